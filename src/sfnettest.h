@@ -235,9 +235,46 @@ extern void sfnt_dump_sys_info(const struct sfnt_tsc_params* tsc_opt);
  * Time measurement.
  */
 
+/* Sources for sfnt_tsc().  The default reads the CPU's counter directly
+ * (rdtsc, mftb or cntvct_el0).  The clock_gettime() sources tick in
+ * nanoseconds, and are read via the vDSO where the kernel provides one.
+ */
+enum sfnt_timer {
+  SFNT_TIMER_TSC,
+  SFNT_TIMER_TSC_LFENCE,      /* lfence; rdtsc: not reordered earlier */
+  SFNT_TIMER_RDTSCP,          /* waits for earlier instructions */
+  SFNT_TIMER_MONOTONIC,
+  SFNT_TIMER_MONOTONIC_RAW,
+  SFNT_TIMER_TAI,
+};
+
+extern enum sfnt_timer sfnt_timer;
+
+/* Select the source used by sfnt_tsc().  Must be called before
+ * sfnt_tsc_get_params().  Returns -EINVAL if [name] is not known and
+ * -ENOSYS if the source is not available on this platform.
+ */
+extern int sfnt_timer_select(const char* name);
+
+extern const char* sfnt_timer_name(enum sfnt_timer);
+
+/* Read a source other than SFNT_TIMER_TSC. */
+extern void sfnt_timer_read(uint64_t* pval);
+
+static inline void sfnt_tsc(uint64_t* pval) {
+  if( sfnt_timer == SFNT_TIMER_TSC )
+    sfnt_tsc_hw(pval);
+  else
+    sfnt_timer_read(pval);
+}
+
 struct sfnt_tsc_params {
   uint64_t  hz;
-  uint64_t  tsc_cost;
+  uint64_t  tsc_cost;     /* of a back-to-back pair of sfnt_tsc() calls */
+  uint64_t  resolution;   /* smallest step seen between reads */
+  uint32_t  mult;         /* ns = ticks * mult >> shift */
+  uint32_t  shift;
+  const char* hz_source;  /* measured, cached, cntfrq or ns */
 };
 
 struct sfnt_tsc_measure {
@@ -247,7 +284,8 @@ struct sfnt_tsc_measure {
 };
 
 /* Measure the speed of the CPU, in the units returned by sfnt_tsc(), and the
- * cost of sfnt_tsc().
+ * cost and resolution of sfnt_tsc().  An invariant TSC's speed is cached
+ * across runs, and checked with a short calibration (see sfnt_tsc.c).
  */
 extern int sfnt_tsc_get_params(struct sfnt_tsc_params*);
 
@@ -266,9 +304,15 @@ extern int64_t sfnt_tsc_msec(const struct sfnt_tsc_params*, int64_t tsc);
 /* Convert tsc delta to microseconds. */
 extern int64_t sfnt_tsc_usec(const struct sfnt_tsc_params*, int64_t tsc);
 
-/* Convert tsc delta to nanoseconds. */
+/* Convert tsc delta to nanoseconds.  Uses a precomputed multiply and
+ * shift, so does not overflow for any delta that fits in int64_t ns.
+ */
 extern int64_t sfnt_tsc_nsec(const struct sfnt_tsc_params*, int64_t tsc);
 
+/* Convert [n] tsc deltas to nanoseconds.  [nsec] may equal [tsc]. */
+extern void sfnt_tsc_nsec_batch(const struct sfnt_tsc_params*,
+                                const int64_t* tsc, int64_t* nsec, int n);
+
 /* Convert milli-seconds delta to tsc. */
 extern int64_t sfnt_msec_tsc(const struct sfnt_tsc_params* params,
 			     int64_t msecs);
@@ -306,6 +350,594 @@ extern void sfnt_iarray_mean_and_limits_int64(const int64_t* start, const int64_
 extern void sfnt_iarray_variance_int64(const int64_t* start, const int64_t* end,
                         int64_t mean, double* variance_out);
 
+/* Sort into ascending order.  These are radix sorts, so much faster than
+ * qsort() for large arrays, but need a temporary copy of the array.
+ */
+extern void sfnt_sort_int64(int64_t* a, int64_t n);
+
+extern void sfnt_sort_int(int* a, int64_t n);
+
+/* Seed the random number generator used by the functions below.  If
+ * [seed] is zero, a seed is chosen from the clock.  Returns the seed used.
+ */
+extern uint64_t sfnt_rand_seed(uint64_t seed);
+
+extern uint64_t sfnt_rand_u64(void);
+
+/* Uniformly distributed in the open interval (0, 1). */
+extern double sfnt_rand_uniform(void);
+
+/* Randomly permute [array]. */
+extern void sfnt_rand_shuffle(int* array, int n);
+
+/**********************************************************************
+ * Histograms.
+ */
+
+/* Log-linear (HDR-style) histogram.  Values below 2^sub_bits are recorded
+ * exactly; above that each power-of-two range is split into
+ * 2^(sub_bits-1) buckets, so the relative error of any reported percentile
+ * is at most 2^-(sub_bits-1).  Memory use is fixed when initialised, and
+ * recording a value is O(1).  Mean, min, max and stddev are exact.
+ */
+struct sfnt_hist {
+  uint64_t* counts;
+  int       n_buckets;
+  int       sub_bits;
+  int       lo_i, hi_i;    /* range of buckets that may be non-empty */
+  uint64_t  n;
+  int64_t   min;
+  int64_t   max;
+  double    mean;
+  double    m2;            /* sum of squared differences from mean */
+};
+
+/* Gives ~0.8% worst case error in about 58KB. */
+#define SFNT_HIST_SUB_BITS  8
+
+/* Returns 0 on success or -ENOMEM. */
+extern int sfnt_hist_init(struct sfnt_hist*, int sub_bits);
+extern void sfnt_hist_free(struct sfnt_hist*);
+extern void sfnt_hist_reset(struct sfnt_hist*);
+
+/* Negative values are counted in the lowest bucket. */
+extern void sfnt_hist_record(struct sfnt_hist*, int64_t v);
+extern void sfnt_hist_record_n(struct sfnt_hist*, int64_t v, uint64_t count);
+
+/* Add the contents of [src] to [dst].  Both must have the same sub_bits. */
+extern void sfnt_hist_merge(struct sfnt_hist* dst, const struct sfnt_hist* src);
+
+extern int64_t sfnt_hist_mean(const struct sfnt_hist*);
+extern double sfnt_hist_stddev(const struct sfnt_hist*);
+
+/* Value at the given percentile, using the same convention as indexing a
+ * sorted array at (n * pct / 100).  The histogram must not be empty.
+ */
+extern int64_t sfnt_hist_percentile(const struct sfnt_hist*, double pct);
+
+/* Value of the [rank]th smallest sample (0-based). */
+extern int64_t sfnt_hist_value_at_rank(const struct sfnt_hist*, uint64_t rank);
+
+/* Compute several percentiles in a single pass.  [pcts] need not be
+ * sorted.
+ */
+extern void sfnt_hist_percentiles(const struct sfnt_hist*, const double* pcts,
+                                  int64_t* vals_out, int n_pcts);
+
+/* Distribution-free confidence interval for the given percentile, from the
+ * binomial distribution of order statistics: [z] is the normal quantile for
+ * the desired confidence (1.96 for 95%).  Returns -1 if there are too few
+ * samples above or below the percentile to bound the interval.
+ */
+extern int sfnt_hist_percentile_ci(const struct sfnt_hist*, double pct,
+                                   double z, int64_t* lo_out, int64_t* hi_out);
+
+/* Index of the bucket that holds [v]. */
+extern int sfnt_hist_bucket(const struct sfnt_hist*, int64_t v);
+
+/* Lower bound and width of bucket [i]. */
+extern int64_t sfnt_hist_bucket_lo(const struct sfnt_hist*, int i);
+extern int64_t sfnt_hist_bucket_width(const struct sfnt_hist*, int i);
+
+/* Save a histogram as text.  [offset] is recorded in the file and should
+ * be added to every value by readers.  Returns 0 or -EIO.
+ */
+extern int sfnt_hist_write(FILE*, const struct sfnt_hist*, int64_t offset);
+
+/* Load a histogram saved by sfnt_hist_write().  Initialises [h], which the
+ * caller must free.  Returns 0, -EINVAL if malformed (including empty, or
+ * with counts that do not add up to n) or -ENOMEM.
+ */
+extern int sfnt_hist_read(FILE*, struct sfnt_hist* h, int64_t* offset_out);
+
+/* Parse a comma separated list of percentiles (eg. "50,99,99.9").  Returns
+ * the number parsed, -EINVAL if malformed or -E2BIG if more than [max_n].
+ */
+extern int sfnt_hist_parse_percentiles(const char* str, double* pcts,
+                                       int max_n);
+
+
+/**********************************************************************
+ * Timelines.
+ */
+
+/* Latency statistics for each fixed interval of a test, for spotting
+ * periodic disturbances that are lost in the summary for the whole test.
+ * Samples must be recorded in time order.  Only intervals that contain at
+ * least one sample are kept.
+ */
+struct sfnt_timeline_row {
+  int64_t   t;             /* start of interval */
+  uint64_t  n;
+  double    mean;
+  int64_t   min, p50, p90, p99, p999, max;
+};
+
+struct sfnt_timeline_heat {
+  int64_t   t;
+  int       col;
+  uint64_t  count;
+};
+
+struct sfnt_timeline {
+  int64_t                    interval;
+  int                        heatmap;
+  struct sfnt_hist           cur;
+  int64_t                    cur_i;
+  struct sfnt_timeline_row*  rows;
+  int                        rows_n, rows_max;
+  struct sfnt_timeline_heat* heat;
+  int                        heat_n, heat_max;
+};
+
+/* [interval] is in the same units as the times passed to
+ * sfnt_timeline_record().  If [heatmap] is set, the number of samples in
+ * each quarter-octave latency range is also kept for each interval.
+ * Returns 0 or -ENOMEM.
+ */
+extern int sfnt_timeline_init(struct sfnt_timeline*, int64_t interval,
+                              int heatmap);
+extern void sfnt_timeline_free(struct sfnt_timeline*);
+extern void sfnt_timeline_reset(struct sfnt_timeline*);
+extern void sfnt_timeline_record(struct sfnt_timeline*, int64_t t, int64_t v);
+
+/* Close the current interval.  Must be called before writing. */
+extern void sfnt_timeline_flush(struct sfnt_timeline*);
+
+/* Write one line per interval: time relative to [t_base] in ms, count, mean,
+ * min, p50, p90, p99, p99.9 and max.  [offset] is added to each latency.
+ * Returns 0 or -EIO.
+ */
+extern int sfnt_timeline_write(const struct sfnt_timeline*, FILE*,
+                               int64_t t_base, int64_t offset, int header);
+
+/* Write one line per non-empty (interval, latency range) cell: time in ms,
+ * range lower and upper bound, and count.
+ */
+extern int sfnt_timeline_write_heatmap(const struct sfnt_timeline*, FILE*,
+                                       int64_t t_base, int64_t offset,
+                                       int header);
+
+
+/**********************************************************************
+ * Structured results.
+ */
+
+/* Results can be written as text (a table with '#' comment lines), or one
+ * row per result as JSON (an object per line), CSV or TSV.  CSV and TSV
+ * rows are preceded by a line of column names whenever the columns change.
+ */
+enum sfnt_format {
+  SFNT_FORMAT_TEXT,
+  SFNT_FORMAT_JSON,
+  SFNT_FORMAT_CSV,
+  SFNT_FORMAT_TSV,
+};
+
+struct sfnt_record_field {
+  char*            key;
+  char*            val;      /* NULL for a missing value */
+  int              is_str;
+};
+
+/* A row of named values, built up with sfnt_record_*() and written with
+ * sfnt_record_write().
+ */
+struct sfnt_record {
+  enum sfnt_format          format;
+  FILE*                     f;
+  struct sfnt_record_field* fields;
+  int                       n_fields;
+  int                       max_fields;
+  char*                     columns;  /* CSV/TSV header last written */
+};
+
+/* Parse "text", "json", "csv" or "tsv".  Returns 0 or -EINVAL. */
+extern int sfnt_format_parse(const char* name, enum sfnt_format* format_out);
+
+/* Reserve stdout for rows of results.  Anything else written to stdout
+ * goes to stderr instead.  Returns a stream for the rows.
+ */
+extern FILE* sfnt_record_take_stdout(void);
+
+/* Rows are written to [f]. */
+extern void sfnt_record_init(struct sfnt_record*, enum sfnt_format,
+                             FILE* f);
+extern void sfnt_record_free(struct sfnt_record*);
+
+/* Add a value.  [val] can be NULL for a missing value.  Floats are given
+ * with [precision] digits after the point, or in the shortest form if
+ * [precision] is negative.
+ */
+extern void sfnt_record_str(struct sfnt_record*, const char* key,
+                            const char* val);
+extern void sfnt_record_int(struct sfnt_record*, const char* key,
+                            int64_t val);
+extern void sfnt_record_float(struct sfnt_record*, const char* key,
+                              double val, int precision);
+
+/* Write the fields as one row, and then discard all except the first
+ * [keep], so that values common to every row need only be added once.
+ */
+extern void sfnt_record_write(struct sfnt_record*, int keep);
+
+/* Add the value of every command line option, with keys "config.<name>".
+ * Options that take a value for each end are given as "<val>;<val>".
+ */
+extern void sfnt_record_cmd_line(struct sfnt_record*);
+
+/* Add the information printed by sfnt_dump_sys_info(), with keys
+ * "sys.<name>".  [tsc_opt] can be NULL.
+ */
+extern void sfnt_record_sys_info(struct sfnt_record*,
+                                 const struct sfnt_tsc_params* tsc_opt);
+
+
+/**********************************************************************
+ * Binary raw results.
+ */
+
+/* A compact file of every sample, written by a background thread while the
+ * test runs.  The file starts with the text line "SFNTRAW1", followed by
+ * "key=value" lines describing the run and an empty line.  The "fields"
+ * key names the values in each record, separated by commas.  Each record
+ * follows, with each value stored as the difference from the same field
+ * in the previous record, zigzag encoded as an unsigned LEB128 varint.
+ */
+#define SFNT_RAWLOG_MAGIC       "SFNTRAW1"
+#define SFNT_RAWLOG_MAX_FIELDS  8
+
+struct sfnt_rawlog {
+  /* Written by the caller's thread. */
+  volatile uint64_t head;
+  uint64_t          tail_cached;
+  uint64_t          n_stalls;
+  volatile uint64_t put_cpu;       /* CPU of first put + 1, or 0 */
+  char              pad1[64];
+  /* Written by the writer thread. */
+  volatile uint64_t tail;
+  volatile uint64_t stop;
+  char              pad2[64];
+  int64_t*          ring;
+  uint64_t          ring_mask;
+  int               n_fields;
+  int               err;
+  FILE*             f;
+  pthread_t         thread;
+};
+
+/* Create [path] and start the writer thread.  The header records the
+ * timer and its frequency from [tsc].  [fields] is a comma
+ * separated list of field names.  [header] holds any further "key=value"
+ * lines, each terminated by a newline, or is NULL.  The writer thread is
+ * moved off the CPU of the thread that calls sfnt_rawlog_put(), which need
+ * not be the caller, where possible.  Returns 0, -errno if the file could
+ * not be created or -EINVAL.
+ */
+extern int sfnt_rawlog_open(struct sfnt_rawlog*, const char* path,
+                            const struct sfnt_tsc_params*,
+                            const char* fields, const char* header);
+
+/* Queue one record of [n_fields] values.  If the writer falls so far
+ * behind that the ring is full, spins until there is room and counts a
+ * stall.
+ */
+extern void sfnt_rawlog_put(struct sfnt_rawlog*, const int64_t* vals);
+
+/* Write out anything queued, stop the writer and close the file.  The
+ * stall count stays valid.  Returns 0 or -errno if writing failed.
+ */
+extern int sfnt_rawlog_close(struct sfnt_rawlog*);
+
+/* Reads a file written by sfnt_rawlog. */
+struct sfnt_rawlog_reader {
+  const uint8_t*    p;
+  const uint8_t*    end;
+  char*             header;
+  int               n_fields;
+  char              fields[SFNT_RAWLOG_MAX_FIELDS][32];
+  uint64_t          prev[SFNT_RAWLOG_MAX_FIELDS];
+  int               truncated;
+};
+
+/* Parse the header of a binary raw file held in memory.  Records are
+ * decoded in place, so the buffer must outlive the reader.  Returns 0 or
+ * -EINVAL if this is not a binary raw file.
+ */
+extern int sfnt_rawlog_reader_init(struct sfnt_rawlog_reader*,
+                                   const void* buf, size_t len);
+extern void sfnt_rawlog_reader_free(struct sfnt_rawlog_reader*);
+
+/* Value of [key] from the header, or NULL if absent. */
+extern const char* sfnt_rawlog_reader_get(const struct sfnt_rawlog_reader*,
+                                          const char* key, char* buf,
+                                          int buf_len);
+
+/* Index of the named field, or -1. */
+extern int sfnt_rawlog_reader_field(const struct sfnt_rawlog_reader*,
+                                    const char* name);
+
+/* Decode the next record into [vals].  Returns 1, 0 at the end of the
+ * file or -EINVAL if the file is corrupt.  A file that ends part way
+ * through a record (eg. because the test was killed) ends at the last
+ * complete record, and [truncated] is set.
+ */
+extern int sfnt_rawlog_reader_next(struct sfnt_rawlog_reader*, int64_t* vals);
+
+
+/**********************************************************************
+ * Stall detection.
+ */
+
+#define SFNT_IRQ_NAME_LEN  32
+
+/* Snapshot of /proc/interrupts or /proc/softirqs (Linux only). */
+struct sfnt_irq_snap {
+  int       n_cpus;
+  int*      cpu_ids;
+  int       n_lines, max_lines;
+  char    (*names)[SFNT_IRQ_NAME_LEN];
+  uint64_t* counts;        /* [line * n_cpus + cpu column] */
+};
+
+/* Returns 0, -EINVAL if malformed, -ENOSYS if not supported or -errno. */
+extern int sfnt_irq_snap_read(struct sfnt_irq_snap*, const char* path);
+extern void sfnt_irq_snap_free(struct sfnt_irq_snap*);
+
+/* Print "name:delta,..." for each counter that changed on any of the given
+ * CPUs, or "-" if none did.  Returns the number of counters printed.
+ */
+extern int sfnt_irq_snap_fprint_delta(FILE*, const struct sfnt_irq_snap* before,
+                                      const struct sfnt_irq_snap* after,
+                                      const int* cpus, int n_cpus);
+
+/* Logs the likely causes of each sample that exceeds a latency threshold:
+ * CPU migration, context switches of the calling thread, and interrupts and
+ * softirqs on its CPU.  sfnt_stall_check() must be called from the thread
+ * being measured, once per sample and outside the timed region.  It only
+ * reads counters when a stall is seen, so causes are reported as deltas
+ * over the window since the previous stall or sfnt_stall_rebase().
+ */
+struct sfnt_stall {
+  const struct sfnt_tsc_params* tsc;
+  int64_t              threshold;
+  FILE*                log;
+  int                  cpu;
+  long                 nvcsw, nivcsw;
+  uint64_t             win_ts;
+  int                  base;
+  struct sfnt_irq_snap irq[2];
+  struct sfnt_irq_snap softirq[2];
+  uint64_t             n_stalls;
+};
+
+/* [key_name] heads the column given by the [key] argument of
+ * sfnt_stall_check() (eg. message size).
+ */
+extern int sfnt_stall_init(struct sfnt_stall*, const struct sfnt_tsc_params*,
+                           int64_t threshold, FILE* log, const char* key_name);
+extern void sfnt_stall_free(struct sfnt_stall*);
+
+/* Start a new baseline, eg. after a gap in measurement. */
+extern void sfnt_stall_rebase(struct sfnt_stall*);
+
+/* Returns 1 if [lat] was a stall and has been logged, else 0. */
+extern int sfnt_stall_check(struct sfnt_stall*, int64_t lat, double t_ms,
+                            int key);
+
+
+/**********************************************************************
+ * OS noise.
+ */
+
+#define SFNT_NOISE_BUCKETS  20
+
+/* Gaps seen by a thread spinning on the TSC.  All times are in ns.
+ * buckets[i] counts gaps in [threshold * 2^i, threshold * 2^(i+1)), and
+ * the last bucket also counts longer gaps.
+ */
+struct sfnt_noise {
+  int64_t  duration;
+  int64_t  threshold;
+  uint64_t n_gaps;
+  int64_t  stolen;
+  int64_t  max_gap;
+  uint64_t buckets[SFNT_NOISE_BUCKETS];
+};
+
+/* Spin on the calling thread for [millisec], recording every gap longer
+ * than [threshold] ns.
+ */
+extern void sfnt_noise_measure(struct sfnt_noise*,
+                               const struct sfnt_tsc_params*,
+                               int millisec, int64_t threshold);
+
+/* Percentage of the time that was lost in gaps. */
+extern double sfnt_noise_stolen_pct(const struct sfnt_noise*);
+
+extern void sfnt_noise_print(FILE*, const char* who, const struct sfnt_noise*);
+
+/* Send or receive results over a control socket. */
+extern void sfnt_noise_put(int fd, const struct sfnt_noise*);
+extern void sfnt_noise_get(int fd, struct sfnt_noise*);
+
+
+/**********************************************************************
+ * Static probes.
+ */
+
+/* USDT probes in provider "sfnt", for use with bpftrace, perf probe or
+ * systemtap.  A probe that is not attached costs a single nop.  Probes:
+ *
+ *   ping_send(size)            sfnt-pingpong client before sending a ping
+ *   pong_recv(size)            sfnt-pingpong client on receiving the pong
+ *   ping_done(size, iter, ns)  sfnt-pingpong client latency of an iteration
+ *   server_recv(size)          sfnt-pingpong server on receiving a ping
+ *   server_reply(size)         sfnt-pingpong server before replying
+ *   stream_send(seq, late)     sfnt-stream client before sending; late is
+ *                              ticks behind schedule
+ *   rx_save(seq, ns)           sfnt-stream client recording a reply
+ *   sync_send(seq, flags)      sfnt-stream client sending a sync
+ *   sync_recv(seq, flags)      sfnt-stream client receiving a sync reply
+ *   stream_reply(seq, flags)   sfnt-stream server sending a reply
+ *   mux_wait()                 before select(), poll() or epoll_wait()
+ *   mux_wake(rc)               after select(), poll() or epoll_wait()
+ */
+#if NT_HAVE_SDT
+# define SFNT_PROBE0(name)             DTRACE_PROBE(sfnt, name)
+# define SFNT_PROBE1(name, a)          DTRACE_PROBE1(sfnt, name, a)
+# define SFNT_PROBE2(name, a, b)       DTRACE_PROBE2(sfnt, name, a, b)
+# define SFNT_PROBE3(name, a, b, c)    DTRACE_PROBE3(sfnt, name, a, b, c)
+#else
+# define SFNT_PROBE0(name)             do{}while(0)
+# define SFNT_PROBE1(name, a)          do{}while(0)
+# define SFNT_PROBE2(name, a, b)       do{}while(0)
+# define SFNT_PROBE3(name, a, b, c)    do{}while(0)
+#endif
+
+
+/**********************************************************************
+ * Performance counters.
+ */
+
+#define SFNT_PERF_MAX  16
+
+/* A group of counters on the calling thread.  Counters that could not be
+ * opened have fds[i] < 0 and the reason in errs[i].
+ */
+struct sfnt_perf {
+  int         n;
+  const char* names[SFNT_PERF_MAX];
+  int         fds[SFNT_PERF_MAX];
+  int         errs[SFNT_PERF_MAX];
+  int         slot[SFNT_PERF_MAX];
+  int         n_open;
+  int         leader;
+};
+
+struct sfnt_perf_sample {
+  uint64_t enabled;
+  uint64_t running;
+  uint64_t vals[SFNT_PERF_MAX];
+};
+
+/* Open the comma separated list of [events] (eg. "cycles,instructions") on
+ * the calling thread, initially disabled.  Returns -EINVAL if an event is
+ * not known, or -ENOSYS if not supported on this platform, in which case
+ * no counters are open and n is zero.
+ */
+extern int sfnt_perf_open(struct sfnt_perf*, const char* events);
+extern void sfnt_perf_close(struct sfnt_perf*);
+extern void sfnt_perf_enable(const struct sfnt_perf*);
+extern void sfnt_perf_disable(const struct sfnt_perf*);
+extern void sfnt_perf_sample(const struct sfnt_perf*,
+                             struct sfnt_perf_sample*);
+
+/* Counts between two samples, scaled up if the counters were multiplexed.
+ * Counters that are unavailable give -1.
+ */
+extern void sfnt_perf_delta(const struct sfnt_perf*,
+                            const struct sfnt_perf_sample* before,
+                            const struct sfnt_perf_sample* after,
+                            int64_t* deltas);
+
+extern void sfnt_perf_print_unavailable(FILE*, const char* who,
+                                        const struct sfnt_perf*);
+
+/* User and system CPU time (nanoseconds) consumed by the calling thread.
+ * Zero on platforms that do not account per thread.
+ */
+struct sfnt_cpu_usage {
+  int64_t user;
+  int64_t sys;
+};
+
+extern void sfnt_cpu_usage_thread(struct sfnt_cpu_usage*);
+
+/* Scheduler statistics for the calling thread.  Fields that are not
+ * available on this platform or kernel are -1.
+ */
+struct sfnt_sched_stats {
+  int64_t run_delay;     /* ns spent runnable waiting for a CPU */
+  int64_t n_runs;        /* times the thread was given a CPU */
+  int64_t n_switches;    /* voluntary and involuntary context switches */
+  int64_t n_migrations;
+};
+
+extern void sfnt_sched_stats_thread(struct sfnt_sched_stats*);
+extern void sfnt_sched_stats_delta(const struct sfnt_sched_stats* before,
+                                   const struct sfnt_sched_stats* after,
+                                   struct sfnt_sched_stats* delta);
+/* Add [delta] to [sum].  A field unavailable in either is unavailable. */
+extern void sfnt_sched_stats_add(struct sfnt_sched_stats* sum,
+                                 const struct sfnt_sched_stats* delta);
+extern void sfnt_sched_stats_put(int fd, const struct sfnt_sched_stats*);
+extern void sfnt_sched_stats_get(int fd, struct sfnt_sched_stats*);
+
+
+/**********************************************************************
+ * Energy counters.
+ */
+
+#define SFNT_ENERGY_MAX       8
+#define SFNT_ENERGY_NAME_LEN  32
+
+/* Package and core energy domains of the RAPL powercap interface.  These
+ * count for the whole host, not just this process.
+ */
+struct sfnt_energy {
+  int      n;
+  char     names[SFNT_ENERGY_MAX][SFNT_ENERGY_NAME_LEN];
+  char*    paths[SFNT_ENERGY_MAX];
+  uint64_t range[SFNT_ENERGY_MAX];  /* counter wraps here, or 0 */
+};
+
+/* A counter that could not be read is SFNT_ENERGY_UNKNOWN. */
+#define SFNT_ENERGY_UNKNOWN   UINT64_MAX
+
+struct sfnt_energy_sample {
+  uint64_t uj[SFNT_ENERGY_MAX];
+};
+
+/* Find the energy domains under /sys/class/powercap, or under
+ * $SFNT_POWERCAP_ROOT if set.  Returns -errno if there are none that can
+ * be read (eg. -ENOENT, or -EACCES if not root).
+ */
+extern int sfnt_energy_open(struct sfnt_energy*);
+extern void sfnt_energy_close(struct sfnt_energy*);
+extern void sfnt_energy_sample(const struct sfnt_energy*,
+                               struct sfnt_energy_sample*);
+
+/* Microjoules used in each domain between two samples.  This is -1 if
+ * either sample could not be read, or if the counter wrapped and its range
+ * is not known.
+ */
+extern void sfnt_energy_delta(const struct sfnt_energy*,
+                              const struct sfnt_energy_sample* before,
+                              const struct sfnt_energy_sample* after,
+                              int64_t* uj);
+
+
 /**********************************************************************
  * File / muxer convenience functions.
  */
@@ -319,6 +951,11 @@ enum sfnt_mux_flags {
   NT_MUX_CONTINUE_ON_EINTR = 0x2,
 };
 
+/* Count of select(), poll() and epoll_wait() calls made by the functions
+ * below, so that callers can see how many times a spinning wait went round.
+ */
+extern uint64_t sfnt_mux_calls;
+
 /* Calls select().  Adds option to spin and option to continue to wait if
  * interrupted by signal.  [timeout_ms] behaves like poll().
  */
@@ -429,8 +1066,30 @@ extern int sfnt_sock_set_timeout(int sock, int send_or_recv, int millisec);
 extern int sfnt_sock_cork(int fd);
 extern int sfnt_sock_uncork(int fd);
 
+/* Summary of the kernel's TCP_INFO for a connected socket.  Fields that
+ * this kernel does not report are -1.
+ */
+struct sfnt_tcp_info {
+  int64_t rtt;            /* smoothed RTT, usec */
+  int64_t rttvar;         /* usec */
+  int64_t total_retrans;
+  int64_t unacked;        /* segments */
+  int64_t snd_cwnd;       /* segments */
+  int64_t pacing_rate;    /* bytes/sec */
+  int64_t delivery_rate;  /* bytes/sec */
+};
+
+/* Returns 0, or -errno (-ENOSYS if not supported on this platform). */
+extern int sfnt_tcp_info_read(int sock, struct sfnt_tcp_info*);
+extern void sfnt_tcp_info_put(int fd, const struct sfnt_tcp_info*);
+extern void sfnt_tcp_info_get(int fd, struct sfnt_tcp_info*);
+
 extern void sfnt_sock_put_int(int fd, int v);
 extern int  sfnt_sock_get_int(int fd);
+extern void sfnt_sock_put_int64(int fd, int64_t v);
+extern int64_t sfnt_sock_get_int64(int fd);
+extern void sfnt_sock_put_int64s(int fd, const int64_t* v, int n);
+extern void sfnt_sock_get_int64s(int fd, int64_t* v, int n);
 extern void  sfnt_sock_put_str(int fd, const char* str);
 extern char* sfnt_sock_get_str(int fd);
 extern void sfnt_sock_put_sockaddr(int fd, const struct sockaddr_storage*);
@@ -18,16 +18,19 @@
 #define NT_PRINTF_LIKE(a, b)  __attribute__((format(printf,a,b)))
 
 
+/* Read the CPU's cycle or timebase counter.  Use sfnt_tsc() instead, which
+ * honours the selected timer source.
+ */
 #ifdef __x86_64__
-static inline void sfnt_tsc(uint64_t* pval) {
+static inline void sfnt_tsc_hw(uint64_t* pval) {
   uint64_t low, high;
   __asm__ __volatile__("rdtsc" : "=a" (low) , "=d" (high));             
   *pval = (high << 32) | low;
 }
 #elif defined(__i386__)
-# define sfnt_tsc(pval)  __asm__ __volatile__("rdtsc" : "=A" (*(pval)))
+# define sfnt_tsc_hw(pval)  __asm__ __volatile__("rdtsc" : "=A" (*(pval)))
 #elif defined(__PPC__)
-static inline void sfnt_tsc(uint64_t* pval) {
+static inline void sfnt_tsc_hw(uint64_t* pval) {
   uint64_t upper, lower, tmp;
   __asm__ volatile(
                    "0:                  \n"
@@ -41,10 +44,25 @@ static inline void sfnt_tsc(uint64_t* pval) {
   *pval = (upper << 32) | lower;
 }
 #elif defined(__aarch64__)
-# define sfnt_tsc(pval)  __asm__ __volatile__("isb; mrs %0, cntvct_el0": "=r" (*(pval)))
+# define sfnt_tsc_hw(pval)  __asm__ __volatile__("isb; mrs %0, cntvct_el0": "=r" (*(pval)))
 #else
 # error Unknown processor.
 #endif
 
 
+/* Ordered loads and stores for passing data between threads without locks.
+ * The release store makes all earlier writes visible to a thread that sees
+ * the stored value with an acquire load.
+ */
+static inline uint64_t sfnt_load_acquire(const volatile uint64_t* p)
+{
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void sfnt_store_release(volatile uint64_t* p, uint64_t v)
+{
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+
 #endif  /* __NETTEST_GCC_H__ */
@@ -76,11 +76,33 @@
 
 #pragma intrinsic(__rdtsc)
 
-static inline void sfnt_tsc(uint64_t* pval) {
+static inline void sfnt_tsc_hw(uint64_t* pval) {
   uint64_t tsc;
 
   tsc = __rdtsc();
   *pval = tsc;
 }
 
+
+/**********************************************************************
+ * Ordered loads and stores for passing data between threads without
+ * locks.  x86 does not reorder loads with loads or stores with stores, so
+ * it is enough to stop the compiler doing so.
+ */
+
+#pragma intrinsic(_ReadWriteBarrier)
+
+static inline uint64_t sfnt_load_acquire(const volatile uint64_t* p)
+{
+  uint64_t v = *p;
+  _ReadWriteBarrier();
+  return v;
+}
+
+static inline void sfnt_store_release(volatile uint64_t* p, uint64_t v)
+{
+  _ReadWriteBarrier();
+  *p = v;
+}
+
 #endif  /* __NETTEST_MSVC_H__ */
@@ -90,6 +90,60 @@
 # error "Please define NT_HAVE_IP_MREQN for this platform"
 #endif
 
+#if defined(__linux__)
+# define NT_HAVE_SO_TIMESTAMPING 1
+# include <linux/net_tstamp.h>
+# include <linux/errqueue.h>
+#elif defined(__sun__) || defined(__APPLE__) || defined(__FreeBSD__)
+# define NT_HAVE_SO_TIMESTAMPING 0
+#else
+# error "Please define NT_HAVE_SO_TIMESTAMPING for this platform"
+#endif
+
+#if defined(__linux__)
+# define NT_HAVE_PERF_EVENT 1
+# include <linux/perf_event.h>
+# include <sys/syscall.h>
+#elif defined(__sun__) || defined(__APPLE__) || defined(__FreeBSD__)
+# define NT_HAVE_PERF_EVENT 0
+#else
+# error "Please define NT_HAVE_PERF_EVENT for this platform"
+#endif
+
+#if defined(__linux__)
+# define NT_HAVE_TCP_INFO 1
+#elif defined(__sun__) || defined(__APPLE__) || defined(__FreeBSD__)
+# define NT_HAVE_TCP_INFO 0
+#else
+# error "Please define NT_HAVE_TCP_INFO for this platform"
+#endif
+
+#if defined(__linux__)
+# define NT_HAVE_TIMERSLACK 1
+# include <sys/prctl.h>
+#elif defined(__sun__) || defined(__APPLE__) || defined(__FreeBSD__)
+# define NT_HAVE_TIMERSLACK 0
+#else
+# error "Please define NT_HAVE_TIMERSLACK for this platform"
+#endif
+
+/* USDT probes are built in if systemtap's <sys/sdt.h> is installed.  Build
+ * with -DNT_HAVE_SDT=0 to leave them out.
+ */
+#ifndef NT_HAVE_SDT
+# if defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#   define NT_HAVE_SDT 1
+#  endif
+# endif
+#endif
+#ifndef NT_HAVE_SDT
+# define NT_HAVE_SDT 0
+#endif
+#if NT_HAVE_SDT
+# include <sys/sdt.h>
+#endif
+
 #if defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__)
 # define NT_HAVE_FIONBIO 1
 #elif defined(__sun__) 
@@ -50,6 +50,11 @@
 #define NT_HAVE_POLL       0
 #define NT_HAVE_EPOLL      0
 
+#define NT_HAVE_SO_TIMESTAMPING 0
+#define NT_HAVE_PERF_EVENT 0
+#define NT_HAVE_TCP_INFO   0
+#define NT_HAVE_SDT        0
+
 
 /**********************************************************************
  * Work-around WIN32 breakage of sockets interface.
@@ -403,4 +408,16 @@ static inline int __nt_pthread_create(pthread_t* thread,
 #define pthread_create __nt_pthread_create
 
 
+static inline int __nt_pthread_join(pthread_t thread, void** retval)
+{
+  if (WaitForSingleObject(thread, INFINITE) != WAIT_OBJECT_0)
+    return EINVAL;
+  CloseHandle(thread);
+  if (retval)
+    *retval = NULL;
+  return 0;
+}
+#define pthread_join __nt_pthread_join
+
+
 #endif  /* __SFNETTEST_WIN32_H__ */
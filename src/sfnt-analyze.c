@@ -0,0 +1,565 @@
+/**************************************************************************\
+*    Filename: sfnt-analyze.c
+* Description: Analyse raw results saved by sfnt-pingpong/sfnt-stream.
+*   Copyright: (C) 2012-2023 Advanced Micro Devices, Inc.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation, incorporated herein by reference.
+\**************************************************************************/
+
+/* Reads result files written with --raw, as text or with
+ * --raw-format=bin, and reports the latency distribution of each.  The
+ * samples considered can be restricted (--skip, --startms, --endms), so
+ * that archived runs can be re-analysed with different parameters without
+ * running the test again.  Optionally writes histograms (which sfnt-compare
+ * can read), CDF tables and timelines.
+ *
+ * Files are memory mapped and shared out between worker threads, one file
+ * at a time.  Each worker allocates a histogram only for the file it is
+ * reading, and keeps just the summary, so archives of many files can be
+ * read in little memory.
+ */
+
+#include "sfnettest.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+static const char* cfg_percentiles = "50,90,99,99.9";
+static int64_t     cfg_skip;
+static int         cfg_startms;
+static int         cfg_endms;
+static int         cfg_exact;
+static int         cfg_merge;
+static int         cfg_threads;
+static const char* cfg_histfile;
+static const char* cfg_cdf;
+static const char* cfg_timeline;
+static int         cfg_interval = 100;
+
+#define CL1(a, b, c, d)  SFNT_CLA(a, b, &(c), d)
+#define CL1F(a, c, d)    CL1(a, FLAG, c, d)
+#define CL1I(a, c, d)    CL1(a, INT, c, d)
+#define CL1S(a, c, d)    CL1(a, STR, c, d)
+#define CL1L(a, c, d)    CL1(a, INT64, c, d)
+
+static struct sfnt_cmd_line_opt cfg_opts[] = {
+  CL1S("percentiles", cfg_percentiles, "percentiles to report"               ),
+  CL1L("skip",        cfg_skip,        "skip first N samples of each file"   ),
+  CL1I("startms",     cfg_startms,     "skip first N ms of each file"        ),
+  CL1I("endms",       cfg_endms,       "ignore samples after N ms"           ),
+  CL1F("exact",       cfg_exact,       "exact percentiles (uses more memory)"),
+  CL1F("merge",       cfg_merge,       "also report all files combined"      ),
+  CL1I("threads",     cfg_threads,     "worker threads (default: all CPUs)"  ),
+  CL1S("histfile",    cfg_histfile,    "save latency histograms to files"    ),
+  CL1S("cdf",         cfg_cdf,         "save CDF tables to files"            ),
+  CL1S("timeline",    cfg_timeline,    "save per-interval stats to files"    ),
+  CL1I("interval",    cfg_interval,    "timeline interval (ms)"              ),
+};
+#define N_CFG_OPTS (sizeof(cfg_opts) / sizeof(cfg_opts[0]))
+
+
+#define MAX_PERCENTILES    32
+
+#define PT_CHK(cmd)  NT_TESTi3(cmd, ==, 0)
+
+
+struct result {
+  const char*      path;
+  char*            name;        /* see name_results() */
+  struct sfnt_hist hist;        /* only while the file is being read */
+  /* Summary kept once the file has been read. */
+  uint64_t         n;
+  int64_t          mean, min, max, stddev;
+  int64_t          pct_vals[MAX_PERCENTILES];
+  int64_t*         samples;     /* only with --exact */
+  int64_t          samples_n, samples_max;
+  /* Applying --skip, --startms and --endms. */
+  int              has_times;
+  int64_t          seen;
+  int64_t          t0;
+  struct sfnt_timeline timeline;
+  int              truncated;   /* ended part way through a record */
+  char             err[128];    /* empty if no error */
+};
+
+
+static double          pcts[MAX_PERCENTILES];
+static int             pcts_n;
+static int64_t         start_ns, end_ns;
+static struct result*  results;
+static int             results_n;
+static int             next_result;
+static pthread_mutex_t next_lock;
+static struct result   all;         /* with --merge */
+static pthread_mutex_t all_lock;
+
+
+static void sample_add(struct result* r, int64_t t, int64_t lat)
+{
+  if( r->has_times ) {
+    if( r->seen == 0 )
+      r->t0 = t;
+    t -= r->t0;
+  }
+  if( r->seen++ < cfg_skip )
+    return;
+  if( r->has_times ) {
+    if( t < start_ns || (end_ns && t >= end_ns) )
+      return;
+    if( cfg_timeline != NULL )
+      sfnt_timeline_record(&r->timeline, t, lat);
+  }
+  sfnt_hist_record(&r->hist, lat);
+  if( cfg_exact ) {
+    if( r->samples_n == r->samples_max ) {
+      r->samples_max = r->samples_max ? r->samples_max * 2 : 65536;
+      r->samples = realloc(r->samples,
+                           r->samples_max * sizeof(r->samples[0]));
+      NT_TEST(r->samples != NULL);
+    }
+    r->samples[r->samples_n++] = lat;
+  }
+}
+
+
+/* Binary files from either tool have a latency_ns field.  sfnt-pingpong
+ * gives the time of each sample in time_ns, and sfnt-stream the time it
+ * should have been sent in send_target_ns.
+ */
+static int analyze_bin(struct result* r, const void* buf, size_t len)
+{
+  struct sfnt_rawlog_reader rd;
+  int64_t vals[SFNT_RAWLOG_MAX_FIELDS];
+  int rc, lat_f, t_f;
+
+  if( sfnt_rawlog_reader_init(&rd, buf, len) < 0 )
+    return -EINVAL;
+  if( (t_f = sfnt_rawlog_reader_field(&rd, "time_ns")) < 0 )
+    t_f = sfnt_rawlog_reader_field(&rd, "send_target_ns");
+  r->has_times = t_f >= 0;
+  if( (lat_f = sfnt_rawlog_reader_field(&rd, "latency_ns")) < 0 )
+    rc = -EINVAL;
+  else
+    while( (rc = sfnt_rawlog_reader_next(&rd, vals)) > 0 )
+      sample_add(r, t_f >= 0 ? vals[t_f] : 0, vals[lat_f]);
+  r->truncated = rd.truncated;
+  sfnt_rawlog_reader_free(&rd);
+  return rc;
+}
+
+
+/* Parse a number written with %d or %.9f, giving its integer part and its
+ * value in billionths.  Returns NULL if there is no number at [p].
+ */
+static const char* parse_num(const char* p, const char* end,
+                             int64_t* int_part, int64_t* nanos)
+{
+  uint64_t ip = 0;
+  int64_t frac = 0, scale = 100000000;
+  int neg = 0;
+
+  while( p < end && (*p == ' ' || *p == '\t') )
+    ++p;
+  if( p < end && *p == '-' ) {
+    neg = 1;
+    ++p;
+  }
+  if( p == end || ! isdigit(*p) )
+    return NULL;
+  for( ; p < end && isdigit(*p); ++p )
+    ip = ip * 10 + (*p - '0');
+  if( p < end && *p == '.' )
+    for( ++p; p < end && isdigit(*p); ++p, scale /= 10 )
+      frac += (*p - '0') * scale;
+  /* Unsigned, so that nonsense wraps rather than overflows. */
+  *int_part = neg ? -(int64_t) ip : (int64_t) ip;
+  *nanos = (int64_t) (ip * 1000000000 + frac);
+  if( neg )
+    *nanos = -*nanos;
+  return p;
+}
+
+
+/* As in sfnt-compare: text files written by sfnt-pingpong have one latency
+ * (ns) per line.  Those written by sfnt-stream have the target send time
+ * first and the latency last, both in seconds.
+ */
+static int analyze_text(struct result* r, const char* p, const char* end)
+{
+  int64_t first_i = 0, first_ns = 0, last_ns = 0, ip, ns;
+  const char* eol;
+  const char* q;
+  int n_fields;
+
+  r->has_times = -1;
+  for( ; p < end; p = eol + 1 ) {
+    if( (eol = memchr(p, '\n', end - p)) == NULL )
+      eol = end;
+    if( *p == '#' )
+      continue;
+    for( n_fields = 0; (q = parse_num(p, eol, &ip, &ns)) != NULL; p = q ) {
+      if( n_fields++ == 0 ) {
+        first_i = ip;
+        first_ns = ns;
+      }
+      last_ns = ns;
+    }
+    if( n_fields == 0 )
+      continue;
+    if( r->has_times < 0 )
+      r->has_times = n_fields > 1;
+    if( n_fields > 1 )
+      sample_add(r, first_ns, last_ns);
+    else
+      sample_add(r, 0, first_i);
+  }
+  return 0;
+}
+
+
+static FILE* open_output(struct result* r, const char* prefix,
+                         const char* suffix)
+{
+  char* fname = alloca(strlen(prefix) + strlen(r->name) + 20);
+  FILE* f;
+  sprintf(fname, "%s-%s.%s", prefix, r->name, suffix);
+  if( (f = fopen(fname, "w")) == NULL )
+    snprintf(r->err, sizeof(r->err), "could not create '%s' (%s)",
+             fname, strerror(errno));
+  return f;
+}
+
+
+/* Fraction of samples at or below the top of each non-empty bucket. */
+static void write_cdf(FILE* f, const struct sfnt_hist* h)
+{
+  uint64_t cum = 0;
+  int64_t v;
+  int i;
+
+  fprintf(f, "#latency(ns)\tcount\tfraction\n");
+  for( i = h->lo_i; i <= h->hi_i; ++i )
+    if( h->counts[i] ) {
+      cum += h->counts[i];
+      v = sfnt_hist_bucket_lo(h, i) + sfnt_hist_bucket_width(h, i) - 1;
+      if( v > h->max )
+        v = h->max;
+      fprintf(f, "%"PRId64"\t%"PRIu64"\t%.9f\n", v, h->counts[i],
+              (double) cum / h->n);
+    }
+}
+
+
+static void write_outputs(struct result* r)
+{
+  FILE* f;
+
+  if( cfg_histfile != NULL && (f = open_output(r, cfg_histfile, "hist")) ) {
+    if( sfnt_hist_write(f, &r->hist, 0) < 0 )
+      snprintf(r->err, sizeof(r->err), "error writing histogram");
+    fclose(f);
+  }
+  if( cfg_cdf != NULL && (f = open_output(r, cfg_cdf, "cdf")) ) {
+    write_cdf(f, &r->hist);
+    fclose(f);
+  }
+  if( cfg_timeline != NULL && (f = open_output(r, cfg_timeline,
+                                               "timeline")) ) {
+    sfnt_timeline_flush(&r->timeline);
+    if( sfnt_timeline_write(&r->timeline, f, 0, 0, 1) < 0 )
+      snprintf(r->err, sizeof(r->err), "error writing timeline");
+    fclose(f);
+  }
+}
+
+
+/* Same convention as sfnt_hist_percentile(). */
+static void get_summary(struct result* r)
+{
+  const struct sfnt_hist* h = &r->hist;
+  int64_t n = r->samples_n, i;
+  int j;
+
+  if( (r->n = h->n) == 0 )
+    return;
+  r->mean = sfnt_hist_mean(h);
+  r->min = h->min;
+  r->max = h->max;
+  r->stddev = (int64_t) sfnt_hist_stddev(h);
+  if( ! cfg_exact ) {
+    sfnt_hist_percentiles(&r->hist, pcts, r->pct_vals, pcts_n);
+    return;
+  }
+  sfnt_sort_int64(r->samples, n);
+  for( j = 0; j < pcts_n; ++j ) {
+    i = (int64_t) (n * pcts[j] / 100);
+    r->pct_vals[j] = r->samples[i < 0 ? 0 : i >= n ? n - 1 : i];
+  }
+}
+
+
+/* Add a file's results to [all]. */
+static void merge_result(const struct result* r)
+{
+  PT_CHK(pthread_mutex_lock(&all_lock));
+  sfnt_hist_merge(&all.hist, &r->hist);
+  if( cfg_exact && r->samples_n ) {
+    all.samples = realloc(all.samples, (all.samples_n + r->samples_n) *
+                          sizeof(all.samples[0]));
+    NT_TEST(all.samples != NULL);
+    memcpy(all.samples + all.samples_n, r->samples,
+           r->samples_n * sizeof(r->samples[0]));
+    all.samples_n += r->samples_n;
+  }
+  PT_CHK(pthread_mutex_unlock(&all_lock));
+}
+
+
+static void analyze_file2(struct result* r)
+{
+  size_t magic_len = strlen(SFNT_RAWLOG_MAGIC"\n");
+  struct stat st;
+  void* map;
+  int fd, rc;
+
+  if( (fd = open(r->path, O_RDONLY)) < 0 || fstat(fd, &st) < 0 ) {
+    snprintf(r->err, sizeof(r->err), "%s", strerror(errno));
+    if( fd >= 0 )
+      close(fd);
+    return;
+  }
+  if( st.st_size == 0 ) {
+    close(fd);
+    return;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if( map == MAP_FAILED ) {
+    snprintf(r->err, sizeof(r->err), "mmap failed (%s)", strerror(errno));
+    return;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  if( st.st_size >= magic_len &&
+      ! memcmp(map, SFNT_RAWLOG_MAGIC"\n", magic_len) )
+    rc = analyze_bin(r, map, st.st_size);
+  else
+    rc = analyze_text(r, map, (const char*) map + st.st_size);
+  munmap(map, st.st_size);
+  if( rc < 0 ) {
+    snprintf(r->err, sizeof(r->err), "malformed");
+    return;
+  }
+  if( r->has_times <= 0 && (start_ns || end_ns || cfg_timeline != NULL) ) {
+    snprintf(r->err, sizeof(r->err), "no timestamps (needed by --startms, "
+             "--endms and --timeline)");
+    return;
+  }
+
+  get_summary(r);
+  write_outputs(r);
+  if( cfg_merge )
+    merge_result(r);
+}
+
+
+static void analyze_file(struct result* r)
+{
+  NT_TEST(sfnt_hist_init(&r->hist, SFNT_HIST_SUB_BITS) == 0);
+  if( cfg_timeline != NULL )
+    NT_TEST(sfnt_timeline_init(&r->timeline,
+                               cfg_interval * (int64_t) 1000000, 0) == 0);
+  analyze_file2(r);
+  sfnt_hist_free(&r->hist);
+  if( cfg_timeline != NULL )
+    sfnt_timeline_free(&r->timeline);
+  free(r->samples);
+  r->samples = NULL;
+}
+
+
+static void* worker_thread(void* arg)
+{
+  int i;
+  while( 1 ) {
+    PT_CHK(pthread_mutex_lock(&next_lock));
+    i = next_result++;
+    PT_CHK(pthread_mutex_unlock(&next_lock));
+    if( i >= results_n )
+      break;
+    analyze_file(&results[i]);
+  }
+  return NULL;
+}
+
+
+/* Name of the result from [r->path], without the suffix.  If [full], the
+ * directories are kept, with '/' replaced by '_'.
+ */
+static void result_set_name(struct result* r, int full)
+{
+  const char* base = strrchr(r->path, '/');
+  const char* dot;
+  char* p;
+
+  if( full ) {
+    for( base = r->path; ! strncmp(base, "./", 2) || *base == '/'; )
+      base += *base == '/' ? 1 : 2;
+  }
+  else {
+    base = base ? base + 1 : r->path;
+  }
+  if( (dot = strrchr(base, '.')) == NULL || dot == base || dot[-1] == '/' ||
+      strchr(dot, '/') != NULL )
+    dot = base + strlen(base);
+  free(r->name);
+  NT_TEST((r->name = strndup(base, dot - base)) != NULL);
+  for( p = r->name; (p = strchr(p, '/')) != NULL; )
+    *p = '_';
+}
+
+
+static int result_name_cmp(const void* pa, const void* pb)
+{
+  const struct result* a = *(const struct result* const*) pa;
+  const struct result* b = *(const struct result* const*) pb;
+  return strcmp(a->name, b->name);
+}
+
+
+/* Results are named after their files, and name the --histfile, --cdf and
+ * --timeline outputs.  Where files in different directories have the same
+ * name, their directories are kept in the name, so that two workers do not
+ * write the same outputs.
+ */
+static void name_results(void)
+{
+  struct result** by_name;
+  int i, j;
+
+  NT_TEST((by_name = malloc(results_n * sizeof(by_name[0]))) != NULL);
+  for( i = 0; i < results_n; ++i ) {
+    result_set_name(&results[i], 0);
+    by_name[i] = &results[i];
+  }
+  qsort(by_name, results_n, sizeof(by_name[0]), result_name_cmp);
+  for( i = 0; i < results_n; i = j ) {
+    for( j = i + 1; j < results_n; ++j )
+      if( strcmp(by_name[i]->name, by_name[j]->name) )
+        break;
+    if( j - i > 1 )
+      for( ; i < j; ++i )
+        result_set_name(by_name[i], 1);
+  }
+  qsort(by_name, results_n, sizeof(by_name[0]), result_name_cmp);
+  for( i = 1; i < results_n; ++i )
+    if( ! strcmp(by_name[i - 1]->name, by_name[i]->name) )
+      sfnt_fail_usage("ERROR: '%s' and '%s' would have the same name",
+                      by_name[i - 1]->path, by_name[i]->path);
+  free(by_name);
+}
+
+
+static void write_result_line(const struct result* r)
+{
+  int i;
+
+  printf("%s\t%"PRIu64, r->name, r->n);
+  if( r->n == 0 ) {
+    for( i = 0; i < pcts_n + 4; ++i )
+      printf("\t-");
+    printf("\n");
+    return;
+  }
+  printf("\t%"PRId64"\t%"PRId64, r->mean, r->min);
+  for( i = 0; i < pcts_n; ++i )
+    printf("\t%"PRId64, r->pct_vals[i]);
+  printf("\t%"PRId64"\t%"PRId64"\n", r->max, r->stddev);
+}
+
+
+int main(int argc, char* argv[])
+{
+  pthread_t* tids;
+  int i, n_failed = 0;
+
+  sfnt_app_getopt("<raw-results-file>...", &argc, argv, cfg_opts, N_CFG_OPTS);
+  --argc; ++argv;
+  if( argc < 1 )
+    sfnt_fail_usage("wrong number of arguments");
+
+  pcts_n = sfnt_hist_parse_percentiles(cfg_percentiles, pcts,
+                                       MAX_PERCENTILES);
+  if( pcts_n < 0 )
+    sfnt_fail_usage("ERROR: Malformed argument to option --percentiles");
+  if( cfg_skip < 0 || cfg_startms < 0 || cfg_endms < 0 )
+    sfnt_fail_usage("ERROR: --skip, --startms and --endms must not be "
+                    "negative");
+  if( cfg_endms && cfg_endms <= cfg_startms )
+    sfnt_fail_usage("ERROR: --endms must be greater than --startms");
+  if( cfg_interval <= 0 )
+    sfnt_fail_usage("ERROR: --interval must be positive");
+  if( cfg_threads < 0 )
+    sfnt_fail_usage("ERROR: Bad argument to option --threads");
+  start_ns = cfg_startms * (int64_t) 1000000;
+  end_ns = cfg_endms * (int64_t) 1000000;
+
+  results_n = argc;
+  NT_TEST((results = calloc(results_n, sizeof(results[0]))) != NULL);
+  for( i = 0; i < results_n; ++i )
+    results[i].path = argv[i];
+  name_results();
+  if( cfg_merge ) {
+    all.name = "all";
+    NT_TEST(sfnt_hist_init(&all.hist, SFNT_HIST_SUB_BITS) == 0);
+    PT_CHK(pthread_mutex_init(&all_lock, NULL));
+  }
+
+  if( cfg_threads == 0 )
+    cfg_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if( cfg_threads > results_n )
+    cfg_threads = results_n;
+  if( cfg_threads < 1 )
+    cfg_threads = 1;
+  PT_CHK(pthread_mutex_init(&next_lock, NULL));
+  NT_TEST((tids = calloc(cfg_threads, sizeof(tids[0]))) != NULL);
+  for( i = 0; i < cfg_threads; ++i )
+    PT_CHK(pthread_create(&tids[i], NULL, worker_thread, NULL));
+  for( i = 0; i < cfg_threads; ++i )
+    PT_CHK(pthread_join(tids[i], NULL));
+  free(tids);
+
+  printf("# files=%d threads=%d skip=%"PRId64" startms=%d endms=%d "
+         "exact=%d\n", results_n, cfg_threads, cfg_skip, cfg_startms,
+         cfg_endms, cfg_exact);
+  printf("#\n");
+  printf("#name\tn\tmean\tmin");
+  for( i = 0; i < pcts_n; ++i )
+    printf("\tp%g", pcts[i]);
+  printf("\tmax\tstddev\n");
+  for( i = 0; i < results_n; ++i ) {
+    if( results[i].err[0] ) {
+      sfnt_err("ERROR: %s: %s\n", results[i].path, results[i].err);
+      ++n_failed;
+      continue;
+    }
+    if( results[i].truncated )
+      sfnt_err("WARNING: %s: ends part way through a record, which has "
+               "been ignored\n", results[i].path);
+    write_result_line(&results[i]);
+  }
+  if( cfg_merge && n_failed < results_n ) {
+    get_summary(&all);
+    write_result_line(&all);
+  }
+  fflush(stdout);
+
+  if( n_failed ) {
+    sfnt_err("ERROR: %d of %d files could not be analysed\n",
+             n_failed, results_n);
+    sfnt_fail_test();
+  }
+  return 0;
+}
@@ -0,0 +1,753 @@
+/**************************************************************************\
+*    Filename: sfnt-compare.c
+* Description: Compare two sets of sfnt-pingpong/sfnt-stream results.
+*   Copyright: (C) 2012-2023 Advanced Micro Devices, Inc.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation, incorporated herein by reference.
+\**************************************************************************/
+
+/* Reads the per-size (or per-rate) result files written with --raw or
+ * --histfile by two runs, and for each size reports:
+ *
+ *  - Mann-Whitney U and Kolmogorov-Smirnov tests of whether the latency
+ *    distributions differ;
+ *  - the change in the mean and selected percentiles, with confidence
+ *    intervals (bootstrap for percentiles, Welch for the mean).
+ *
+ * With --thresholds, exits with an error if any statistic got
+ * significantly worse by more than the given limit.
+ */
+
+#include "sfnettest.h"
+#include <glob.h>
+
+
+static const char* cfg_percentiles = "50,90,99,99.9";
+static const char* cfg_thresholds;
+static float       cfg_confidence = 95;
+static int         cfg_bootstrap = 2000;
+static uint64_t    cfg_seed = 1;
+
+#define CL1(a, b, c, d)  SFNT_CLA(a, b, &(c), d)
+#define CL1I(a, c, d)    CL1(a, INT, c, d)
+#define CL1S(a, c, d)    CL1(a, STR, c, d)
+#define CL1D(a, c, d)    CL1(a, FLOAT, c, d)
+
+static struct sfnt_cmd_line_opt cfg_opts[] = {
+  CL1S("percentiles", cfg_percentiles, "percentiles to compare"              ),
+  CL1S("thresholds",  cfg_thresholds,  "fail if thresholds exceeded"         ),
+  CL1D("confidence",  cfg_confidence,  "confidence level (percent)"          ),
+  CL1I("bootstrap",   cfg_bootstrap,   "number of bootstrap replicates"      ),
+  CL1("seed",         UINT64,  cfg_seed, "random number seed"                ),
+};
+#define N_CFG_OPTS (sizeof(cfg_opts) / sizeof(cfg_opts[0]))
+
+
+#define MAX_PERCENTILES    32
+
+
+/* A sample, stored as sorted distinct values with their counts.  Raw
+ * results and histograms are both converted to this form.
+ */
+struct sample_set {
+  int64_t*  vals;
+  uint64_t* cum;       /* number of samples <= vals[i] */
+  int       len;
+  uint64_t  n;
+  double    mean;
+  double    var;
+};
+
+
+struct result_file {
+  char* key;           /* eg. "64" or "64-100000" */
+  char* path;
+  int   is_hist;
+  int   is_bin;
+};
+
+
+struct result_files {
+  struct result_file* files;
+  int                 n;
+};
+
+
+/* A line from the --thresholds file. */
+struct threshold {
+  char*  key;          /* or "*" */
+  double pct;          /* percentile, or -1 for mean */
+  double limit;
+  int    is_relative;
+};
+
+
+static double         pcts[MAX_PERCENTILES];
+static int            pcts_n;
+static struct threshold* thresholds;
+static int            thresholds_n;
+static double         z_conf;
+static int            n_violations;
+
+/**********************************************************************/
+
+static double rand_normal(void)
+{
+  double u = sfnt_rand_uniform();
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * sfnt_rand_uniform());
+}
+
+
+/* Marsaglia and Tsang's method; requires a >= 1. */
+static double rand_gamma(double a)
+{
+  double d = a - 1.0 / 3, c = 1 / sqrt(9 * d);
+  double x, v, u;
+  while( 1 ) {
+    do {
+      x = rand_normal();
+      v = 1 + c * x;
+    } while( v <= 0 );
+    v = v * v * v;
+    u = sfnt_rand_uniform();
+    if( log(u) < 0.5 * x * x + d - d * v + d * log(v) )
+      return d * v;
+  }
+}
+
+
+static double rand_beta(double a, double b)
+{
+  double x = rand_gamma(a);
+  return x / (x + rand_gamma(b));
+}
+
+
+/* Two-sided p-value for a standard normal statistic. */
+static double normal_p(double z)
+{
+  return erfc(fabs(z) / M_SQRT2);
+}
+
+
+/* z such that normal_p(z) == alpha. */
+static double normal_z(double alpha)
+{
+  double lo = 0, hi = 40, mid;
+  int i;
+  for( i = 0; i < 100; ++i ) {
+    mid = (lo + hi) / 2;
+    if( normal_p(mid) > alpha )
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return mid;
+}
+
+
+/* Asymptotic distribution of the Kolmogorov-Smirnov statistic. */
+static double ks_p(double lambda)
+{
+  double sum = 0, term, sign = 1;
+  int j;
+  if( lambda < 0.2 )
+    return 1;
+  for( j = 1; j <= 100; ++j ) {
+    term = sign * exp(-2 * j * j * lambda * lambda);
+    sum += term;
+    if( fabs(term) < 1e-10 * sum )
+      break;
+    sign = -sign;
+  }
+  sum *= 2;
+  return sum < 0 ? 0 : (sum > 1 ? 1 : sum);
+}
+
+/**********************************************************************/
+
+static void set_append(struct sample_set* s, int* max, int64_t v, uint64_t c)
+{
+  if( s->len && s->vals[s->len - 1] == v ) {
+    s->cum[s->len - 1] += c;
+    return;
+  }
+  if( s->len == *max ) {
+    *max = *max ? *max * 2 : 1024;
+    s->vals = realloc(s->vals, *max * sizeof(s->vals[0]));
+    s->cum = realloc(s->cum, *max * sizeof(s->cum[0]));
+    NT_TEST(s->vals != NULL && s->cum != NULL);
+  }
+  s->vals[s->len] = v;
+  s->cum[s->len] = (s->len ? s->cum[s->len - 1] : 0) + c;
+  ++s->len;
+}
+
+
+static void set_free(struct sample_set* s)
+{
+  free(s->vals);
+  free(s->cum);
+}
+
+
+static void raw_append(int64_t** raw, int64_t* raw_n, int64_t* raw_max,
+                       int64_t v)
+{
+  if( *raw_n == *raw_max ) {
+    *raw_max = *raw_max ? *raw_max * 2 : 65536;
+    *raw = realloc(*raw, *raw_max * sizeof(raw[0][0]));
+    NT_TEST(*raw != NULL);
+  }
+  (*raw)[(*raw_n)++] = v;
+}
+
+
+/* Binary raw files (--raw-format=bin) have a latency_ns field. */
+static int read_raw_bin(FILE* f, const char* path, int64_t** raw,
+                        int64_t* raw_n, int64_t* raw_max)
+{
+  struct sfnt_rawlog_reader r;
+  int64_t vals[SFNT_RAWLOG_MAX_FIELDS];
+  char* buf;
+  long len;
+  int rc, field;
+
+  if( fseek(f, 0, SEEK_END) < 0 || (len = ftell(f)) < 0 ||
+      fseek(f, 0, SEEK_SET) < 0 )
+    return -errno;
+  NT_TEST((buf = malloc(len)) != NULL);
+  if( fread(buf, 1, len, f) != len ) {
+    free(buf);
+    return -EIO;
+  }
+  if( (rc = sfnt_rawlog_reader_init(&r, buf, len)) == 0 ) {
+    if( (field = sfnt_rawlog_reader_field(&r, "latency_ns")) < 0 )
+      rc = -EINVAL;
+    else
+      while( (rc = sfnt_rawlog_reader_next(&r, vals)) > 0 )
+        raw_append(raw, raw_n, raw_max, vals[field]);
+    if( rc == 0 && r.truncated )
+      sfnt_err("WARNING: '%s' ends part way through a record, which has "
+               "been ignored\n", path);
+    sfnt_rawlog_reader_free(&r);
+  }
+  free(buf);
+  return rc;
+}
+
+
+/* Raw files written by sfnt-pingpong have one latency (ns) per line.  Those
+ * written by sfnt-stream have the latency (seconds) in the last column.
+ */
+static int load_raw(struct sample_set* s, const char* path, int is_bin)
+{
+  char line[256];
+  char* p;
+  char* end;
+  double d, last;
+  int64_t* raw = NULL;
+  int64_t raw_n = 0, raw_max = 0, i;
+  int n_fields, max = 0, rc;
+  FILE* f;
+
+  if( (f = fopen(path, "r")) == NULL )
+    return -errno;
+  if( is_bin && (rc = read_raw_bin(f, path, &raw, &raw_n, &raw_max)) < 0 ) {
+    fclose(f);
+    free(raw);
+    return rc;
+  }
+  while( ! is_bin && fgets(line, sizeof(line), f) != NULL ) {
+    if( line[0] == '#' )
+      continue;
+    n_fields = 0;
+    last = 0;
+    for( p = line; ; p = end ) {
+      d = strtod(p, &end);
+      if( end == p )
+        break;
+      last = d;
+      ++n_fields;
+    }
+    if( n_fields == 0 )
+      continue;
+    raw_append(&raw, &raw_n, &raw_max,
+               (int64_t) (n_fields == 1 ? last : last * 1e9 + 0.5));
+  }
+  fclose(f);
+
+  memset(s, 0, sizeof(*s));
+  if( raw_n == 0 ) {
+    free(raw);
+    return -EINVAL;
+  }
+  sfnt_sort_int64(raw, raw_n);
+  for( i = 0; i < raw_n; ++i ) {
+    set_append(s, &max, raw[i], 1);
+    s->mean += raw[i];
+  }
+  s->n = raw_n;
+  s->mean /= raw_n;
+  for( i = 0; i < raw_n; ++i )
+    s->var += (raw[i] - s->mean) * (raw[i] - s->mean);
+  s->var = raw_n > 1 ? s->var / (raw_n - 1) : 0;
+  free(raw);
+  return 0;
+}
+
+
+/* Histogram buckets are represented by their midpoint. */
+static int load_hist(struct sample_set* s, const char* path)
+{
+  struct sfnt_hist h;
+  int64_t offset, v;
+  int i, max = 0, rc;
+  FILE* f;
+
+  if( (f = fopen(path, "r")) == NULL )
+    return -errno;
+  rc = sfnt_hist_read(f, &h, &offset);
+  fclose(f);
+  if( rc < 0 )
+    return rc;
+
+  /* Ranks are taken from the counts, so they must agree with n. */
+  memset(s, 0, sizeof(*s));
+  for( i = h.lo_i; i <= h.hi_i; ++i )
+    if( h.counts[i] ) {
+      v = sfnt_hist_bucket_lo(&h, i) + (sfnt_hist_bucket_width(&h, i) - 1) / 2;
+      if( v < h.min )  v = h.min;
+      if( v > h.max )  v = h.max;
+      set_append(s, &max, v + offset, h.counts[i]);
+      s->n += h.counts[i];
+    }
+  s->mean = h.mean + offset;
+  s->var = s->n > 1 ? h.m2 / (s->n - 1) : 0;
+  sfnt_hist_free(&h);
+  return s->len ? 0 : -EINVAL;
+}
+
+
+static void load(struct sample_set* s, const struct result_file* rf)
+{
+  int rc = rf->is_hist ? load_hist(s, rf->path) :
+                         load_raw(s, rf->path, rf->is_bin);
+  if( rc < 0 ) {
+    sfnt_err("ERROR: Could not read results from '%s' (%s)\n",
+             rf->path, strerror(-rc));
+    sfnt_fail_test();
+  }
+}
+
+
+static int64_t value_at_rank(const struct sample_set* s, uint64_t rank)
+{
+  int lo = 0, hi = s->len - 1, mid;
+  while( lo < hi ) {
+    mid = (lo + hi) / 2;
+    if( s->cum[mid] > rank )
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return s->vals[lo];
+}
+
+
+/* Same convention as indexing a sorted array at (n * pct / 100). */
+static uint64_t pct_to_rank(const struct sample_set* s, double pct)
+{
+  double r = s->n * pct / 100;
+  if( r >= s->n - 1 )
+    return s->n - 1;
+  return (uint64_t) r;
+}
+
+/**********************************************************************/
+
+/* Natural ordering, so that "64" sorts before "128". */
+static int key_cmp(const char* a, const char* b)
+{
+  long la, lb;
+  char* ea;
+  char* eb;
+  while( *a && *b ) {
+    if( isdigit((unsigned char) *a) && isdigit((unsigned char) *b) ) {
+      la = strtol(a, &ea, 10);
+      lb = strtol(b, &eb, 10);
+      if( la != lb )
+        return la < lb ? -1 : 1;
+      a = ea;
+      b = eb;
+    }
+    else if( *a != *b ) {
+      return (unsigned char) *a - (unsigned char) *b;
+    }
+    else {
+      ++a;
+      ++b;
+    }
+  }
+  return (unsigned char) *a - (unsigned char) *b;
+}
+
+
+static int qsort_compare_result_file(const void* pa, const void* pb)
+{
+  const struct result_file* a = pa;
+  const struct result_file* b = pb;
+  int rc = key_cmp(a->key, b->key);
+  /* Prefer raw results to histograms for the same key. */
+  return rc ? rc : a->is_hist - b->is_hist;
+}
+
+
+static void find_files(struct result_files* rfs, const char* prefix)
+{
+  const char* exts[] = { ".dat", ".sfr", ".hist" };
+  char* pattern = alloca(strlen(prefix) + 10);
+  size_t pre_len = strlen(prefix) + 1;
+  char* path;
+  glob_t g;
+  int e, i, out;
+
+  rfs->files = NULL;
+  rfs->n = 0;
+  for( e = 0; e < 3; ++e ) {
+    sprintf(pattern, "%s-*%s", prefix, exts[e]);
+    if( glob(pattern, 0, NULL, &g) != 0 )
+      continue;
+    rfs->files = realloc(rfs->files,
+                         (rfs->n + g.gl_pathc) * sizeof(rfs->files[0]));
+    NT_TEST(rfs->files != NULL);
+    for( i = 0; i < g.gl_pathc; ++i ) {
+      path = g.gl_pathv[i];
+      rfs->files[rfs->n].path = strdup(path);
+      rfs->files[rfs->n].key = strndup(path + pre_len,
+                                       strlen(path) - pre_len -
+                                       strlen(exts[e]));
+      rfs->files[rfs->n].is_hist = e == 2;
+      rfs->files[rfs->n].is_bin = e == 1;
+      ++rfs->n;
+    }
+    globfree(&g);
+  }
+  if( rfs->n == 0 ) {
+    sfnt_err("ERROR: No results found matching '%s-*.dat', '%s-*.sfr' or "
+             "'%s-*.hist'\n", prefix, prefix, prefix);
+    sfnt_fail_setup();
+  }
+
+  /* Drop histograms where we also have raw results for the same key. */
+  qsort(rfs->files, rfs->n, sizeof(rfs->files[0]), qsort_compare_result_file);
+  for( i = out = 0; i < rfs->n; ++i )
+    if( out == 0 || strcmp(rfs->files[out - 1].key, rfs->files[i].key) )
+      rfs->files[out++] = rfs->files[i];
+  rfs->n = out;
+}
+
+/**********************************************************************/
+
+static void parse_thresholds(const char* path)
+{
+  char line[256], key[64], stat[32], limit[32];
+  char* end;
+  struct threshold* t;
+  int line_n = 0, i;
+  FILE* f;
+
+  if( (f = fopen(path, "r")) == NULL ) {
+    sfnt_err("ERROR: Could not open thresholds file '%s'\n", path);
+    sfnt_fail_setup();
+  }
+  while( fgets(line, sizeof(line), f) != NULL ) {
+    ++line_n;
+    if( line[0] == '#' || sscanf(line, "%63s", key) != 1 )
+      continue;
+    if( sscanf(line, "%63s %31s %31s", key, stat, limit) != 3 )
+      goto bad;
+    thresholds = realloc(thresholds,
+                         (thresholds_n + 1) * sizeof(thresholds[0]));
+    NT_TEST(thresholds != NULL);
+    t = &thresholds[thresholds_n++];
+    t->key = strdup(key);
+    if( ! strcasecmp(stat, "mean") ) {
+      t->pct = -1;
+    }
+    else {
+      if( stat[0] != 'p' && stat[0] != 'P' )
+        goto bad;
+      t->pct = strtod(stat + 1, &end);
+      if( end == stat + 1 || *end || t->pct <= 0 || t->pct >= 100 )
+        goto bad;
+    }
+    t->limit = strtod(limit, &end);
+    if( end == limit )
+      goto bad;
+    t->is_relative = ! strcmp(end, "%");
+    if( ! t->is_relative && *end && strcmp(end, "ns") )
+      goto bad;
+
+    /* Make sure we compute the statistics the thresholds refer to. */
+    if( t->pct > 0 ) {
+      for( i = 0; i < pcts_n; ++i )
+        if( pcts[i] == t->pct )
+          break;
+      if( i == pcts_n ) {
+        if( pcts_n == MAX_PERCENTILES )
+          sfnt_fail_usage("ERROR: Too many percentiles");
+        pcts[pcts_n++] = t->pct;
+      }
+    }
+  }
+  fclose(f);
+  return;
+
+ bad:
+  sfnt_err("ERROR: %s:%d: expected '<size|*> <mean|pNN> <limit>[%%|ns]'\n",
+           path, line_n);
+  sfnt_fail_setup();
+}
+
+
+static void check_thresholds(const char* key, double pct, const char* stat,
+                             double base, double change, int signif)
+{
+  struct threshold* t;
+  double limit;
+  int i;
+
+  for( i = 0; i < thresholds_n; ++i ) {
+    t = &thresholds[i];
+    if( t->pct != pct || (strcmp(t->key, "*") && strcmp(t->key, key)) )
+      continue;
+    limit = t->is_relative ? base * t->limit / 100 : t->limit;
+    if( signif && change > limit ) {
+      printf("# VIOLATION: key=%s stat=%s change=%+.0fns (%+.2f%%) "
+             "limit=%g%s\n", key, stat, change,
+             base ? change * 100 / base : 0, t->limit,
+             t->is_relative ? "%" : "ns");
+      ++n_violations;
+    }
+  }
+}
+
+/**********************************************************************/
+
+static void rank_tests(const char* key, const struct sample_set* a,
+                       const struct sample_set* b)
+{
+  double n1 = a->n, n2 = b->n, n = n1 + n2;
+  double rank = 0, rank_sum_a = 0, tie_sum = 0, t, ca, cb, ne;
+  double u, mu, sigma, z, mw_pval, d = 0, diff, ks_pval;
+  uint64_t cum_a = 0, cum_b = 0, prev_a = 0, prev_b = 0;
+  int i = 0, j = 0;
+  int64_t v;
+
+  /* Walk both sets in order, processing each distinct value once.  Tied
+   * values get the mean of the ranks they span.
+   */
+  while( i < a->len || j < b->len ) {
+    if( j == b->len || (i < a->len && a->vals[i] <= b->vals[j]) )
+      v = a->vals[i];
+    else
+      v = b->vals[j];
+    if( i < a->len && a->vals[i] == v )
+      cum_a = a->cum[i++];
+    if( j < b->len && b->vals[j] == v )
+      cum_b = b->cum[j++];
+    ca = cum_a - prev_a;
+    cb = cum_b - prev_b;
+    t = ca + cb;
+    rank_sum_a += ca * (rank + (t + 1) / 2);
+    tie_sum += t * t * t - t;
+    rank += t;
+    prev_a = cum_a;
+    prev_b = cum_b;
+    diff = fabs(cum_a / n1 - cum_b / n2);
+    if( diff > d )
+      d = diff;
+  }
+
+  /* Mann-Whitney U with tie correction and continuity correction. */
+  u = rank_sum_a - n1 * (n1 + 1) / 2;
+  mu = n1 * n2 / 2;
+  sigma = sqrt(n1 * n2 / 12 * ((n + 1) - tie_sum / (n * (n - 1))));
+  if( sigma > 0 ) {
+    z = fabs(u - mu) - 0.5;
+    mw_pval = normal_p(z > 0 ? z / sigma : 0);
+  }
+  else {
+    mw_pval = 1;
+  }
+
+  /* Kolmogorov-Smirnov. */
+  ne = n1 * n2 / n;
+  ks_pval = ks_p((sqrt(ne) + 0.12 + 0.11 / sqrt(ne)) * d);
+
+  /* P(cand > base) + P(tie) / 2 = U_cand / (n1 * n2) */
+  printf("%s\t%"PRIu64"\t%"PRIu64"\t%.4g\t%.3f\t%.4f\t%.4g\t%s\n",
+         key, a->n, b->n, mw_pval, 1 - u / (n1 * n2), d, ks_pval,
+         (mw_pval < 1 - cfg_confidence / 100 ||
+          ks_pval < 1 - cfg_confidence / 100) ? "*" : "");
+}
+
+
+static int qsort_compare_double(const void* pa, const void* pb)
+{
+  double a = *(const double*) pa;
+  double b = *(const double*) pb;
+  return (a > b) - (a < b);
+}
+
+
+/* The k-th order statistic of a bootstrap resample of size n is the
+ * original sample at rank floor(U * n), where U ~ Beta(k, n + 1 - k) is
+ * the k-th order statistic of n uniforms.  So we can draw from the exact
+ * bootstrap distribution of a percentile without resampling.
+ */
+static int64_t bootstrap_percentile(const struct sample_set* s, uint64_t rank)
+{
+  double u = rand_beta(rank + 1, s->n - rank);
+  uint64_t r = (uint64_t) (u * s->n);
+  return value_at_rank(s, r < s->n ? r : s->n - 1);
+}
+
+
+static void print_change(const char* key, const char* stat, double base,
+                         double cand, double lo, double hi)
+{
+  int signif = lo > 0 || hi < 0;
+  printf("%s\t%s\t%.0f\t%.0f\t%+.2f\t%+.2f\t%+.2f\t%s\n", key, stat,
+         base, cand, base ? (cand - base) * 100 / base : 0,
+         base ? lo * 100 / base : 0, base ? hi * 100 / base : 0,
+         signif ? "*" : "");
+}
+
+
+static void compare_stats(const char* key, const struct sample_set* a,
+                          const struct sample_set* b)
+{
+  double* diffs = malloc(cfg_bootstrap * sizeof(double));
+  double alpha = 1 - cfg_confidence / 100;
+  double se, lo, hi;
+  int64_t qa, qb;
+  uint64_t ra, rb;
+  char stat[32];
+  int i, k;
+
+  NT_TEST(diffs != NULL);
+
+  /* Mean: Welch's approximation. */
+  se = sqrt(a->var / a->n + b->var / b->n);
+  lo = b->mean - a->mean - z_conf * se;
+  hi = b->mean - a->mean + z_conf * se;
+  print_change(key, "mean", a->mean, b->mean, lo, hi);
+  check_thresholds(key, -1, "mean", a->mean, b->mean - a->mean, lo > 0 || hi < 0);
+
+  for( k = 0; k < pcts_n; ++k ) {
+    ra = pct_to_rank(a, pcts[k]);
+    rb = pct_to_rank(b, pcts[k]);
+    qa = value_at_rank(a, ra);
+    qb = value_at_rank(b, rb);
+    for( i = 0; i < cfg_bootstrap; ++i )
+      diffs[i] = (double) (bootstrap_percentile(b, rb) -
+                           bootstrap_percentile(a, ra));
+    qsort(diffs, cfg_bootstrap, sizeof(diffs[0]), qsort_compare_double);
+    lo = diffs[(int) (cfg_bootstrap * alpha / 2)];
+    hi = diffs[(int) (cfg_bootstrap * (1 - alpha / 2))];
+    sprintf(stat, "p%g", pcts[k]);
+    print_change(key, stat, qa, qb, lo, hi);
+    check_thresholds(key, pcts[k], stat, qa, qb - qa, lo > 0 || hi < 0);
+  }
+  free(diffs);
+}
+
+/**********************************************************************/
+
+int main(int argc, char* argv[])
+{
+  struct result_files base, cand;
+  struct sample_set* sa;
+  struct sample_set* sb;
+  int* match;
+  int i, j, n_match = 0;
+
+  sfnt_app_getopt("<baseline-prefix> <candidate-prefix>",
+                  &argc, argv, cfg_opts, N_CFG_OPTS);
+  --argc; ++argv;
+  if( argc != 2 )
+    sfnt_fail_usage("wrong number of arguments");
+
+  pcts_n = sfnt_hist_parse_percentiles(cfg_percentiles, pcts,
+                                       MAX_PERCENTILES);
+  if( pcts_n < 0 )
+    sfnt_fail_usage("ERROR: Malformed argument to option --percentiles");
+  if( cfg_confidence <= 0 || cfg_confidence >= 100 )
+    sfnt_fail_usage("ERROR: --confidence must be between 0 and 100");
+  if( cfg_bootstrap < 100 )
+    sfnt_fail_usage("ERROR: --bootstrap must be at least 100");
+  if( cfg_thresholds != NULL )
+    parse_thresholds(cfg_thresholds);
+  z_conf = normal_z(1 - cfg_confidence / 100);
+  sfnt_rand_seed(cfg_seed ? cfg_seed : 1);
+
+  find_files(&base, argv[0]);
+  find_files(&cand, argv[1]);
+
+  /* Pair up results for the same size/rate. */
+  match = calloc(base.n, sizeof(int));
+  NT_TEST(match != NULL);
+  for( i = 0; i < base.n; ++i ) {
+    match[i] = -1;
+    for( j = 0; j < cand.n; ++j )
+      if( ! strcmp(base.files[i].key, cand.files[j].key) )
+        match[i] = j;
+    if( match[i] < 0 )
+      sfnt_err("WARNING: No candidate result for '%s'\n", base.files[i].path);
+    else
+      ++n_match;
+  }
+  if( n_match == 0 ) {
+    sfnt_err("ERROR: No results in common\n");
+    sfnt_fail_setup();
+  }
+
+  sa = calloc(base.n, sizeof(*sa));
+  sb = calloc(base.n, sizeof(*sb));
+  NT_TEST(sa != NULL && sb != NULL);
+  for( i = 0; i < base.n; ++i )
+    if( match[i] >= 0 ) {
+      load(&sa[i], &base.files[i]);
+      load(&sb[i], &cand.files[match[i]]);
+    }
+
+  printf("# baseline=%s candidate=%s\n", argv[0], argv[1]);
+  printf("# confidence=%g%% bootstrap=%d seed=%"PRIu64"\n",
+         (double) cfg_confidence, cfg_bootstrap, cfg_seed);
+  printf("#\n");
+  printf("#key\tn_base\tn_cand\tmw_p\tP(c>b)\tks_d\tks_p\tdiffer\n");
+  for( i = 0; i < base.n; ++i )
+    if( match[i] >= 0 )
+      rank_tests(base.files[i].key, &sa[i], &sb[i]);
+  printf("#\n");
+  printf("#key\tstat\tbase\tcand\tchange%%\tci_lo%%\tci_hi%%\tsignif\n");
+  for( i = 0; i < base.n; ++i )
+    if( match[i] >= 0 ) {
+      compare_stats(base.files[i].key, &sa[i], &sb[i]);
+      set_free(&sa[i]);
+      set_free(&sb[i]);
+    }
+  fflush(stdout);
+
+  if( n_violations ) {
+    sfnt_err("%s: %d threshold violation(s)\n", sfnt_app_name, n_violations);
+    sfnt_fail_test();
+  }
+  return 0;
+}
+
+/*! \cidoxg_end */
@@ -21,13 +21,16 @@ static int         cfg_spin[2];
 static const char* cfg_muxer[2];
 static int         cfg_rtt;
 static const char* cfg_raw;
+static const char* cfg_raw_format;
+static const char* cfg_histfile;
+static const char* cfg_format;
 static float       cfg_percentile = 99;
 static int         cfg_minmsg;
 static int         cfg_maxmsg;
 static int         cfg_minms = 1000;
 static int         cfg_maxms = 3000;
-static int         cfg_miniter = 1000;
-static int         cfg_maxiter = 1000000;
+static int64_t     cfg_miniter = 1000;
+static int64_t     cfg_maxiter = 1000000;
 static int         cfg_warmupiter = 10000;
 static int         cfg_warmupms = 500;
 static int         cfg_forkboth;
@@ -53,10 +56,36 @@ static int         cfg_nodelay[2];
 static unsigned    cfg_busy_poll[2];
 static unsigned    cfg_sleep_gap = 0;
 static unsigned    cfg_spin_gap = 0;
+static const char* cfg_gap_sweep;
+static unsigned    cfg_gap_jitter;
 static unsigned    cfg_msg_more[2];
 static unsigned    cfg_v6only[2];
 static int         cfg_ipv4;
 static int         cfg_ipv6;
+static const char* cfg_percentiles;
+static unsigned    cfg_rate;
+static int         cfg_poisson;
+static const char* cfg_converge;
+static int         cfg_interleave;
+static uint64_t    cfg_seed;
+static unsigned    cfg_interval;
+static const char* cfg_timeline;
+static const char* cfg_heatmap;
+static unsigned    cfg_stall_threshold;
+static const char* cfg_stall_log;
+static unsigned    cfg_noise_ms;
+static unsigned    cfg_noise_threshold = 1000;
+static float       cfg_noise_budget;
+static int         cfg_noise_fail;
+static int         cfg_timestamping;
+static int         cfg_turnaround;
+static const char* cfg_trace;
+static unsigned    cfg_trace_len = 65536;
+static const char* cfg_perf_counters;
+static int         cfg_energy;
+static int         cfg_sched_stats;
+static int         cfg_tcp_info;
+static const char* cfg_timer;
 
 /* CL1* args take a single value (either applying to both client and server
  * or just one end).  CL2* args take either one value (used for both client
@@ -74,6 +103,7 @@ static int         cfg_ipv6;
 #define CL2S(a, c, d)    CL2(a, STR, c, d)
 #define CL1D(a, c, d)    CL1(a, FLOAT, c, d)
 #define CL2D(a, c, d)    CL2(a, FLOAT, c, d)
+#define CL1L(a, c, d)    CL1(a, INT64, c, d)
 
 static struct sfnt_cmd_line_opt cfg_opts[] = {
   CL1U("port",        cfg_port,        "server port#"                        ),
@@ -83,13 +113,16 @@ static struct sfnt_cmd_line_opt cfg_opts[] = {
   CL2S("muxer",       cfg_muxer,       "select, poll, epoll or none"         ),
   CL1F("rtt",         cfg_rtt,         "report round-trip-time"              ),
   CL1S("raw",         cfg_raw,         "dump raw results to files"           ),
+  CL1S("raw-format",  cfg_raw_format,  "text or bin (compact, written live)" ),
+  CL1S("histfile",    cfg_histfile,    "save latency histograms to files"    ),
+  CL1S("format",      cfg_format,      "results as text, json, csv or tsv"   ),
   CL1D("percentile",  cfg_percentile,  "percentile"                          ),
   CL1I("minmsg",      cfg_minmsg,      "min message size"                    ),
   CL1I("maxmsg",      cfg_maxmsg,      "max message size"                    ),
   CL1I("minms",       cfg_minms,       "min time per msg size (ms)"          ),
   CL1I("maxms",       cfg_maxms,       "max time per msg size (ms)"          ),
-  CL1I("miniter",     cfg_miniter,     "min iterations for result"           ),
-  CL1I("maxiter",     cfg_maxiter,     "max iterations for result"           ),
+  CL1L("miniter",     cfg_miniter,     "min iterations for result"           ),
+  CL1L("maxiter",     cfg_maxiter,     "max iterations for result"           ),
   CL1I("warmupiter",  cfg_warmupiter,  "min iterations for warmup"           ),
   CL1I("warmupms",    cfg_warmupms,    "min time for warmup"                 ),
   CL1S("mcast",       cfg_mcast,       "set multicast address"               ),
@@ -114,14 +147,56 @@ static struct sfnt_cmd_line_opt cfg_opts[] = {
   CL2U("busy-poll",   cfg_busy_poll,   "SO_BUSY_POLL (in microseconds)"      ),
   CL1U("sleep-gap",   cfg_sleep_gap,   "gap in usec to sleep between iter"   ),
   CL1U("spin-gap",    cfg_spin_gap,    "gap in usec to spin between iter"    ),
+  CL1S("gap-sweep",   cfg_gap_sweep,   "idle gaps (usec) to sweep per size"  ),
+  CL1U("gap-jitter",  cfg_gap_jitter,  "randomise gaps by +/- this percent"  ),
   CL2F("more",        cfg_msg_more,    "MSG_MORE for first n-1 pings/pongs"  ),
   CL2F("v6only",      cfg_v6only,      "enable IPV6_V6ONLY sockopt"          ),
   CL1F("ipv4",        cfg_ipv4,        "use IPv4 only"                       ),
   CL1F("ipv6",        cfg_ipv6,        "use IPv6 only"                       ),
+  CL1S("percentiles", cfg_percentiles, "extra percentiles to report"         ),
+  CL1U("rate",        cfg_rate,        "open-loop: send pings at fixed rate"  ),
+  CL1F("poisson",     cfg_poisson,     "open-loop: Poisson arrivals at rate" ),
+  CL1S("converge",    cfg_converge,    "<pct>:<rel-err> stop when %ile known" ),
+  CL1I("interleave",  cfg_interleave,  "n chunks per size, in random order"  ),
+  CL1("seed",         UINT64, cfg_seed, "random seed (0 to pick one)"        ),
+  CL1U("interval",    cfg_interval,    "timeline interval (ms)"              ),
+  CL1S("timeline",    cfg_timeline,    "save per-interval stats to files"    ),
+  CL1S("heatmap",     cfg_heatmap,     "save latency heatmaps to files"      ),
+  CL1U("stall-threshold", cfg_stall_threshold,
+                                       "log causes of samples over (ns)"     ),
+  CL1S("stall-log",   cfg_stall_log,   "stall log file (default stderr)"     ),
+  CL1U("noise-ms",    cfg_noise_ms,    "measure OS noise on cores first (ms)"),
+  CL1U("noise-threshold", cfg_noise_threshold,
+                                       "min gap counted as noise (ns)"       ),
+  CL1D("noise-budget", cfg_noise_budget, "max % of time lost to noise"       ),
+  CL1F("noise-fail",  cfg_noise_fail,  "fail rather than warn if over budget"),
+  CL1F("timestamping", cfg_timestamping, "split RTT with SO_TIMESTAMPING"    ),
+  CL1F("turnaround",  cfg_turnaround,  "split RTT into network and server"   ),
+  CL1S("trace",       cfg_trace,       "save per-stage trace to files"       ),
+  CL1U("trace-len",   cfg_trace_len,   "trace records kept per size"         ),
+  CL1S("perf-counters", cfg_perf_counters,
+                                       "counters, eg. cycles,instructions"   ),
+  CL1F("energy",      cfg_energy,      "report RAPL energy per iteration"    ),
+  CL1F("sched-stats", cfg_sched_stats, "report run delay and migrations"     ),
+  CL1F("tcp-info",    cfg_tcp_info,    "report TCP_INFO for each size (tcp)" ),
+  CL1S("timer",       cfg_timer,       "tsc,tsc-lfence,rdtscp,monotonic,..." ),
 };
 #define N_CFG_OPTS (sizeof(cfg_opts) / sizeof(cfg_opts[0]))
 
 
+/* Timestamps (ticks) for one iteration with --trace.  The wait_* fields
+ * are only set when using a muxer.
+ */
+struct trace_rec {
+  uint64_t send_start;
+  uint64_t send_done;
+  uint64_t wait_start;
+  uint64_t wait_done;
+  uint64_t recv_done;
+  uint64_t polls;
+};
+
+
 struct stats {
   int64_t mean;
   int64_t min;
@@ -149,6 +224,63 @@ enum fd_type {
 
 
 #define MAX_FDS            1024
+#define MAX_PERCENTILES    16
+
+/* Segments of the round trip measured with --timestamping. */
+#define TS_APP_SCHED       0   /* send() to qdisc */
+#define TS_SCHED_SND       1   /* qdisc to driver */
+#define TS_SND_RX          2   /* wire, peer and return path */
+#define TS_RX_APP          3   /* kernel receive to recv() return */
+#define TS_N_SEGS          4
+
+static const char* const ts_seg_names[TS_N_SEGS] = {
+  "app>sch", "sch>drv", "wire", "rx>app"
+};
+
+/* Parts of the round trip measured with --turnaround. */
+#define TA_SERVER          0   /* server recv() return to send() entry */
+#define TA_NET             1   /* everything else */
+#define TA_N               2
+
+static const char* const ta_names[TA_N] = { "srv", "net" };
+
+/* Stages of each iteration measured with --trace. */
+#define TR_SEND            0   /* send() entry to return */
+#define TR_SETUP           1   /* send() return to muxer wait */
+#define TR_WAIT            2   /* muxer wait, or blocking recv() */
+#define TR_RECV            3   /* muxer wakeup to recv() return */
+#define TR_POLLS           4   /* muxer or non-blocking recv() calls */
+#define TR_N               5
+
+/* Upper bound on iterations requested from the server in one go. */
+#define MAX_BATCH_ITER     (1 << 30)
+
+/* With --turnaround each end buffers a value per iteration until the end
+ * of the batch, so batches are split into pieces of at most this size to
+ * bound the memory used.
+ */
+#define TA_MAX_BATCH_ITER  (1 << 16)
+
+/* Max pings in flight in open-loop mode (must be a power of 2). */
+#define OL_MAX_OUTSTANDING 4096
+
+/* Open-loop datagram pings unanswered for this long, if --timeout is not
+ * given, are counted as lost.
+ */
+#define OL_LOSS_TIMEOUT_S  1
+
+/* Sent to the server in place of an iteration count to ask for its
+ * TCP_INFO.  Zero tells the server to exit.
+ */
+#define CMD_TCP_INFO       (-1)
+
+/* TCP_INFO at the end of a size, and retransmits during it, for the
+ * client [0] and server [1].
+ */
+struct tcpi_result {
+  struct sfnt_tcp_info end[2];
+  int64_t              retrans[2];
+};
 
 static struct sfnt_tsc_measure tsc_measure;
 static struct sfnt_tsc_params tsc;
@@ -157,6 +289,57 @@ static char           ppbuf[64 * 1024];
 static enum fd_type   fd_type;
 static int            the_fds[4];  /* used for pipes and unix sockets */
 
+static struct sfnt_hist lat_hist;
+static struct sfnt_timeline timeline;
+static uint64_t       sweep_start;
+static int            raw_bin;        /* --raw-format=bin */
+static struct sfnt_rawlog rawlog;
+static struct sfnt_rawlog* rawlog_cur;  /* size being measured, or NULL */
+static enum sfnt_format out_format;   /* --format */
+static struct sfnt_record results;
+static int            results_keep;   /* fields common to every row */
+static struct sfnt_stall stall;
+static uint64_t       ol_send_ts[OL_MAX_OUTSTANDING];  /* when due */
+static uint64_t       ol_tx_ts[OL_MAX_OUTSTANDING];    /* when sent */
+static uint8_t        ol_pending[OL_MAX_OUTSTANDING];
+static uint32_t       ol_seq;         /* of next open-loop ping */
+static uint64_t       ol_lost;        /* open-loop pings never answered */
+static uint64_t       ol_stale;       /* replies discarded as too late */
+static char           ol_txbuf[64 * 1024];
+static double         conv_pct;
+static double         conv_relerr;
+static double         pcts[MAX_PERCENTILES];
+static int            pcts_n;
+static struct sfnt_hist seg_hists[TS_N_SEGS];
+static struct sfnt_hist* ts_hists;     /* [TS_N_SEGS] being measured */
+static uint64_t       ts_missing;
+static int            ts_no_sched;    /* no SCHED stamps on this path */
+static int            ts_no_snd;      /* no SND stamps on this path */
+static struct sfnt_hist ta_hists[TA_N];
+static struct sfnt_hist* ta_cur;       /* [TA_N] being measured */
+static int64_t*       ta_buf;         /* per-iteration turnaround times */
+static uint64_t*      ta_rtt;         /* per-iteration round trips (ticks) */
+static int            ta_buf_n;
+static struct trace_rec* trace_ring;   /* [cfg_trace_len] */
+static struct trace_rec* trace_cur;    /* record being filled, or NULL */
+static int64_t        trace_n;        /* records written this size */
+static uint64_t       trace_mux_calls;
+static struct sfnt_hist trace_hists[TR_N];
+static struct sfnt_hist* tr_cur;       /* [TR_N] being measured */
+static struct sfnt_perf perf;
+static int64_t*       perf_sums;      /* [perf.n * 2] client then server */
+static int64_t*       perf_cur;       /* perf_sums being accumulated */
+static struct sfnt_energy energy;
+static int            energy_err;
+static int64_t*       energy_sums;    /* [energy.n + 1] uJ per domain, ns */
+static struct sfnt_sched_stats sched_sums[2];  /* client, server */
+static struct sfnt_sched_stats* sched_cur;     /* [2] being accumulated */
+static struct tcpi_result tcpi_res;
+static struct sfnt_ilist gap_sweep;
+static int            cur_gap = -1;   /* usec from gap_sweep, or -1 */
+static uint64_t       gap_idle;       /* ticks actually slept for cur_gap */
+static int64_t        gap_idle_n;
+
 static fd_set         select_fdset;
 static int            select_fds[MAX_FDS];
 static int            select_n_fds;
@@ -179,6 +362,18 @@ static int                 pfds_n;
 static int                 epoll_fd;
 #endif
 
+#define TRACE_TS(field)                                 \
+  do {                                                  \
+    if( trace_cur != NULL )                             \
+      sfnt_tsc(&trace_cur->field);                      \
+  } while( 0 )
+
+#define TRACE_TS_FIRST(field)                           \
+  do {                                                  \
+    if( trace_cur != NULL && trace_cur->field == 0 )    \
+      sfnt_tsc(&trace_cur->field);                      \
+  } while( 0 )
+
 static ssize_t (*do_recv)(int, void*, size_t, int);
 static ssize_t (*do_send)(int, const void*, size_t, int);
 
@@ -275,8 +470,10 @@ static ssize_t select_recv(int fd, void* buf, size_t len, int flags)
   do {
     for( i = 0; i < select_n_fds; ++i )
       FD_SET(select_fds[i], &select_fdset);
+    TRACE_TS_FIRST(wait_start);
     rc = sfnt_select(select_max_fd + 1, &select_fdset, NULL, NULL, &tsc,
                      timeout_ms, mux_flags);
+    TRACE_TS(wait_done);
     if( rc == 1 ) {
       NT_TEST(FD_ISSET(fd, &select_fdset));
       if( (rc = do_recv(fd, (char*) buf + got, len - got, flags)) > 0 )
@@ -315,7 +512,9 @@ static ssize_t poll_recv(int fd, void* buf, size_t len, int flags)
   if( cfg_spin[0] )
     mux_flags |= NT_MUX_SPIN;
   do {
+    TRACE_TS_FIRST(wait_start);
     rc = sfnt_poll(pfds, pfds_n, timeout_ms, &tsc, mux_flags);
+    TRACE_TS(wait_done);
     if( rc == 1 ) {
       NT_TEST(pfds[0].revents & POLLIN);
       if( (rc = do_recv(fd, (char*) buf + got, len - got, flags)) > 0 )
@@ -361,7 +560,9 @@ static ssize_t epoll_recv(int fd, void* buf, size_t len, int flags)
   if( cfg_spin[0] )
     mux_flags |= NT_MUX_SPIN;
   do {
+    TRACE_TS_FIRST(wait_start);
     rc = sfnt_epoll_wait(epoll_fd, &e, 1, timeout_ms, &tsc, mux_flags);
+    TRACE_TS(wait_done);
     if( rc == 1 ) {
       NT_TEST(e.events & EPOLLIN);
       if( (rc = do_recv(fd, (char*) buf + got, len - got, flags)) > 0 )
@@ -390,7 +591,9 @@ static ssize_t epoll_mod_recv(int fd, void* buf, size_t len, int flags)
   e.events = EPOLLIN;
   NT_TRY(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &e));
   do {
+    TRACE_TS_FIRST(wait_start);
     rc = sfnt_epoll_wait(epoll_fd, &e, 1, timeout_ms, &tsc, mux_flags);
+    TRACE_TS(wait_done);
     if( rc == 1 ) {
       NT_TEST(e.events & EPOLLIN);
       if( (rc = do_recv(fd, (char*) buf + got, len - got, flags)) > 0 )
@@ -421,7 +624,9 @@ static ssize_t epoll_adddel_recv(int fd, void* buf, size_t len, int flags)
   e.events = EPOLLIN;
   NT_TRY(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &e));
   do {
+    TRACE_TS_FIRST(wait_start);
     rc = sfnt_epoll_wait(epoll_fd, &e, 1, timeout_ms, &tsc, mux_flags);
+    TRACE_TS(wait_done);
     if( rc == 1 ) {
       NT_TEST(e.events & EPOLLIN);
       if( (rc = do_recv(fd, (char*) buf + got, len - got, flags)) > 0 )
@@ -449,15 +654,205 @@ static ssize_t spin_recv(int fd, void* buf, size_t len, int flags)
   int rc, got = 0, all = flags & MSG_WAITALL;
   flags = (flags & ~MSG_WAITALL) | MSG_DONTWAIT;
   do {
-    while( (rc = do_recv(fd, (char*) buf + got, len - got, flags)) < 0 )
+    while( (rc = do_recv(fd, (char*) buf + got, len - got, flags)) < 0 ) {
       if( errno != EAGAIN )
         goto out;
+      if( trace_cur != NULL )
+        ++trace_cur->polls;
+    }
     got += rc;
   } while( all && got < len && rc > 0 );
  out:
   return got ? got : rc;
 }
 
+/**********************************************************************
+ * Breakdown of round trip with SO_TIMESTAMPING.  All timestamps are
+ * CLOCK_REALTIME, which is what the kernel's software timestamps use.
+ */
+
+#if NT_HAVE_SO_TIMESTAMPING
+
+/* Wait this long after the reply for TX timestamps to arrive, for the first
+ * TS_PROBE_PINGS pings.  After that we only wait for types that have been
+ * seen, as some paths never produce them (eg. no SCHED stamp with a noqueue
+ * qdisc, no SND stamp on loopback or from NICs without TX stamping).
+ */
+#define TS_WAIT_NS         1000000
+#define TS_PROBE_PINGS     16
+
+static int64_t ts_app_send;
+static int64_t ts_rx;
+static int     ts_seen;                /* bit per SCM_TSTAMP_* seen */
+static int     ts_probe = TS_PROBE_PINGS;
+
+
+static int64_t ts_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * (int64_t) 1000000000 + ts.tv_nsec;
+}
+
+
+static int64_t ts_get_scm(struct cmsghdr* cmsg)
+{
+  struct scm_timestamping* tss = (void*) CMSG_DATA(cmsg);
+  return tss->ts[0].tv_sec * (int64_t) 1000000000 + tss->ts[0].tv_nsec;
+}
+
+
+/* Used as do_recv() to pick up the receive timestamp. */
+static ssize_t rfn_recv_ts(int fd, void* buf, size_t len, int flags)
+{
+  char control[256];
+  struct iovec iov = { buf, len };
+  struct msghdr msg;
+  struct cmsghdr* cmsg;
+  ssize_t rc;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if( (rc = recvmsg(fd, &msg, flags)) > 0 )
+    for( cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg) )
+      if( cmsg->cmsg_level == SOL_SOCKET &&
+          cmsg->cmsg_type == SCM_TIMESTAMPING )
+        ts_rx = ts_get_scm(cmsg);
+  return rc;
+}
+
+
+/* Read one TX timestamp from the error queue.  Returns its type
+ * (SCM_TSTAMP_*), or -1 if the queue is empty.
+ */
+static int ts_get_tx(int fd, int64_t* ts_out)
+{
+  char control[256];
+  struct msghdr msg;
+  struct cmsghdr* cmsg;
+  struct sock_extended_err* ee;
+  int64_t ts = 0;
+  int type = -1;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if( recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0 )
+    return -1;
+  for( cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg) ) {
+    if( cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_TIMESTAMPING ) {
+      ts = ts_get_scm(cmsg);
+    }
+    else if( (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+             (cmsg->cmsg_level == SOL_IPV6 &&
+              cmsg->cmsg_type == IPV6_RECVERR) ) {
+      ee = (void*) CMSG_DATA(cmsg);
+      if( ee->ee_origin == SO_EE_ORIGIN_TIMESTAMPING )
+        type = ee->ee_info;
+    }
+  }
+  *ts_out = ts;
+  return type;
+}
+
+
+static void ts_enable(int fd)
+{
+  int flags = SOF_TIMESTAMPING_TX_SCHED | SOF_TIMESTAMPING_TX_SOFTWARE |
+              SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+              SOF_TIMESTAMPING_OPT_TSONLY;
+  if( setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) ) {
+    sfnt_err("ERROR: SO_TIMESTAMPING not supported (%d %s)\n",
+             errno, strerror(errno));
+    sfnt_fail_setup();
+  }
+  /* Queued TX timestamps make the socket readable with POLLERR, which the
+   * muxers do not expect, so only support receiving directly.
+   */
+  if( mux_recv != do_recv && mux_recv != spin_recv )
+    sfnt_fail_usage("ERROR: --timestamping requires --muxer=none");
+  if( mux_recv == do_recv )
+    mux_recv = rfn_recv_ts;
+  do_recv = rfn_recv_ts;
+}
+
+
+static void ts_before_ping(int fd)
+{
+  int64_t ts;
+  /* Discard any stragglers from previous pings. */
+  while( ts_get_tx(fd, &ts) >= 0 )
+    ;
+  ts_rx = 0;
+  ts_app_send = ts_now();
+}
+
+
+static void ts_after_ping(int fd)
+{
+  int64_t app_recv = ts_now();
+  int64_t sched = 0, snd = 0, ts;
+  int want, got = 0, type;
+
+  /* TX timestamps are normally queued before the reply arrives, but allow
+   * a little time for stragglers.
+   */
+  if( ts_probe )
+    want = (1 << SCM_TSTAMP_SCHED) | (1 << SCM_TSTAMP_SND);
+  else
+    want = ts_seen;
+  do {
+    if( (type = ts_get_tx(fd, &ts)) == SCM_TSTAMP_SCHED )
+      sched = ts;
+    else if( type == SCM_TSTAMP_SND )
+      snd = ts;
+    if( type == SCM_TSTAMP_SCHED || type == SCM_TSTAMP_SND )
+      got |= 1 << type;
+  } while( (got & want) != want && ts_now() - app_recv < TS_WAIT_NS );
+  ts_seen |= got;
+  if( ts_probe && --ts_probe == 0 ) {
+    ts_no_sched = ! (ts_seen & (1 << SCM_TSTAMP_SCHED));
+    ts_no_snd = ! (ts_seen & (1 << SCM_TSTAMP_SND));
+  }
+
+  /* Segments are recorded if both their ends were stamped, so those that
+   * depend on a missing type are shown as '-'.
+   */
+  if( ts_hists == NULL )
+    return;
+  if( ! ts_rx || (got & ts_seen) != ts_seen )
+    ++ts_missing;
+  if( sched )
+    sfnt_hist_record(&ts_hists[TS_APP_SCHED], sched - ts_app_send);
+  if( sched && snd )
+    sfnt_hist_record(&ts_hists[TS_SCHED_SND], snd - sched);
+  if( snd && ts_rx )
+    sfnt_hist_record(&ts_hists[TS_SND_RX], ts_rx - snd);
+  if( ts_rx )
+    sfnt_hist_record(&ts_hists[TS_RX_APP], app_recv - ts_rx);
+}
+
+#else
+
+static void ts_enable(int fd)
+{
+  sfnt_fail_usage("ERROR: --timestamping not supported on this platform");
+}
+
+static void ts_before_ping(int fd)
+{
+}
+
+static void ts_after_ping(int fd)
+{
+}
+
+#endif
+
 /**********************************************************************/
 
 static void set_ttl(int af, int sock, int ttl)
@@ -565,24 +960,39 @@ static int recv_size(int sz)
 static void do_ping(int read_fd, int write_fd, int sz)
 {
   int i, rc; /* send_flags = cfg_msg_more[0] ? MSG_MORE : 0; */
+  SFNT_PROBE1(ping_send, sz);
   for( i = 0; i < cfg_n_pings[0]; ++i ) {
+    TRACE_TS_FIRST(send_start);
     rc = do_send(write_fd, ppbuf, sz, 0);
     NT_TESTi3(rc, ==, sz);
+    TRACE_TS_FIRST(send_done);
     rc = mux_recv(read_fd, ppbuf, recv_size(sz), MSG_WAITALL);
     NT_TESTi3(rc, ==, sz);
   }
+  TRACE_TS(recv_done);
+  SFNT_PROBE1(pong_recv, sz);
 }
 
-static void do_pong(int read_fd, int write_fd, int recv_sz, int send_sz)
+static uint64_t do_pong(int read_fd, int write_fd, int recv_sz, int send_sz)
 {
   int i, rc; /*, send_flags = cfg_msg_more[0] ? MSG_MORE : 0; */
+  uint64_t rx_done = 0, tx_done = 0, turnaround = 0;
   for( i = 0; i < cfg_n_pings[0]; ++i ) {
     /* NB. Solaris doesn't block in UDP recv with 0 length buffer. */
     rc = mux_recv(read_fd, ppbuf, recv_size(recv_sz), MSG_WAITALL);
     NT_TESTi3(rc, ==, recv_sz);
+    SFNT_PROBE1(server_recv, recv_sz);
+    if( cfg_turnaround )
+      sfnt_tsc(&rx_done);
+    SFNT_PROBE1(server_reply, send_sz);
     rc = do_send(write_fd, ppbuf, send_sz, 0);
     NT_TESTi3(rc, ==, send_sz);
+    if( cfg_turnaround ) {
+      sfnt_tsc(&tx_done);
+      turnaround += tx_done - rx_done;
+    }
   }
+  return turnaround;
 }
 
 #else
@@ -590,33 +1000,50 @@ static void do_pong(int read_fd, int write_fd, int recv_sz, int send_sz)
 static void do_ping(int read_fd, int write_fd, int sz)
 {
   int i, rc, send_flags = cfg_msg_more[0] ? MSG_MORE : 0;
+  SFNT_PROBE1(ping_send, sz);
+  TRACE_TS(send_start);
   for( i = 0; i < cfg_n_pings[0] - 1; ++i ) {
     rc = do_send(write_fd, ppbuf, sz, send_flags);
     NT_TESTi3(rc, ==, sz);
   }
   rc = do_send(write_fd, ppbuf, sz, 0);
   NT_TESTi3(rc, ==, sz);
+  TRACE_TS(send_done);
   for( i = 0; i < cfg_n_pongs; ++i ) {
     rc = mux_recv(read_fd, ppbuf, recv_size(sz), MSG_WAITALL);
     NT_TESTi3(rc, ==, sz);
   }
+  TRACE_TS(recv_done);
+  SFNT_PROBE1(pong_recv, sz);
 }
 
 
-static void do_pong(int read_fd, int write_fd, int recv_sz, int send_sz)
+/* Returns the time (in ticks) from return of the last recv() to return of
+ * the last send() if --turnaround, else 0.  There is no work to do between
+ * the two calls, so the time is that spent in the server's send path.
+ */
+static uint64_t do_pong(int read_fd, int write_fd, int recv_sz, int send_sz)
 {
   int i, rc, send_flags = cfg_msg_more[0] ? MSG_MORE : 0;
+  uint64_t rx_done = 0, tx_done = 0;
   for( i = 0; i < cfg_n_pings[0]; ++i ) {
     /* NB. Solaris doesn't block in UDP recv with 0 length buffer. */
     rc = mux_recv(read_fd, ppbuf, recv_size(recv_sz), MSG_WAITALL);
     NT_TESTi3(rc, ==, recv_sz);
   }
+  SFNT_PROBE1(server_recv, recv_sz);
+  if( cfg_turnaround )
+    sfnt_tsc(&rx_done);
+  SFNT_PROBE1(server_reply, send_sz);
   for( i = 0; i < cfg_n_pongs - 1; ++i ) {
     rc = do_send(write_fd, ppbuf, send_sz, send_flags);
     NT_TESTi3(rc, ==, send_sz);
   }
   rc = do_send(write_fd, ppbuf, send_sz, 0);
   NT_TESTi3(rc, ==, send_sz);
+  if( cfg_turnaround )
+    sfnt_tsc(&tx_done);
+  return tx_done - rx_done;
 }
 #endif
 
@@ -732,12 +1159,22 @@ static void client_send_opts(int ss)
   sfnt_sock_put_int(ss, cfg_busy_poll[1]);
   sfnt_sock_put_int(ss, cfg_msg_more[1]);
   sfnt_sock_put_int(ss, cfg_v6only[1]);
+  sfnt_sock_put_int(ss, cfg_noise_ms);
+  sfnt_sock_put_int(ss, cfg_noise_threshold);
+  sfnt_sock_put_int(ss, cfg_turnaround);
+  sfnt_sock_put_str(ss, cfg_perf_counters);
+  sfnt_sock_put_int(ss, cfg_sched_stats);
+  sfnt_sock_put_int(ss, cfg_rate);
+  sfnt_sock_put_str(ss, cfg_timer);
   sfnt_sock_uncork(ss);
 }
 
 
 static void server_recv_opts(int ss)
 {
+  char* timer;
+  int rc;
+
   fd_type = sfnt_sock_get_int(ss);
   cfg_connect[0] = sfnt_sock_get_int(ss);
   cfg_spin[0] = sfnt_sock_get_int(ss);
@@ -763,8 +1200,20 @@ static void server_recv_opts(int ss)
   cfg_busy_poll[0] = sfnt_sock_get_int(ss);
   cfg_msg_more[0] = sfnt_sock_get_int(ss);
   cfg_v6only[0] = sfnt_sock_get_int(ss);
+  cfg_noise_ms = sfnt_sock_get_int(ss);
+  cfg_noise_threshold = sfnt_sock_get_int(ss);
+  cfg_turnaround = sfnt_sock_get_int(ss);
+  cfg_perf_counters = sfnt_sock_get_str(ss);
+  cfg_sched_stats = sfnt_sock_get_int(ss);
+  cfg_rate = sfnt_sock_get_int(ss);
+  /* The client's --timer, if given, overrides the server's own. */
+  if( (timer = sfnt_sock_get_str(ss)) != NULL )
+    cfg_timer = timer;
   if( cfg_msg_more[0] && MSG_MORE == 0 )
     sfnt_fail_usage("ERROR: MSG_MORE not supported on this platform");
+  if( cfg_timer != NULL && (rc = sfnt_timer_select(cfg_timer)) < 0 )
+    sfnt_fail_usage("ERROR: %s timer '%s' on server",
+                    rc == -ENOSYS ? "Unsupported" : "Unknown", cfg_timer);
 }
 
 
@@ -916,6 +1365,18 @@ static void set_sock_timeouts(int sock)
 #endif
 
 
+/* Ensure the per-iteration --turnaround buffers can hold [n] entries. */
+static void ta_buf_grow(int n)
+{
+  if( n <= ta_buf_n )
+    return;
+  ta_buf = realloc(ta_buf, n * sizeof(ta_buf[0]));
+  ta_rtt = realloc(ta_rtt, n * sizeof(ta_rtt[0]));
+  NT_TEST(ta_buf != NULL && ta_rtt != NULL);
+  ta_buf_n = n;
+}
+
+
 static int do_server2(int ss);
 
 
@@ -994,22 +1455,80 @@ static int do_server(void)
 }
 
 
+/* Open-loop pings over a datagram socket may be lost, so the server does
+ * not count them.  It echoes whatever arrives until the client says that
+ * the batch is over.
+ */
+static void do_pongs_open_loop(int ss, int read_fd, int write_fd, int size)
+{
+  enum sfnt_mux_flags mux_flags = NT_MUX_CONTINUE_ON_EINTR;
+  fd_set fds;
+  int rc;
+
+  if( cfg_spin[0] )
+    mux_flags |= NT_MUX_SPIN;
+  while( 1 ) {
+    rc = do_recv(read_fd, ppbuf, recv_size(size), MSG_DONTWAIT);
+    if( rc >= 0 ) {
+      SFNT_PROBE1(server_recv, rc);
+      NT_TESTi3(do_send(write_fd, ppbuf, rc, 0), ==, rc);
+      continue;
+    }
+    if( errno != EAGAIN ) {
+      sfnt_err("ERROR: recv failed (%d %s)\n", errno, strerror(errno));
+      sfnt_fail_test();
+    }
+    FD_ZERO(&fds);
+    FD_SET(read_fd, &fds);
+    FD_SET(ss, &fds);
+    rc = sfnt_select((read_fd > ss ? read_fd : ss) + 1, &fds, NULL, NULL,
+                     &tsc, timeout_ms, mux_flags);
+    if( rc == 0 ) {
+      sfnt_err("ERROR: timed out waiting for open-loop pings\n");
+      sfnt_fail_test();
+    }
+    NT_TEST(rc > 0);
+    /* Pings that have arrived are answered before ending the batch. */
+    if( FD_ISSET(ss, &fds) && ! FD_ISSET(read_fd, &fds) ) {
+      sfnt_sock_get_int(ss);
+      break;
+    }
+  }
+}
+
+
 static int do_server2(int ss)
 {
-  int sl, iter, send_size, recv_size;
+  int sl, i, iter, send_size, recv_size, rc;
   int read_fd, write_fd;
+  uint64_t turnaround;
+  struct sfnt_perf_sample perf_before, perf_after;
+  int64_t perf_deltas[SFNT_PERF_MAX];
+  struct sfnt_sched_stats sched_before, sched_after, sched_delta;
 
   server_check_ver(ss);
   server_recv_opts(ss);
   sfnt_sock_put_str(ss, getenv("LD_PRELOAD"));
 
-  /* Init after we've received config opts from client. */
+  /* Init after we've received config opts from client.  The calibration
+   * begun in do_server() may have used another timer, so start it again.
+   */
+  sfnt_tsc_get_params_begin(&tsc_measure);
   do_init();
   /* We don't need particularly accurate timing on the server side, so a
    * millisecond of calibration should be fine - it's only used for
    * timeouts */
   NT_TRY(sfnt_tsc_get_params_end(&tsc_measure, &tsc, 1000));
 
+  /* Measure noise on our core while the client waits, so that the two
+   * measurements do not disturb one another.
+   */
+  if( cfg_noise_ms ) {
+    struct sfnt_noise noise;
+    sfnt_noise_measure(&noise, &tsc, cfg_noise_ms, cfg_noise_threshold);
+    sfnt_noise_put(ss, &noise);
+  }
+
   /* Create and bind/connect test socket. */
   switch( fd_type ) {
   case FDT_TCP: {
@@ -1060,11 +1579,24 @@ static int do_server2(int ss)
                         sizeof(cfg_busy_poll[0])));
   }
   add_fds(read_fd);
+  /* If the counters cannot be opened here then none are sent back, and the
+   * client shows them as unavailable.
+   */
+  if( cfg_perf_counters != NULL &&
+      (rc = sfnt_perf_open(&perf, cfg_perf_counters)) < 0 )
+    sfnt_err("WARNING: --perf-counters not available on server (%s)\n",
+             strerror(-rc));
 
   while( 1 ) {
     iter = sfnt_sock_get_int(ss);
     if( iter == 0 )
       break;
+    if( iter == CMD_TCP_INFO ) {
+      struct sfnt_tcp_info ti;
+      NT_TRY(sfnt_tcp_info_read(read_fd, &ti));
+      sfnt_tcp_info_put(ss, &ti);
+      continue;
+    }
     send_size = sfnt_sock_get_int(ss);
     recv_size = (uint64_t) send_size * cfg_n_pings[1] / cfg_n_pings[0];
 #ifdef TEST_LATENCY
@@ -1074,8 +1606,49 @@ static int do_server2(int ss)
     }
 #endif
 
-    while( iter-- )
-      do_pong(read_fd, write_fd, recv_size, send_size);
+    /* Counters include the client's initial ping in each batch. */
+    if( cfg_perf_counters != NULL ) {
+      sfnt_perf_sample(&perf, &perf_before);
+      sfnt_perf_enable(&perf);
+    }
+    if( cfg_sched_stats )
+      sfnt_sched_stats_thread(&sched_before);
+    if( cfg_rate && ! (fd_type & FDTF_STREAM) ) {
+      do_pongs_open_loop(ss, read_fd, write_fd, recv_size);
+    }
+    else if( ! cfg_turnaround ) {
+      for( i = 0; i < iter; ++i )
+        do_pong(read_fd, write_fd, recv_size, send_size);
+    }
+    else {
+      ta_buf_grow(iter);
+      for( i = 0; i < iter; ++i ) {
+        turnaround = do_pong(read_fd, write_fd, recv_size, send_size);
+        ta_buf[i] = turnaround > tsc.tsc_cost ?
+          sfnt_tsc_nsec(&tsc, turnaround - tsc.tsc_cost) : 0;
+      }
+    }
+    if( cfg_sched_stats )
+      sfnt_sched_stats_thread(&sched_after);
+    if( cfg_perf_counters != NULL ) {
+      sfnt_perf_disable(&perf);
+      sfnt_perf_sample(&perf, &perf_after);
+    }
+
+    /* Send results back once the batch is done, so that doing so does not
+     * disturb the measurement.
+     */
+    if( cfg_turnaround )
+      sfnt_sock_put_int64s(ss, ta_buf, iter);
+    if( cfg_perf_counters != NULL ) {
+      sfnt_perf_delta(&perf, &perf_before, &perf_after, perf_deltas);
+      sfnt_sock_put_int(ss, perf.n);
+      sfnt_sock_put_int64s(ss, perf_deltas, perf.n);
+    }
+    if( cfg_sched_stats ) {
+      sfnt_sched_stats_delta(&sched_before, &sched_after, &sched_delta);
+      sfnt_sched_stats_put(ss, &sched_delta);
+    }
   }
 
   NT_TESTi3(recv(ss, ppbuf, 1, 0), ==, 0);
@@ -1084,59 +1657,418 @@ static int do_server2(int ss)
 }
 
 
+static void trace_begin(void)
+{
+  trace_cur = &trace_ring[trace_n++ % cfg_trace_len];
+  memset(trace_cur, 0, sizeof(*trace_cur));
+  trace_mux_calls = sfnt_mux_calls;
+}
+
+
+static void trace_end(void)
+{
+  struct trace_rec* r = trace_cur;
+  trace_cur = NULL;
+  r->polls += sfnt_mux_calls - trace_mux_calls;
+  if( tr_cur == NULL )
+    return;
+  sfnt_hist_record(&tr_cur[TR_SEND],
+                   sfnt_tsc_nsec(&tsc, r->send_done - r->send_start));
+  if( r->wait_start ) {
+    sfnt_hist_record(&tr_cur[TR_SETUP],
+                     sfnt_tsc_nsec(&tsc, r->wait_start - r->send_done));
+    sfnt_hist_record(&tr_cur[TR_WAIT],
+                     sfnt_tsc_nsec(&tsc, r->wait_done - r->wait_start));
+    sfnt_hist_record(&tr_cur[TR_RECV],
+                     sfnt_tsc_nsec(&tsc, r->recv_done - r->wait_done));
+  }
+  else {
+    sfnt_hist_record(&tr_cur[TR_WAIT],
+                     sfnt_tsc_nsec(&tsc, r->recv_done - r->send_done));
+  }
+  sfnt_hist_record(&tr_cur[TR_POLLS], r->polls);
+}
+
+
+/* Add client and server counts from a batch to [sums].  A counter that is
+ * unavailable in any batch is reported as unavailable.
+ */
+/* Read the server's counts for a batch into [deltas].  They are all -1 if
+ * the server could not open the counters.
+ */
+static void perf_get_server(int ss, int64_t* deltas)
+{
+  int64_t buf[SFNT_PERF_MAX];
+  int i, n;
+
+  n = sfnt_sock_get_int(ss);
+  NT_TEST(n >= 0 && n <= SFNT_PERF_MAX);
+  sfnt_sock_get_int64s(ss, buf, n);
+  for( i = 0; i < perf.n; ++i )
+    deltas[i] = n == perf.n ? buf[i] : -1;
+}
+
+
+static void perf_accumulate(int64_t* sums, const int64_t* deltas)
+{
+  int i;
+  for( i = 0; i < perf.n * 2; ++i )
+    if( deltas[i] < 0 )
+      sums[i] = -1;
+    else if( sums[i] >= 0 )
+      sums[i] += deltas[i];
+}
+
+
+static unsigned gap_jitter(unsigned usec)
+{
+  if( cfg_gap_jitter == 0 )
+    return usec;
+  return (unsigned) (usec * (1 + (2 * sfnt_rand_uniform() - 1) *
+                             cfg_gap_jitter / 100.0) + 0.5);
+}
+
+
+/* Idle between iterations.  Gaps from --gap-sweep are slept rather than
+ * spun, so that the core can drop into deeper C-states and the caches and
+ * TLB go cold, as they do between the messages of a sparse stream.  The
+ * sleep overshoots by the wakeup latency, so the time actually idle is
+ * measured and reported alongside the requested gap.
+ */
+static void do_gap(void)
+{
+  uint64_t start, stop;
+  if( cur_gap > 0 ) {
+    sfnt_tsc(&start);
+    usleep(gap_jitter(cur_gap));
+    sfnt_tsc(&stop);
+    gap_idle += stop - start;
+    ++gap_idle_n;
+  }
+  if( cfg_sleep_gap )
+    usleep(gap_jitter(cfg_sleep_gap));
+  if( cfg_spin_gap ) 
+    sfnt_tsc_usleep(&tsc, gap_jitter(cfg_spin_gap));
+}
+
+
+static void rawlog_put(uint64_t now, int64_t lat)
+{
+  int64_t vals[2];
+  vals[0] = sfnt_tsc_nsec(&tsc, now - sweep_start);
+  vals[1] = lat;
+  sfnt_rawlog_put(rawlog_cur, vals);
+}
+
+
 static void do_pings(int ss, int read_fd, int write_fd, int msg_size,
-                     int iter, int64_t* results)
+                     int iter, struct sfnt_hist* hist, int64_t* raw)
 {
+  struct sfnt_perf_sample perf_before, perf_after;
+  int64_t perf_deltas[SFNT_PERF_MAX * 2];
+  struct sfnt_sched_stats sched_before, sched_after, sched_delta;
   uint64_t start, stop;
+  int64_t lat;
   int i;
 
   sfnt_sock_put_int(ss, iter + 1); /* +1 as initial ping  below */
   sfnt_sock_put_int(ss, msg_size);
 
   /* Touch to ensure resident. */
-  memset(results, 0, iter * sizeof(results[0]));
+  if( raw != NULL )
+    memset(raw, 0, iter * sizeof(raw[0]));
 
   /* Ensure server is ready. */
   do_ping(read_fd, write_fd, msg_size);
+  if( hist != NULL && cfg_stall_threshold )
+    sfnt_stall_rebase(&stall);
+
+  if( cfg_turnaround )
+    ta_buf_grow(iter + 1);
+  if( cfg_perf_counters != NULL ) {
+    sfnt_perf_sample(&perf, &perf_before);
+    sfnt_perf_enable(&perf);
+  }
+  if( cfg_sched_stats )
+    sfnt_sched_stats_thread(&sched_before);
 
   for( i = 0; i < iter; ++i ) {
+    if( cfg_timestamping )
+      ts_before_ping(write_fd);
+    if( cfg_trace != NULL && hist != NULL )
+      trace_begin();
     sfnt_tsc(&start);
     do_ping(read_fd, write_fd, msg_size);
     sfnt_tsc(&stop);
+    if( trace_cur != NULL )
+      trace_end();
+    if( cfg_timestamping )
+      ts_after_ping(write_fd);
+    if( cfg_turnaround )
+      ta_rtt[i] = stop - start - tsc.tsc_cost;
    
-    results[i] = sfnt_tsc_nsec(&tsc, stop - start - tsc.tsc_cost);
+    lat = sfnt_tsc_nsec(&tsc, stop - start - tsc.tsc_cost);
     if( ! cfg_rtt )
-      results[i] /= 2;
-    if( cfg_sleep_gap )
-      usleep(cfg_sleep_gap);
-    if( cfg_spin_gap ) 
-      sfnt_tsc_usleep(&tsc, cfg_spin_gap);
+      lat /= 2;
+    SFNT_PROBE3(ping_done, msg_size, i, lat);
+    if( rawlog_cur != NULL )
+      rawlog_put(stop, lat);
+    if( hist != NULL )
+      sfnt_hist_record(hist, lat);
+    if( hist != NULL && cfg_interval )
+      sfnt_timeline_record(&timeline, sfnt_tsc_nsec(&tsc, stop - sweep_start),
+                           lat);
+    if( hist != NULL && cfg_stall_threshold )
+      sfnt_stall_check(&stall, lat,
+                       sfnt_tsc_nsec(&tsc, stop - sweep_start) * 1e-6,
+                       msg_size);
+    if( raw != NULL )
+      raw[i] = lat;
+    do_gap();
+  }
+
+  if( cfg_sched_stats )
+    sfnt_sched_stats_thread(&sched_after);
+  if( cfg_perf_counters != NULL ) {
+    sfnt_perf_disable(&perf);
+    sfnt_perf_sample(&perf, &perf_after);
+  }
+
+  if( cfg_turnaround ) {
+    /* First entry is for the initial ping. */
+    sfnt_sock_get_int64s(ss, ta_buf, iter + 1);
+    if( ta_cur != NULL )
+      for( i = 0; i < iter; ++i ) {
+        lat = sfnt_tsc_nsec(&tsc, ta_rtt[i]) - ta_buf[i + 1];
+        sfnt_hist_record(&ta_cur[TA_SERVER], ta_buf[i + 1]);
+        sfnt_hist_record(&ta_cur[TA_NET], cfg_rtt ? lat : lat / 2);
+      }
+  }
+  if( cfg_perf_counters != NULL ) {
+    sfnt_perf_delta(&perf, &perf_before, &perf_after, perf_deltas);
+    perf_get_server(ss, perf_deltas + perf.n);
+    if( perf_cur != NULL )
+      perf_accumulate(perf_cur, perf_deltas);
+  }
+  if( cfg_sched_stats ) {
+    sfnt_sched_stats_delta(&sched_before, &sched_after, &sched_delta);
+    if( sched_cur != NULL )
+      sfnt_sched_stats_add(&sched_cur[0], &sched_delta);
+    sfnt_sched_stats_get(ss, &sched_delta);
+    if( sched_cur != NULL )
+      sfnt_sched_stats_add(&sched_cur[1], &sched_delta);
   }
 }
 
 
-static void get_stats(struct stats* s, int64_t* results, int results_n)
+/* Open-loop variant of do_pings(): pings are sent according to a schedule
+ * (fixed or Poisson rate) regardless of whether earlier pings have been
+ * answered, and latency is measured from the time each ping was due to be
+ * sent.  So a stall delays (and is charged to) every ping that should have
+ * gone out during it, rather than just the one that was in flight.
+ *
+ * Sends and receives are interleaved by spinning: nothing blocks, so that
+ * pings go out on time, and so that a send that would block (because the
+ * server is itself blocked sending replies) does not stop us reading them.
+ *
+ * Each ping carries a sequence number, which the server echoes, so that
+ * replies are matched to pings even if some are lost.  Datagram pings
+ * unanswered after --timeout (default OL_LOSS_TIMEOUT_S) are counted as
+ * lost; on a stream it is an error.  Messages too small to hold a sequence
+ * number are matched to pings in order.
+ *
+ * Returns the number of pings answered.
+ */
+static int do_pings_open_loop(int ss, int read_fd, int write_fd,
+                              int msg_size, int iter,
+                              struct sfnt_hist* hist, int64_t* raw)
 {
-  int64_t* results_end = results + results_n;
-  double variance;
+  struct sfnt_perf_sample perf_before, perf_after;
+  int64_t perf_deltas[SFNT_PERF_MAX * 2];
+  double gap = (double) tsc.hz / cfg_rate;
+  double due_ticks = 0;
+  uint64_t start, due, now, intended;
+  uint64_t loss_ticks = (cfg_timeout[0] ? cfg_timeout[0] : OL_LOSS_TIMEOUT_S)
+                        * tsc.hz;
+  int has_seq = msg_size >= (int) sizeof(uint32_t);
+  uint32_t first, oldest, seq;
+  int sent = 0, recvd = 0, resolved = 0, got = 0, tx_off = 0, slot;
+  int64_t lat;
+  int rc;
+
+  sfnt_sock_put_int(ss, iter + 1); /* +1 as initial ping  below */
+  sfnt_sock_put_int(ss, msg_size);
+
+  /* Touch to ensure resident. */
+  if( raw != NULL )
+    memset(raw, 0, iter * sizeof(raw[0]));
+
+  /* Ensure server is ready. */
+  do_ping(read_fd, write_fd, msg_size);
+
+  /* read() and write() ignore MSG_DONTWAIT. */
+  if( fd_type == FDT_PIPE && ! cfg_spin[0] ) {
+    sfnt_fd_set_nonblocking(read_fd);
+    sfnt_fd_set_nonblocking(write_fd);
+  }
+
+  if( cfg_perf_counters != NULL ) {
+    sfnt_perf_sample(&perf, &perf_before);
+    sfnt_perf_enable(&perf);
+  }
+  if( hist != NULL && cfg_stall_threshold )
+    sfnt_stall_rebase(&stall);
+  first = oldest = ol_seq;
+  sfnt_tsc(&start);
+  due = start;
+  while( resolved < iter ) {
+    sfnt_tsc(&now);
+    /* Send (or carry on sending) the next ping if it is due and there is
+     * room for it in the window.
+     */
+    slot = ol_seq & (OL_MAX_OUTSTANDING - 1);
+    if( sent < iter && (tx_off > 0 || ((int64_t) (now - due) >= 0 &&
+                                       ! ol_pending[slot])) ) {
+      if( tx_off == 0 ) {
+        ol_send_ts[slot] = due;
+        ol_tx_ts[slot] = now;
+        if( has_seq )
+          memcpy(ol_txbuf, &ol_seq, sizeof(ol_seq));
+        SFNT_PROBE1(ping_send, msg_size);
+      }
+      rc = do_send(write_fd, ol_txbuf + tx_off, msg_size - tx_off,
+                   MSG_DONTWAIT);
+      if( rc < 0 && errno != EAGAIN ) {
+        sfnt_err("ERROR: send failed (%d %s)\n", errno, strerror(errno));
+        sfnt_fail_test();
+      }
+      if( rc >= 0 && (tx_off += rc) == msg_size ) {
+        tx_off = 0;
+        ol_pending[slot] = 1;
+        ++ol_seq;
+        ++sent;
+        due_ticks += cfg_poisson ? -log(sfnt_rand_uniform()) * gap : gap;
+        due = start + (uint64_t) due_ticks;
+        continue;
+      }
+    }
+
+    rc = do_recv(read_fd, ppbuf + got, recv_size(msg_size) - got,
+                 MSG_DONTWAIT);
+    if( rc < 0 ) {
+      if( errno != EAGAIN ) {
+        sfnt_err("ERROR: recv failed (%d %s)\n", errno, strerror(errno));
+        sfnt_fail_test();
+      }
+      /* Give up on the oldest ping if it has waited too long. */
+      slot = oldest & (OL_MAX_OUTSTANDING - 1);
+      if( oldest != ol_seq && now - ol_tx_ts[slot] > loss_ticks ) {
+        if( ! (fd_type & FDTF_STREAM) ) {
+          ol_pending[slot] = 0;
+          ++ol_lost;
+          ++resolved;
+          while( oldest != ol_seq &&
+                 ! ol_pending[oldest & (OL_MAX_OUTSTANDING - 1)] )
+            ++oldest;
+        }
+        else if( cfg_timeout[0] ) {
+          sfnt_err("ERROR: no open-loop reply after %us\n", cfg_timeout[0]);
+          sfnt_fail_test();
+        }
+      }
+      continue;
+    }
+    NT_TEST(rc > 0 || ! (fd_type & FDTF_STREAM));
+    if( (got += rc) < msg_size )
+      continue;
+    sfnt_tsc(&now);
+    got = 0;
+
+    if( has_seq )
+      memcpy(&seq, ppbuf, sizeof(seq));
+    else
+      seq = oldest;
+    slot = seq & (OL_MAX_OUTSTANDING - 1);
+    /* Replies to pings from an earlier batch, or already counted lost. */
+    if( seq - first >= (uint32_t) sent ||
+        ol_seq - seq > OL_MAX_OUTSTANDING || ! ol_pending[slot] ) {
+      ++ol_stale;
+      continue;
+    }
+    ol_pending[slot] = 0;
+    ++resolved;
+    while( oldest != ol_seq && ! ol_pending[oldest & (OL_MAX_OUTSTANDING - 1)] )
+      ++oldest;
+
+    intended = ol_send_ts[slot];
+    lat = sfnt_tsc_nsec(&tsc, now - intended - tsc.tsc_cost);
+    if( ! cfg_rtt )
+      lat /= 2;
+    SFNT_PROBE1(pong_recv, msg_size);
+    SFNT_PROBE3(ping_done, msg_size, recvd, lat);
+    if( rawlog_cur != NULL )
+      rawlog_put(now, lat);
+    if( hist != NULL )
+      sfnt_hist_record(hist, lat);
+    if( hist != NULL && cfg_interval )
+      sfnt_timeline_record(&timeline, sfnt_tsc_nsec(&tsc, now - sweep_start),
+                           lat);
+    if( hist != NULL && cfg_stall_threshold )
+      sfnt_stall_check(&stall, lat,
+                       sfnt_tsc_nsec(&tsc, now - sweep_start) * 1e-6,
+                       msg_size);
+    if( raw != NULL )
+      raw[recvd] = lat;
+    ++recvd;
+  }
+
+  if( cfg_perf_counters != NULL ) {
+    sfnt_perf_disable(&perf);
+    sfnt_perf_sample(&perf, &perf_after);
+  }
+  if( fd_type == FDT_PIPE && ! cfg_spin[0] ) {
+    sfnt_fd_set_blocking(read_fd);
+    sfnt_fd_set_blocking(write_fd);
+  }
+  /* Tell the server that the batch is over. */
+  if( ! (fd_type & FDTF_STREAM) )
+    sfnt_sock_put_int(ss, 0);
+  if( cfg_perf_counters != NULL ) {
+    sfnt_perf_delta(&perf, &perf_before, &perf_after, perf_deltas);
+    perf_get_server(ss, perf_deltas + perf.n);
+    if( perf_cur != NULL )
+      perf_accumulate(perf_cur, perf_deltas);
+  }
+  if( recvd == 0 ) {
+    sfnt_err("ERROR: all %d open-loop pings were lost\n", iter);
+    sfnt_fail_test();
+  }
+  return recvd;
+}
 
-  qsort(results, results_n, sizeof(int64_t), &sfnt_qsort_compare_int64);
-  sfnt_iarray_mean_and_limits_int64(results, results_end, &s->mean, &s->min, &s->max);
 
-  s->median = results[results_n >> 1u];
-  s->percentile = results[(int64_t) (results_n * cfg_percentile / 100)];
-  sfnt_iarray_variance_int64(results, results_end, s->mean, &variance);
-  s->stddev = (uint64_t) sqrt(variance);
+static void get_stats(struct stats* s, const struct sfnt_hist* h)
+{
+  s->mean = sfnt_hist_mean(h);
+  s->min = h->min;
+  s->max = h->max;
+  s->median = sfnt_hist_percentile(h, 50);
+  s->percentile = sfnt_hist_percentile(h, cfg_percentile);
+  s->stddev = (uint64_t) sfnt_hist_stddev(h);
 }
 
 
-static void write_raw_results(int msg_size, int64_t* results, int results_n)
+static void write_raw_results(int msg_size, int64_t* results,
+                              int64_t results_n, int append)
 {
   char* fname = (char*) alloca(strlen(cfg_raw) + 30);
   FILE* f;
-  int i;
-  sprintf(fname, "%s-%d.dat", cfg_raw, msg_size);
-  if( (f = fopen(fname, "w")) == NULL ) {
+  int64_t i;
+  if( cur_gap >= 0 )
+    sprintf(fname, "%s-%d-gap%d.dat", cfg_raw, msg_size, cur_gap);
+  else
+    sprintf(fname, "%s-%d.dat", cfg_raw, msg_size);
+  if( (f = fopen(fname, append ? "a" : "w")) == NULL ) {
     sfnt_err("ERROR: Could not open output file '%s'\n", fname);
     sfnt_fail_test();
   }
@@ -1146,11 +2078,275 @@ static void write_raw_results(int msg_size, int64_t* results, int results_n)
 }
 
 
+/* With --raw-format=bin, samples are queued as they are measured and
+ * written out by a background thread.
+ */
+static void rawlog_begin(int msg_size)
+{
+  char* fname = (char*) alloca(strlen(cfg_raw) + 30);
+  char hdr[128];
+  int rc;
+  if( cur_gap >= 0 )
+    sprintf(fname, "%s-%d-gap%d.sfr", cfg_raw, msg_size, cur_gap);
+  else
+    sprintf(fname, "%s-%d.sfr", cfg_raw, msg_size);
+  snprintf(hdr, sizeof(hdr), "tool=sfnt-pingpong\nsize=%d\ngap_us=%d\n"
+           "rate=%d\nrtt=%d\n", msg_size, cur_gap, cfg_rate, cfg_rtt);
+  if( (rc = sfnt_rawlog_open(&rawlog, fname, &tsc, "time_ns,latency_ns",
+                             hdr)) < 0 ) {
+    sfnt_err("ERROR: Could not open output file '%s' (%s)\n",
+             fname, strerror(-rc));
+    sfnt_fail_test();
+  }
+  rawlog_cur = &rawlog;
+}
+
+
+static void rawlog_end(void)
+{
+  int rc;
+  rawlog_cur = NULL;
+  if( (rc = sfnt_rawlog_close(&rawlog)) < 0 ) {
+    sfnt_err("ERROR: Failed to write raw results (%s)\n", strerror(-rc));
+    sfnt_fail_test();
+  }
+  if( rawlog.n_stalls )
+    printf("# WARNING: raw results writer fell behind %"PRIu64" times\n",
+           rawlog.n_stalls);
+}
+
+
+static void write_hist_file(int msg_size, const struct sfnt_hist* h)
+{
+  char* fname = (char*) alloca(strlen(cfg_histfile) + 30);
+  FILE* f;
+  if( cur_gap >= 0 )
+    sprintf(fname, "%s-%d-gap%d.hist", cfg_histfile, msg_size, cur_gap);
+  else
+    sprintf(fname, "%s-%d.hist", cfg_histfile, msg_size);
+  if( (f = fopen(fname, "w")) == NULL ) {
+    sfnt_err("ERROR: Could not open output file '%s'\n", fname);
+    sfnt_fail_test();
+  }
+  NT_TRY(sfnt_hist_write(f, h, 0));
+  fclose(f);
+}
+
+
+static void write_timeline_file(const char* prefix, const char* suffix,
+                                int msg_size, int append,
+                                int (*write_fn)(const struct sfnt_timeline*,
+                                                FILE*, int64_t, int64_t, int))
+{
+  char* fname = (char*) alloca(strlen(prefix) + 40);
+  FILE* f;
+  if( cur_gap >= 0 )
+    sprintf(fname, "%s-%d-gap%d.%s", prefix, msg_size, cur_gap, suffix);
+  else
+    sprintf(fname, "%s-%d.%s", prefix, msg_size, suffix);
+  if( (f = fopen(fname, append ? "a" : "w")) == NULL ) {
+    sfnt_err("ERROR: Could not open output file '%s'\n", fname);
+    sfnt_fail_test();
+  }
+  NT_TRY(write_fn(&timeline, f, 0, 0, ! append));
+  fclose(f);
+}
+
+
+/* Times in the timeline are relative to the start of the sweep, so with
+ * --interleave the chunks for each size appear at the times they ran.
+ */
+static void write_timeline(int msg_size, int append)
+{
+  sfnt_timeline_flush(&timeline);
+  if( cfg_timeline != NULL )
+    write_timeline_file(cfg_timeline, "timeline", msg_size, append,
+                        sfnt_timeline_write);
+  if( cfg_heatmap != NULL )
+    write_timeline_file(cfg_heatmap, "heatmap", msg_size, append,
+                        sfnt_timeline_write_heatmap);
+}
+
+
+/* Dump the records in the --trace ring, oldest first.  Times are relative
+ * to the start of the sweep.  The setup and recv stages are zero when not
+ * using a muxer, as the wait is then inside recv().
+ */
+static void write_trace(int msg_size, int append)
+{
+  char* fname = (char*) alloca(strlen(cfg_trace) + 30);
+  const struct trace_rec* r;
+  int64_t i, n;
+  FILE* f;
+
+  if( cur_gap >= 0 )
+    sprintf(fname, "%s-%d-gap%d.trace", cfg_trace, msg_size, cur_gap);
+  else
+    sprintf(fname, "%s-%d.trace", cfg_trace, msg_size);
+  if( (f = fopen(fname, append ? "a" : "w")) == NULL ) {
+    sfnt_err("ERROR: Could not open output file '%s'\n", fname);
+    sfnt_fail_test();
+  }
+  if( ! append )
+    fprintf(f, "#time(ms)\tsend\tsetup\twait\trecv\tpolls\n");
+  n = trace_n < cfg_trace_len ? trace_n : cfg_trace_len;
+  for( i = trace_n - n; i < trace_n; ++i ) {
+    r = &trace_ring[i % cfg_trace_len];
+    fprintf(f, "%.6f\t%"PRId64"\t", sfnt_tsc_nsec(&tsc, r->send_start -
+                                                   sweep_start) * 1e-6,
+            sfnt_tsc_nsec(&tsc, r->send_done - r->send_start));
+    if( r->wait_start )
+      fprintf(f, "%"PRId64"\t%"PRId64"\t%"PRId64,
+              sfnt_tsc_nsec(&tsc, r->wait_start - r->send_done),
+              sfnt_tsc_nsec(&tsc, r->wait_done - r->wait_start),
+              sfnt_tsc_nsec(&tsc, r->recv_done - r->wait_done));
+    else
+      fprintf(f, "0\t%"PRId64"\t0",
+              sfnt_tsc_nsec(&tsc, r->recv_done - r->send_done));
+    fprintf(f, "\t%"PRIu64"\n", r->polls);
+  }
+  fclose(f);
+  trace_n = 0;
+}
+
+
+/* Print the distribution of each --trace stage. */
+static void trace_report(int msg_size, const struct sfnt_hist* hists)
+{
+  static const char* names[TR_N] = { "send", "setup", "wait", "recv",
+                                     "polls" };
+  static const double tr_pcts[] = { 50, 90, 99 };
+  int64_t vals[3];
+  int i;
+
+  for( i = 0; i < TR_N; ++i ) {
+    if( hists[i].n == 0 )
+      continue;
+    sfnt_hist_percentiles(&hists[i], tr_pcts, vals, 3);
+    printf("# trace: size=%d %s mean=%"PRId64" min=%"PRId64" p50=%"PRId64
+           " p90=%"PRId64" p99=%"PRId64" max=%"PRId64"\n", msg_size,
+           names[i], sfnt_hist_mean(&hists[i]), hists[i].min, vals[0],
+           vals[1], vals[2], hists[i].max);
+  }
+  fflush(stdout);
+}
+
+
+/* Print results of the noise preflight, and warn or fail if the core lost
+ * more time than --noise-budget allows.
+ */
+static void noise_report(const char* who, const char* core,
+                         const struct sfnt_noise* n)
+{
+  char* label = alloca(strlen(who) + (core ? strlen(core) : 3) + 10);
+  double pct = sfnt_noise_stolen_pct(n);
+
+  sprintf(label, "%s core=%s", who, core ? core : "any");
+  sfnt_noise_print(stdout, label, n);
+  if( cfg_noise_budget <= 0 || pct <= cfg_noise_budget )
+    return;
+  if( cfg_noise_fail ) {
+    fflush(stdout);
+    sfnt_err("ERROR: %s lost %.4f%% of time to OS noise (budget %g%%)\n",
+             label, pct, (double) cfg_noise_budget);
+    sfnt_fail_setup();
+  }
+  printf("# WARNING: %s lost %.4f%% of time to OS noise (budget %g%%)\n",
+         label, pct, (double) cfg_noise_budget);
+}
+
+
+static FILE* stall_log_open(const char* fname)
+{
+  FILE* f;
+  if( fname == NULL )
+    return stderr;
+  if( (f = fopen(fname, "w")) == NULL ) {
+    sfnt_err("ERROR: Could not open output file '%s'\n", fname);
+    sfnt_fail_setup();
+  }
+  return f;
+}
+
+
+/* Relative half-width of the 95% confidence interval of the --converge
+ * percentile, or -1 if there are not yet enough samples to bound it.  The
+ * interval is at least one histogram bucket wide, as values within a bucket
+ * cannot be told apart.
+ */
+static double converge_relerr(const struct sfnt_hist* h)
+{
+  int64_t lo, hi, q, width;
+  if( h->n == 0 || sfnt_hist_percentile_ci(h, conv_pct, 1.96, &lo, &hi) < 0 )
+    return -1;
+  q = sfnt_hist_percentile(h, conv_pct);
+  width = sfnt_hist_bucket_width(h, sfnt_hist_bucket(h, q));
+  if( hi - lo < width )
+    hi = lo + width;
+  return q ? (double) (hi - lo) / 2 / q : 0;
+}
+
+
+/* Energy is sampled around each call to run_test(), so includes the
+ * exchanges with the server between batches.
+ */
+static void energy_begin(struct sfnt_energy_sample* before, uint64_t* ts)
+{
+  sfnt_energy_sample(&energy, before);
+  sfnt_tsc(ts);
+}
+
+
+static void energy_end(const struct sfnt_energy_sample* before, uint64_t ts,
+                       int64_t* sums)
+{
+  struct sfnt_energy_sample after;
+  int64_t uj[SFNT_ENERGY_MAX];
+  uint64_t now;
+  int i;
+
+  sfnt_energy_sample(&energy, &after);
+  sfnt_tsc(&now);
+  sfnt_energy_delta(&energy, before, &after, uj);
+  /* Once a domain's energy is unknown it stays unknown. */
+  for( i = 0; i < energy.n; ++i )
+    if( uj[i] < 0 || sums[i] < 0 )
+      sums[i] = -1;
+    else
+      sums[i] += uj[i];
+  sums[energy.n] += sfnt_tsc_nsec(&tsc, now - ts);
+}
+
+
+/* Snapshot TCP_INFO for our socket and the server's. */
+static void tcpi_snap(int ss, int sock, struct sfnt_tcp_info* ti)
+{
+  NT_TRY(sfnt_tcp_info_read(sock, &ti[0]));
+  sfnt_sock_put_int(ss, CMD_TCP_INFO);
+  sfnt_tcp_info_get(ss, &ti[1]);
+}
+
+
+static void tcpi_add(struct tcpi_result* r, const struct sfnt_tcp_info* start,
+                     const struct sfnt_tcp_info* end)
+{
+  int i;
+  for( i = 0; i < 2; ++i ) {
+    r->end[i] = end[i];
+    if( start[i].total_retrans < 0 || r->retrans[i] < 0 )
+      r->retrans[i] = -1;
+    else
+      r->retrans[i] += end[i].total_retrans - start[i].total_retrans;
+  }
+}
+
+
 static void run_test(int ss, int read_fd, int write_fd, int maxms, int minms,
-                     int maxiter, int miniter, int* results_n, int msg_size,
-                     int64_t* results)
+                     int64_t maxiter, int64_t miniter, int64_t* results_n,
+                     int msg_size, struct sfnt_hist* hist, int64_t* raw)
 {
-  int n_this_time = miniter;
+  int64_t n_this_time = miniter;
+  int64_t done, n;
   uint64_t start, end, ticks;
   uint64_t freq = monotonic_clock_freq();
   uint64_t minticks = minms * freq / 1000;
@@ -1158,18 +2354,47 @@ static void run_test(int ss, int read_fd, int write_fd, int maxms, int minms,
 
   start = monotonic_clock();
 
+  if( n_this_time > MAX_BATCH_ITER )
+    n_this_time = MAX_BATCH_ITER;
+  /* In open-loop mode the duration of a batch is fixed by the rate, so
+   * keep batches short enough not to overshoot maxms by much.
+   */
+  if( cfg_rate && n_this_time > cfg_rate / 10 )
+    n_this_time = cfg_rate / 10 ? cfg_rate / 10 : 1;
+
   do {
     if( *results_n + n_this_time > maxiter )
       n_this_time = maxiter - *results_n;
     if( n_this_time == 0 )
       break;     /* No point in continuing, even if minms is not yet met */
 
-    do_pings(ss, read_fd, write_fd, msg_size,
-             n_this_time, results + *results_n);
-    *results_n += n_this_time;
+    if( cfg_rate ) {
+      *results_n += do_pings_open_loop(ss, read_fd, write_fd, msg_size,
+                                       (int) n_this_time, hist,
+                                       raw ? raw + *results_n : NULL);
+    }
+    else {
+      for( done = 0; done < n_this_time; done += n ) {
+        n = n_this_time - done;
+        if( cfg_turnaround && n > TA_MAX_BATCH_ITER )
+          n = TA_MAX_BATCH_ITER;
+        do_pings(ss, read_fd, write_fd, msg_size, (int) n,
+                 hist, raw ? raw + *results_n : NULL);
+        *results_n += n;
+      }
+    }
 
     end = monotonic_clock();
     ticks = end - start;
+
+    /* In --converge mode we stop as soon as the chosen percentile is
+     * known well enough, ignoring minms.
+     */
+    if( cfg_converge != NULL && hist != NULL && *results_n >= miniter ) {
+      double relerr = converge_relerr(hist);
+      if( relerr >= 0 && relerr <= conv_relerr )
+        break;
+    }
   } while( (ticks < maxticks && *results_n < maxiter) ||
            (ticks < minticks || *results_n < miniter) );
 }
@@ -1177,46 +2402,430 @@ static void run_test(int ss, int read_fd, int write_fd, int maxms, int minms,
 
 static void do_warmup(int ss, int read_fd, int write_fd)
 {
-  int results_n = 0;
-  int64_t* results;
+  int64_t results_n = 0;
 
-  /* If the requested warmup timeout is large with respect to the number of
-   * warmup iterations, the warmup would sit doing nothing after the requested
-   * number of iterations elapsed, which is unhelpful.  Ideally we would like
-   * to allow an unbounded number of iterations up to the timeout, but we have
-   * to provide some storage for each iteration, so we synthesise a bound. */
-  const int MIN_RESOLUTION_NS = 50;
-  int maxiter = cfg_warmupms * (1000000 / MIN_RESOLUTION_NS);
-  if( cfg_warmupiter > maxiter )
-    maxiter = cfg_warmupiter;
+  /* Run for at least cfg_warmupms milliseconds and at least cfg_warmupiter
+   * iterations.  Warmup results are not recorded, so there is no need to
+   * bound the number of iterations. */
+  run_test(ss, read_fd, write_fd, cfg_warmupms, cfg_warmupms, INT64_MAX,
+           cfg_warmupiter, &results_n, 1, NULL, NULL);
+}
 
-  results = malloc(maxiter * sizeof(*results));
-  NT_TEST(results != NULL);
 
-  /* Run for at least cfg_warmupms milliseconds and at least cfg_warmupiter
-   * iterations. */
-  run_test(ss, read_fd, write_fd, cfg_warmupms, cfg_warmupms, maxiter,
-           cfg_warmupiter, &results_n, 1, results);
+/* Each value in a row of results is printed after a tab, or added to the
+ * row for --format.  Missing values are "-".
+ */
+static void col_i64(const char* name, int64_t v)
+{
+  if( out_format == SFNT_FORMAT_TEXT )
+    printf("\t%"PRId64, v);
+  else
+    sfnt_record_int(&results, name, v);
+}
+
 
-  free(results);
+static void col_float(const char* name, int precision, double v)
+{
+  if( out_format == SFNT_FORMAT_TEXT )
+    printf("\t%.*f", precision, v);
+  else
+    sfnt_record_float(&results, name, v, precision);
 }
 
 
-static void do_test(int ss, int read_fd, int write_fd,
-                    int msg_size, int64_t* results)
+static void col_none(const char* name)
+{
+  if( out_format == SFNT_FORMAT_TEXT )
+    printf("\t-");
+  else
+    sfnt_record_str(&results, name, NULL);
+}
+
+
+static void col_opt_i64(const char* name, int64_t v)
+{
+  if( v < 0 )
+    col_none(name);
+  else
+    col_i64(name, v);
+}
+
+
+/* Column name built from [fmt].  Valid until the next call. */
+static const char* col_name(const char* fmt, ...)
+{
+  static char name[64];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(name, sizeof(name), fmt, args);
+  va_end(args);
+  return name;
+}
+
+
+/* Print mean run delay (ns), and context switches and migrations per
+ * iteration.
+ */
+static void sched_stats_print(const char* side,
+                              const struct sfnt_sched_stats* s, int64_t n)
+{
+  if( s->run_delay < 0 || s->n_runs <= 0 )
+    col_none(col_name("%s:rundly", side));
+  else
+    col_i64(col_name("%s:rundly", side), s->run_delay / s->n_runs);
+  if( s->n_switches < 0 || n == 0 )
+    col_none(col_name("%s:csw", side));
+  else
+    col_float(col_name("%s:csw", side), 2, (double) s->n_switches / n);
+  if( s->n_migrations < 0 || n == 0 )
+    col_none(col_name("%s:mig", side));
+  else
+    col_float(col_name("%s:mig", side), 3, (double) s->n_migrations / n);
+}
+
+
+static void tcpi_print(const struct tcpi_result* r)
+{
+  const struct sfnt_tcp_info* ti;
+  const char* side;
+  int i;
+  for( i = 0; i < 2; ++i ) {
+    ti = &r->end[i];
+    side = i ? "s" : "c";
+    col_opt_i64(col_name("%s:srtt", side), ti->rtt);
+    col_opt_i64(col_name("%s:retx", side), r->retrans[i]);
+    col_opt_i64(col_name("%s:dlvr", side), ti->delivery_rate < 0 ? -1 :
+                ti->delivery_rate * 8 / 1000000);
+    col_opt_i64(col_name("%s:pace", side), ti->pacing_rate < 0 ? -1 :
+                ti->pacing_rate * 8 / 1000000);
+    col_opt_i64(col_name("%s:unack", side), ti->unacked);
+    col_opt_i64(col_name("%s:cwnd", side), ti->snd_cwnd);
+  }
+}
+
+
+/* [segs] gives the round-trip breakdown from --timestamping, [ta] the
+ * server and network times from --turnaround, [pc] the counts from
+ * --perf-counters, [en] the energy from --energy, [sch] the client and
+ * server scheduler stats from --sched-stats and [tcpi] the TCP_INFO from
+ * --tcp-info.  Any may be NULL.
+ */
+static void write_result_line(int msg_size, const struct sfnt_hist* h,
+                              const struct sfnt_hist* segs,
+                              const struct sfnt_hist* ta, const int64_t* pc,
+                              const int64_t* en,
+                              const struct sfnt_sched_stats* sch,
+                              const struct tcpi_result* tcpi,
+                              int64_t results_n)
 {
-  int results_n = 0;
   struct stats s;
+  const char* name;
+  int i;
+
+  if( cfg_histfile != NULL )
+    write_hist_file(msg_size, h);
+  get_stats(&s, h);
+  col_i64("size", msg_size);
+  if( cur_gap >= 0 ) {
+    col_i64("gap", cur_gap);
+    col_i64("idle", gap_idle_n ?
+            sfnt_tsc_nsec(&tsc, gap_idle / gap_idle_n) / 1000 : 0);
+  }
+  col_i64("mean", s.mean);
+  col_i64("min", s.min);
+  col_i64("median", s.median);
+  col_i64("max", s.max);
+  col_i64("%ile", s.percentile);
+  col_i64("stddev", s.stddev);
+  col_i64("iter", results_n);
+  if( pcts_n ) {
+    int64_t* vals = alloca(pcts_n * sizeof(vals[0]));
+    sfnt_hist_percentiles(h, pcts, vals, pcts_n);
+    for( i = 0; i < pcts_n; ++i )
+      col_i64(col_name("p%g", pcts[i]), vals[i]);
+  }
+  if( cfg_converge != NULL ) {
+    double relerr = converge_relerr(h);
+    if( relerr < 0 )
+      col_none("ci%");
+    else
+      col_float("ci%", 2, relerr * 100);
+  }
+  if( segs != NULL )
+    for( i = 0; i < TS_N_SEGS; ++i ) {
+      if( segs[i].n )
+        col_i64(ts_seg_names[i], sfnt_hist_mean(&segs[i]));
+      else
+        col_none(ts_seg_names[i]);
+    }
+  if( ta != NULL )
+    for( i = 0; i < TA_N; ++i ) {
+      col_i64(ta_names[i], sfnt_hist_mean(&ta[i]));
+      col_i64(col_name("%s%%ile", ta_names[i]),
+              sfnt_hist_percentile(&ta[i], cfg_percentile));
+    }
+  if( pc != NULL )
+    for( i = 0; i < perf.n * 2; ++i ) {
+      name = col_name("%s:%s", i < perf.n ? "c" : "s", perf.names[i % perf.n]);
+      if( pc[i] < 0 || results_n == 0 )
+        col_none(name);
+      else
+        col_float(name, 1, (double) pc[i] / results_n);
+    }
+  if( en != NULL )
+    for( i = 0; i < energy.n; ++i ) {
+      if( results_n == 0 || en[energy.n] == 0 || en[i] < 0 ) {
+        col_none(col_name("%s:uJ", energy.names[i]));
+        col_none(col_name("%s:W", energy.names[i]));
+      }
+      else {
+        col_float(col_name("%s:uJ", energy.names[i]), 2,
+                  (double) en[i] / results_n);
+        col_float(col_name("%s:W", energy.names[i]), 2,
+                  en[i] * 1e3 / en[energy.n]);
+      }
+    }
+  if( sch != NULL )
+    for( i = 0; i < 2; ++i )
+      sched_stats_print(i ? "s" : "c", &sch[i], results_n);
+  if( tcpi != NULL )
+    tcpi_print(tcpi);
+  if( out_format == SFNT_FORMAT_TEXT ) {
+    printf("\n");
+    fflush(stdout);
+  }
+  else {
+    sfnt_record_write(&results, results_keep);
+  }
+}
+
+
+static void do_test(int ss, int read_fd, int write_fd,
+                    int msg_size, int64_t* raw)
+{
+  struct sfnt_energy_sample en_before;
+  struct sfnt_tcp_info tcpi_start[2], tcpi_end[2];
+  uint64_t en_ts;
+  int64_t results_n = 0;
+  int i;
 
+  sfnt_hist_reset(&lat_hist);
+  gap_idle = 0;
+  gap_idle_n = 0;
+  if( cfg_interval )
+    sfnt_timeline_reset(&timeline);
+  if( cfg_timestamping ) {
+    for( i = 0; i < TS_N_SEGS; ++i )
+      sfnt_hist_reset(&seg_hists[i]);
+    ts_hists = seg_hists;
+  }
+  if( cfg_turnaround ) {
+    for( i = 0; i < TA_N; ++i )
+      sfnt_hist_reset(&ta_hists[i]);
+    ta_cur = ta_hists;
+  }
+  if( cfg_trace != NULL ) {
+    for( i = 0; i < TR_N; ++i )
+      sfnt_hist_reset(&trace_hists[i]);
+    tr_cur = trace_hists;
+  }
+  if( cfg_perf_counters != NULL ) {
+    memset(perf_sums, 0, perf.n * 2 * sizeof(perf_sums[0]));
+    perf_cur = perf_sums;
+  }
+  if( cfg_sched_stats ) {
+    memset(sched_sums, 0, sizeof(sched_sums));
+    sched_cur = sched_sums;
+  }
+  if( cfg_tcp_info ) {
+    memset(&tcpi_res, 0, sizeof(tcpi_res));
+    tcpi_snap(ss, read_fd, tcpi_start);
+  }
+  if( energy.n ) {
+    memset(energy_sums, 0, (energy.n + 1) * sizeof(energy_sums[0]));
+    energy_begin(&en_before, &en_ts);
+  }
+  if( raw_bin )
+    rawlog_begin(msg_size);
   run_test(ss, read_fd, write_fd, cfg_maxms, cfg_minms, cfg_maxiter,
-           cfg_miniter, &results_n, msg_size, results);
+           cfg_miniter, &results_n, msg_size, &lat_hist, raw);
+  if( raw_bin )
+    rawlog_end();
+  if( energy.n )
+    energy_end(&en_before, en_ts, energy_sums);
+  if( cfg_tcp_info ) {
+    tcpi_snap(ss, read_fd, tcpi_end);
+    tcpi_add(&tcpi_res, tcpi_start, tcpi_end);
+  }
+  ts_hists = NULL;
+  sched_cur = NULL;
+  ta_cur = NULL;
+  tr_cur = NULL;
+  perf_cur = NULL;
+
+  if( cfg_raw != NULL && ! raw_bin )
+    write_raw_results(msg_size, raw, results_n, 0);
+  if( cfg_interval )
+    write_timeline(msg_size, 0);
+  if( cfg_trace != NULL )
+    write_trace(msg_size, 0);
+  write_result_line(msg_size, &lat_hist,
+                    cfg_timestamping ? seg_hists : NULL,
+                    cfg_turnaround ? ta_hists : NULL,
+                    cfg_perf_counters ? perf_sums : NULL,
+                    energy.n ? energy_sums : NULL,
+                    cfg_sched_stats ? sched_sums : NULL,
+                    cfg_tcp_info ? &tcpi_res : NULL, results_n);
+  if( cfg_trace != NULL )
+    trace_report(msg_size, trace_hists);
+}
 
-  if( cfg_raw != NULL )
-    write_raw_results(msg_size, results, results_n);
-  get_stats(&s, results, results_n);
-  printf("\t%d\t%"PRId64"\t%"PRId64"\t%"PRId64"\t%"PRId64"\t%"PRId64"\t%"PRId64"\t%d\n",
-            msg_size, s.mean, s.min, s.median, s.max, s.percentile, s.stddev, results_n);
-  fflush(stdout);
+
+static int64_t div_round_up(int64_t n, int64_t d)
+{
+  return (n + d - 1) / d;
+}
+
+
+/* With --interleave each message size is measured in cfg_interleave
+ * chunks, each with 1/cfg_interleave of the time and iteration budget.
+ * The chunks for all sizes are run in a random order, so that any drift
+ * in the system's performance over the course of the sweep is spread
+ * evenly over the sizes rather than being confounded with size.
+ */
+static void do_tests_interleaved(int ss, int read_fd, int write_fd,
+                                 const struct sfnt_ilist* msg_sizes,
+                                 int64_t* raw)
+{
+  int n_tasks = msg_sizes->len * cfg_interleave;
+  int* tasks = malloc(n_tasks * sizeof(int));
+  int* chunks_done = calloc(msg_sizes->len, sizeof(int));
+  int64_t* results_n = calloc(msg_sizes->len, sizeof(int64_t));
+  struct sfnt_hist* hists = calloc(msg_sizes->len, sizeof(struct sfnt_hist));
+  struct sfnt_hist* segs = NULL;
+  int n_segs = cfg_timestamping ? msg_sizes->len * TS_N_SEGS : 0;
+  struct sfnt_hist* tas = NULL;
+  int n_tas = cfg_turnaround ? msg_sizes->len * TA_N : 0;
+  struct sfnt_hist* trs = NULL;
+  int n_trs = cfg_trace != NULL ? msg_sizes->len * TR_N : 0;
+  int64_t* pcs = NULL;
+  int64_t* ens = NULL;
+  struct sfnt_sched_stats* schs = NULL;
+  struct tcpi_result* tcpis = NULL;
+  struct sfnt_tcp_info tcpi_start[2], tcpi_end[2];
+  struct sfnt_energy_sample en_before;
+  uint64_t en_ts;
+  int64_t chunk_n;
+  int i, size_i, msg_size;
+
+  NT_TEST(tasks && chunks_done && results_n && hists);
+  for( i = 0; i < msg_sizes->len; ++i )
+    NT_TEST(sfnt_hist_init(&hists[i], SFNT_HIST_SUB_BITS) == 0);
+  if( n_segs ) {
+    NT_TEST((segs = calloc(n_segs, sizeof(struct sfnt_hist))) != NULL);
+    for( i = 0; i < n_segs; ++i )
+      NT_TEST(sfnt_hist_init(&segs[i], SFNT_HIST_SUB_BITS) == 0);
+  }
+  if( n_tas ) {
+    NT_TEST((tas = calloc(n_tas, sizeof(struct sfnt_hist))) != NULL);
+    for( i = 0; i < n_tas; ++i )
+      NT_TEST(sfnt_hist_init(&tas[i], SFNT_HIST_SUB_BITS) == 0);
+  }
+  if( n_trs ) {
+    NT_TEST((trs = calloc(n_trs, sizeof(struct sfnt_hist))) != NULL);
+    for( i = 0; i < n_trs; ++i )
+      NT_TEST(sfnt_hist_init(&trs[i], SFNT_HIST_SUB_BITS) == 0);
+  }
+  if( cfg_perf_counters != NULL )
+    NT_TEST((pcs = calloc(msg_sizes->len * perf.n * 2,
+                          sizeof(pcs[0]))) != NULL);
+  if( energy.n )
+    NT_TEST((ens = calloc(msg_sizes->len * (energy.n + 1),
+                          sizeof(ens[0]))) != NULL);
+  if( cfg_sched_stats )
+    NT_TEST((schs = calloc(msg_sizes->len * 2, sizeof(schs[0]))) != NULL);
+  if( cfg_tcp_info )
+    NT_TEST((tcpis = calloc(msg_sizes->len, sizeof(tcpis[0]))) != NULL);
+  for( i = 0; i < n_tasks; ++i )
+    tasks[i] = i % msg_sizes->len;
+  sfnt_rand_shuffle(tasks, n_tasks);
+
+  for( i = 0; i < n_tasks; ++i ) {
+    size_i = tasks[i];
+    msg_size = msg_sizes->list[size_i];
+    chunk_n = 0;
+    if( cfg_interval )
+      sfnt_timeline_reset(&timeline);
+    if( segs != NULL )
+      ts_hists = &segs[size_i * TS_N_SEGS];
+    if( tas != NULL )
+      ta_cur = &tas[size_i * TA_N];
+    if( trs != NULL )
+      tr_cur = &trs[size_i * TR_N];
+    if( pcs != NULL )
+      perf_cur = &pcs[size_i * perf.n * 2];
+    if( schs != NULL )
+      sched_cur = &schs[size_i * 2];
+    if( tcpis != NULL )
+      tcpi_snap(ss, read_fd, tcpi_start);
+    if( ens != NULL )
+      energy_begin(&en_before, &en_ts);
+    run_test(ss, read_fd, write_fd,
+             (int) div_round_up(cfg_maxms, cfg_interleave),
+             (int) div_round_up(cfg_minms, cfg_interleave),
+             div_round_up(cfg_maxiter, cfg_interleave),
+             div_round_up(cfg_miniter, cfg_interleave),
+             &chunk_n, msg_size, &hists[size_i], raw);
+    if( ens != NULL )
+      energy_end(&en_before, en_ts, &ens[size_i * (energy.n + 1)]);
+    if( tcpis != NULL ) {
+      tcpi_snap(ss, read_fd, tcpi_end);
+      tcpi_add(&tcpis[size_i], tcpi_start, tcpi_end);
+    }
+    ts_hists = NULL;
+    ta_cur = NULL;
+    tr_cur = NULL;
+    perf_cur = NULL;
+    sched_cur = NULL;
+    if( cfg_raw != NULL )
+      write_raw_results(msg_size, raw, chunk_n, chunks_done[size_i] > 0);
+    if( cfg_interval )
+      write_timeline(msg_size, chunks_done[size_i] > 0);
+    if( cfg_trace != NULL )
+      write_trace(msg_size, chunks_done[size_i] > 0);
+    results_n[size_i] += chunk_n;
+    ++chunks_done[size_i];
+  }
+
+  for( i = 0; i < msg_sizes->len; ++i ) {
+    write_result_line(msg_sizes->list[i], &hists[i],
+                      segs ? &segs[i * TS_N_SEGS] : NULL,
+                      tas ? &tas[i * TA_N] : NULL,
+                      pcs ? &pcs[i * perf.n * 2] : NULL,
+                      ens ? &ens[i * (energy.n + 1)] : NULL,
+                      schs ? &schs[i * 2] : NULL,
+                      tcpis ? &tcpis[i] : NULL, results_n[i]);
+    if( trs != NULL )
+      trace_report(msg_sizes->list[i], &trs[i * TR_N]);
+    sfnt_hist_free(&hists[i]);
+  }
+  for( i = 0; i < n_segs; ++i )
+    sfnt_hist_free(&segs[i]);
+  free(segs);
+  for( i = 0; i < n_tas; ++i )
+    sfnt_hist_free(&tas[i]);
+  free(tas);
+  for( i = 0; i < n_trs; ++i )
+    sfnt_hist_free(&trs[i]);
+  free(trs);
+  free(pcs);
+  free(ens);
+  free(schs);
+  free(tcpis);
+  free(hists);
+  free(results_n);
+  free(chunks_done);
+  free(tasks);
 }
 
 
@@ -1302,6 +2911,13 @@ static int do_client(int argc, char* argv[])
   else
     sfnt_fail_usage("unknown fd_type '%s'", fd_type_s);
 
+  if( out_format != SFNT_FORMAT_TEXT ) {
+    sfnt_record_init(&results, out_format, sfnt_record_take_stdout());
+    sfnt_record_str(&results, "tool", sfnt_app_name);
+    sfnt_record_str(&results, "config.fd_type", fd_type_s);
+    sfnt_record_str(&results, "config.host", argc == 2 ? argv[1] : NULL);
+  }
+
   if( fd_type & FDTF_LOCAL ) {
     int ss[2];
     if( argc != 1 )
@@ -1358,9 +2974,10 @@ static int do_client2(int ss, const char* hostport, int local)
   struct sfnt_ilist msg_sizes;
   int read_fd, write_fd;
   char* server_ld_preload;
+  struct sfnt_noise client_noise, server_noise;
   int msg_size;
-  int64_t* results;
-  int i, one = 1;
+  int64_t* raw = NULL;
+  int i, j, rc, one = 1;
   uint64_t old_tsc_hz;
 
   client_check_ver(ss);
@@ -1387,9 +3004,28 @@ static int do_client2(int ss, const char* hostport, int local)
   }
 
   do_init();
+  if( cfg_perf_counters != NULL ) {
+    rc = sfnt_perf_open(&perf, cfg_perf_counters);
+    if( rc == -ENOSYS )
+      sfnt_fail_usage("ERROR: --perf-counters not supported on this "
+                      "platform");
+    if( rc < 0 )
+      sfnt_fail_usage("ERROR: Unknown counter in --perf-counters");
+    NT_TEST((perf_sums = calloc(perf.n * 2, sizeof(perf_sums[0]))) != NULL);
+  }
+  /* Without energy counters the columns are left out, with a warning. */
+  if( cfg_energy ) {
+    if( (rc = sfnt_energy_open(&energy)) < 0 )
+      energy_err = -rc;
+    else
+      NT_TEST((energy_sums = calloc(energy.n + 1,
+                                    sizeof(energy_sums[0]))) != NULL);
+  }
 
   client_send_opts(ss);
   server_ld_preload = sfnt_sock_get_str(ss);
+  if( cfg_noise_ms )
+    sfnt_noise_get(ss, &server_noise);
 
   /* Create and bind/connect test socket. */
   switch( fd_type ) {
@@ -1430,22 +3066,126 @@ static int do_client2(int ss, const char* hostport, int local)
       NT_TRY(setsockopt(read_fd, SOL_SOCKET, SO_BUSY_POLL, &cfg_busy_poll[0],
                         sizeof(cfg_busy_poll[0])));
   }
+  if( cfg_timestamping ) {
+    if( fd_type != FDT_UDP && fd_type != FDT_TCP )
+      sfnt_fail_usage("ERROR: --timestamping requires udp or tcp");
+    ts_enable(read_fd);
+  }
+  if( cfg_tcp_info && fd_type != FDT_TCP )
+    sfnt_fail_usage("ERROR: --tcp-info requires tcp");
   add_fds(read_fd);
 
-  results = malloc(cfg_maxiter * sizeof(*results));
-  NT_TEST(results != NULL);
+  /* Results are accumulated in a histogram, so per-iteration storage is
+   * only needed when dumping raw results. */
+  NT_TEST(sfnt_hist_init(&lat_hist, SFNT_HIST_SUB_BITS) == 0);
+  if( cfg_interval )
+    NT_TEST(sfnt_timeline_init(&timeline, cfg_interval * (int64_t) 1000000,
+                               cfg_heatmap != NULL) == 0);
+  if( cfg_timestamping )
+    for( i = 0; i < TS_N_SEGS; ++i )
+      NT_TEST(sfnt_hist_init(&seg_hists[i], SFNT_HIST_SUB_BITS) == 0);
+  if( cfg_turnaround )
+    for( i = 0; i < TA_N; ++i )
+      NT_TEST(sfnt_hist_init(&ta_hists[i], SFNT_HIST_SUB_BITS) == 0);
+  if( cfg_trace != NULL ) {
+    for( i = 0; i < TR_N; ++i )
+      NT_TEST(sfnt_hist_init(&trace_hists[i], SFNT_HIST_SUB_BITS) == 0);
+    trace_ring = malloc(cfg_trace_len * sizeof(trace_ring[0]));
+    NT_TEST(trace_ring != NULL);
+    /* Touch to ensure resident. */
+    memset(trace_ring, 0, cfg_trace_len * sizeof(trace_ring[0]));
+  }
+  if( cfg_raw != NULL && ! raw_bin ) {
+    raw = malloc(cfg_maxiter * sizeof(*raw));
+    NT_TEST(raw != NULL);
+  }
 
   /* Very rough calibration so we've got enough data for the warmup and sys
    * info. We re-sample more accurately again after that */
   NT_TRY(sfnt_tsc_get_params_end(&tsc_measure, &tsc, 100));
+  if( cfg_noise_ms )
+    sfnt_noise_measure(&client_noise, &tsc, cfg_noise_ms, cfg_noise_threshold);
   sfnt_dump_sys_info(&tsc);
   printf("# testing with arguments: cfg_port:%d, cfg_rtt:%d, IS_TESTING_LATENCY:%d\n", cfg_port, cfg_rtt, IS_TESTING_LATENCY);
   if( server_ld_preload != NULL )
     printf("# server LD_PRELOAD=%s\n", server_ld_preload);
   printf("# percentile=%g\n", (double) cfg_percentile);
+  if( cfg_rate )
+    printf("# open-loop rate=%u%s\n", cfg_rate, cfg_poisson ? " poisson" : "");
+  if( cfg_interleave > 1 || cfg_poisson || cfg_gap_jitter )
+    printf("# seed=%"PRIu64"\n", cfg_seed);
+  if( gap_sweep.len ) {
+    printf("# gap-sweep: sleep between iterations (usec):");
+    for( i = 0; i < gap_sweep.len; ++i )
+      printf(" %d", gap_sweep.list[i]);
+    printf("\n");
+  }
+  if( cfg_gap_jitter )
+    printf("# gap-jitter=+/-%u%%\n", cfg_gap_jitter);
+  if( cfg_interleave > 1 )
+    printf("# interleave=%d\n", cfg_interleave);
+  if( cfg_interval )
+    printf("# interval=%ums\n", cfg_interval);
+  if( cfg_stall_threshold )
+    printf("# stall-threshold=%uns\n", cfg_stall_threshold);
+  if( cfg_timestamping )
+    printf("# timestamping: mean round-trip time in each segment (ns)\n");
+  if( cfg_turnaround )
+    printf("# turnaround: srv=server recv() to send() return, net=%s "
+           "less srv (ns)\n", cfg_rtt ? "round trip" : "half round trip");
+  if( cfg_perf_counters != NULL ) {
+    printf("# perf-counters: per-iteration counts on client (c:) and "
+           "server (s:)\n");
+    sfnt_perf_print_unavailable(stdout, "client", &perf);
+  }
+  if( cfg_sched_stats )
+    printf("# sched-stats: mean run delay (ns), context switches and "
+           "migrations per iteration on client (c:) and server (s:)\n");
+  if( cfg_tcp_info )
+    printf("# tcp-info: at end of each size on client (c:) and server (s:): "
+           "srtt (us), retransmits during the size, delivery and pacing "
+           "rate (Mbit/s), unacked and cwnd (segments)\n");
+  if( cfg_energy && energy.n )
+    printf("# energy: uJ per iteration and average W for the client host\n");
+  if( cfg_energy && ! energy.n )
+    printf("# WARNING: energy counters unavailable (%d %s)\n",
+           energy_err, strerror(energy_err));
+  if( cfg_noise_ms ) {
+    noise_report("client", cfg_affinity[0], &client_noise);
+    noise_report("server", cfg_affinity[1], &server_noise);
+  }
+  if( cfg_converge != NULL )
+    printf("# converge=p%g +/-%g%% (95%% confidence)\n", conv_pct,
+           conv_relerr * 100);
   printf("#\n");
-  printf("#\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n",
-              "size", "mean", "min", "median", "max", "%ile", "stddev", "iter");
+  printf("#\t%s", "size");
+  if( gap_sweep.len )
+    printf("\t%s\t%s", "gap", "idle");
+  printf("\t%s\t%s\t%s\t%s\t%s\t%s\t%s",
+              "mean", "min", "median", "max", "%ile", "stddev", "iter");
+  for( i = 0; i < pcts_n; ++i )
+    printf("\tp%g", pcts[i]);
+  if( cfg_converge != NULL )
+    printf("\t%s", "ci%");
+  if( cfg_timestamping )
+    for( i = 0; i < TS_N_SEGS; ++i )
+      printf("\t%s", ts_seg_names[i]);
+  if( cfg_turnaround )
+    for( i = 0; i < TA_N; ++i )
+      printf("\t%s\t%s%%ile", ta_names[i], ta_names[i]);
+  for( i = 0; i < perf.n * 2; ++i )
+    printf("\t%s:%s", i < perf.n ? "c" : "s", perf.names[i % perf.n]);
+  for( i = 0; i < energy.n; ++i )
+    printf("\t%s:uJ\t%s:W", energy.names[i], energy.names[i]);
+  if( cfg_sched_stats )
+    printf("\t%s\t%s\t%s\t%s\t%s\t%s", "c:rundly", "c:csw", "c:mig",
+           "s:rundly", "s:csw", "s:mig");
+  if( cfg_tcp_info )
+    for( i = 0; i < 2; ++i )
+      printf("\t%s:srtt\t%s:retx\t%s:dlvr\t%s:pace\t%s:unack\t%s:cwnd",
+             i ? "s" : "c", i ? "s" : "c", i ? "s" : "c", i ? "s" : "c",
+             i ? "s" : "c", i ? "s" : "c");
+  printf("\n");
   fflush(stdout);
 
   if( fd_type & FDTF_STREAM ) {
@@ -1475,13 +3215,82 @@ static int do_client2(int ss, const char* hostport, int local)
   NT_TRY(sfnt_tsc_get_params_end(&tsc_measure, &tsc, 50000));
   if( fabs((double)(int64_t)(tsc.hz - old_tsc_hz) / old_tsc_hz) > .01 )
     printf("# WARNING: tsc_hz changed to %"PRIu64" on recheck\n", tsc.hz);
-  for( i = 0; i < msg_sizes.len; ++i )
-    do_test(ss, read_fd, write_fd, msg_sizes.list[i], results);
+  if( out_format != SFNT_FORMAT_TEXT ) {
+    sfnt_record_cmd_line(&results);
+    sfnt_record_sys_info(&results, &tsc);
+    sfnt_record_str(&results, "server.ld_preload", server_ld_preload);
+    results_keep = results.n_fields;
+  }
+  if( cfg_stall_threshold )
+    NT_TRY(sfnt_stall_init(&stall, &tsc, cfg_stall_threshold,
+                           stall_log_open(cfg_stall_log), "size"));
+  sfnt_tsc(&sweep_start);
+  if( cfg_interleave > 1 )
+    do_tests_interleaved(ss, read_fd, write_fd, &msg_sizes, raw);
+  else if( gap_sweep.len ) {
+#if NT_HAVE_TIMERSLACK
+    /* Else each sleep overshoots by the default 50us timer slack. */
+    prctl(PR_SET_TIMERSLACK, 1);
+#endif
+    for( i = 0; i < msg_sizes.len; ++i )
+      for( j = 0; j < gap_sweep.len; ++j ) {
+        cur_gap = gap_sweep.list[j];
+        do_test(ss, read_fd, write_fd, msg_sizes.list[i], raw);
+      }
+  }
+  else
+    for( i = 0; i < msg_sizes.len; ++i )
+      do_test(ss, read_fd, write_fd, msg_sizes.list[i], raw);
 
   /* Tell server side to exit. */
   sfnt_sock_put_int(ss, 0);
 
-  free(results);
+  free(raw);
+  sfnt_hist_free(&lat_hist);
+  if( cfg_interval )
+    sfnt_timeline_free(&timeline);
+  if( cfg_timestamping ) {
+    if( ts_no_sched || ts_no_snd )
+      printf("# timestamping: no%s%s TX timestamps on this path\n",
+             ts_no_sched ? " SCHED" : "", ts_no_snd ? " SND" : "");
+    if( ts_missing )
+      printf("# timestamping: %"PRIu64" samples lacked timestamps\n",
+             ts_missing);
+    for( i = 0; i < TS_N_SEGS; ++i )
+      sfnt_hist_free(&seg_hists[i]);
+  }
+  if( ol_lost || ol_stale )
+    printf("# open-loop: %"PRIu64" pings lost, %"PRIu64" late replies "
+           "discarded\n", ol_lost, ol_stale);
+  if( cfg_turnaround ) {
+    for( i = 0; i < TA_N; ++i )
+      sfnt_hist_free(&ta_hists[i]);
+    free(ta_buf);
+    free(ta_rtt);
+  }
+  if( cfg_trace != NULL ) {
+    for( i = 0; i < TR_N; ++i )
+      sfnt_hist_free(&trace_hists[i]);
+    free(trace_ring);
+  }
+  if( cfg_perf_counters != NULL ) {
+    sfnt_perf_close(&perf);
+    free(perf_sums);
+  }
+  if( energy.n ) {
+    sfnt_energy_close(&energy);
+    free(energy_sums);
+  }
+  if( cfg_stall_threshold ) {
+    printf("# stalls=%"PRIu64"\n", stall.n_stalls);
+    if( stall.log != stderr )
+      fclose(stall.log);
+    sfnt_stall_free(&stall);
+  }
+  if( out_format != SFNT_FORMAT_TEXT ) {
+    fclose(results.f);
+    sfnt_record_free(&results);
+  }
 
   return 0;
 }
@@ -1508,6 +3317,83 @@ int main(int argc, char* argv[])
   if( cfg_minms > cfg_maxms )
     cfg_maxms = cfg_minms;
   NT_ASSERT(cfg_maxiter >= cfg_miniter);
+  if( cfg_converge != NULL ) {
+    char pct_sign;
+    int n = sscanf(cfg_converge, "%lf:%lf%c", &conv_pct, &conv_relerr,
+                   &pct_sign);
+    if( n == 3 && pct_sign == '%' )
+      conv_relerr /= 100;
+    else if( n != 2 )
+      sfnt_fail_usage("ERROR: Malformed argument to option --converge");
+    if( conv_pct <= 0 || conv_pct >= 100 || conv_relerr <= 0 )
+      sfnt_fail_usage("ERROR: Bad argument to option --converge");
+  }
+  if( cfg_interleave < 0 )
+    sfnt_fail_usage("ERROR: Bad argument to option --interleave");
+  if( cfg_timer != NULL && (rc = sfnt_timer_select(cfg_timer)) < 0 )
+    sfnt_fail_usage("ERROR: %s timer '%s'",
+                    rc == -ENOSYS ? "Unsupported" : "Unknown", cfg_timer);
+  cfg_seed = sfnt_rand_seed(cfg_seed);
+  if( (cfg_timeline != NULL || cfg_heatmap != NULL) && ! cfg_interval )
+    sfnt_fail_usage("ERROR: --timeline and --heatmap require --interval");
+  if( cfg_interval && cfg_timeline == NULL && cfg_heatmap == NULL )
+    sfnt_fail_usage("ERROR: --interval requires --timeline or --heatmap");
+  if( cfg_stall_log != NULL && ! cfg_stall_threshold )
+    sfnt_fail_usage("ERROR: --stall-log requires --stall-threshold");
+  if( (cfg_noise_budget > 0 || cfg_noise_fail) && ! cfg_noise_ms )
+    sfnt_fail_usage("ERROR: --noise-budget and --noise-fail require "
+                    "--noise-ms");
+  if( cfg_noise_fail && cfg_noise_budget <= 0 )
+    sfnt_fail_usage("ERROR: --noise-fail requires --noise-budget");
+  if( cfg_timestamping && (cfg_rate || cfg_n_pings[0] != 1 ||
+                           cfg_n_pings[1] != 1 || cfg_n_pongs != 1) )
+    sfnt_fail_usage("ERROR: --timestamping requires closed-loop mode with "
+                    "--n-pings=1 and --n-pongs=1");
+  if( cfg_turnaround && cfg_rate )
+    sfnt_fail_usage("ERROR: --turnaround requires closed-loop mode");
+  if( cfg_trace != NULL && cfg_rate )
+    sfnt_fail_usage("ERROR: --trace requires closed-loop mode");
+  if( cfg_sched_stats && cfg_rate )
+    sfnt_fail_usage("ERROR: --sched-stats requires closed-loop mode");
+  if( cfg_trace_len == 0 )
+    sfnt_fail_usage("ERROR: --trace-len must be at least 1");
+  if( cfg_poisson && ! cfg_rate )
+    sfnt_fail_usage("ERROR: --poisson requires --rate");
+  if( cfg_rate && (cfg_n_pings[0] != 1 || cfg_n_pings[1] != 1 ||
+                   cfg_n_pongs != 1) )
+    sfnt_fail_usage("ERROR: --rate requires --n-pings=1 and --n-pongs=1");
+  if( cfg_rate && (cfg_sleep_gap || cfg_spin_gap) )
+    sfnt_fail_usage("ERROR: --rate cannot be combined with --sleep-gap or "
+                    "--spin-gap");
+  if( cfg_gap_sweep != NULL ) {
+    if( sfnt_ilist_parse(&gap_sweep, cfg_gap_sweep) != 0 ||
+        gap_sweep.len == 0 )
+      sfnt_fail_usage("ERROR: Malformed argument to option --gap-sweep");
+    if( cfg_rate || cfg_sleep_gap || cfg_spin_gap || cfg_interleave > 1 )
+      sfnt_fail_usage("ERROR: --gap-sweep cannot be combined with --rate, "
+                      "--sleep-gap, --spin-gap or --interleave");
+  }
+  if( cfg_gap_jitter > 100 )
+    sfnt_fail_usage("ERROR: --gap-jitter must be at most 100");
+  if( cfg_raw_format != NULL ) {
+    if( ! strcmp(cfg_raw_format, "bin") )
+      raw_bin = 1;
+    else if( strcmp(cfg_raw_format, "text") )
+      sfnt_fail_usage("ERROR: Unknown raw format '%s'", cfg_raw_format);
+    if( cfg_raw == NULL )
+      sfnt_fail_usage("ERROR: --raw-format requires --raw");
+    if( raw_bin && cfg_interleave > 1 )
+      sfnt_fail_usage("ERROR: --raw-format=bin cannot be combined with "
+                      "--interleave");
+  }
+  if( cfg_format != NULL && sfnt_format_parse(cfg_format, &out_format) < 0 )
+    sfnt_fail_usage("ERROR: Unknown format '%s'", cfg_format);
+  if( cfg_percentiles != NULL ) {
+    pcts_n = sfnt_hist_parse_percentiles(cfg_percentiles, pcts,
+                                         MAX_PERCENTILES);
+    if( pcts_n < 0 )
+      sfnt_fail_usage("ERROR: Malformed argument to option --percentiles");
+  }
   timeout_ms = cfg_timeout[0] ? cfg_timeout[0] * 1000 : -1;
 
 #if defined(__unix__) ||  defined(__APPLE__)
@@ -31,6 +31,9 @@ static int         cfg_spin[2];
 static const char* cfg_muxer[2];
 static int         cfg_rtt;
 static const char* cfg_raw;
+static const char* cfg_raw_format;
+static const char* cfg_histfile;
+static const char* cfg_format;
 static float       cfg_percentile = 99;
 static const char* cfg_mcast;
 static const char* cfg_mcast_intf[2];
@@ -52,6 +55,23 @@ static int         cfg_debug;
 static unsigned    cfg_v6only[2];
 static int         cfg_ipv4;
 static int         cfg_ipv6;
+static const char* cfg_percentiles;
+static int         cfg_interleave;
+static uint64_t    cfg_seed;
+static unsigned    cfg_interval;
+static const char* cfg_timeline;
+static const char* cfg_heatmap;
+static unsigned    cfg_stall_threshold;
+static const char* cfg_stall_log;
+static unsigned    cfg_noise_ms;
+static unsigned    cfg_noise_threshold = 1000;
+static float       cfg_noise_budget;
+static int         cfg_noise_fail;
+static const char* cfg_perf_counters;
+static int         cfg_cpu_cost;
+static int         cfg_energy;
+static int         cfg_sched_stats;
+static const char* cfg_timer;
 
 #define CL1(a, b, c, d)  SFNT_CLA(a, b, &(c), d)
 #define CL2(a, b, c, d)  SFNT_CLA2(a, b, &(c), d)
@@ -80,6 +100,9 @@ static struct sfnt_cmd_line_opt cfg_opts[] = {
   CL2S("muxer",       cfg_muxer,       "select, poll, epoll or none"         ),
   CL1F("rtt",         cfg_rtt,         "report round-trip-time"              ),
   CL1S("raw",         cfg_raw,         "dump raw results to files"           ),
+  CL1S("raw-format",  cfg_raw_format,  "text or bin (compact, written live)" ),
+  CL1S("histfile",    cfg_histfile,    "save latency histograms to files"    ),
+  CL1S("format",      cfg_format,      "results as text, json, csv or tsv"   ),
   CL1D("percentile",  cfg_percentile,  "percentile"                          ),
   CL1S("mcast",       cfg_mcast,       "set multicast address"               ),
   CL2S("mcastintf",   cfg_mcast_intf,  "set multicast interface"             ),
@@ -101,6 +124,26 @@ static struct sfnt_cmd_line_opt cfg_opts[] = {
   CL2F("v6only",      cfg_v6only,      "enable IPV6_V6ONLY sockopt"          ),
   CL1F("ipv4",        cfg_ipv4,        "use IPv4 only"                       ),
   CL1F("ipv6",        cfg_ipv6,        "use IPv6 only"                       ),
+  CL1S("percentiles", cfg_percentiles, "extra percentiles to report"         ),
+  CL1I("interleave",  cfg_interleave,  "n chunks per rate, in random order"  ),
+  CL1("seed",         UINT64, cfg_seed, "random seed (0 to pick one)"        ),
+  CL1U("interval",    cfg_interval,    "timeline interval (ms)"              ),
+  CL1S("timeline",    cfg_timeline,    "save per-interval stats to files"    ),
+  CL1S("heatmap",     cfg_heatmap,     "save latency heatmaps to files"      ),
+  CL1U("stall-threshold", cfg_stall_threshold,
+                                       "log causes of samples over (ns)"     ),
+  CL1S("stall-log",   cfg_stall_log,   "stall log file (default stderr)"     ),
+  CL1U("noise-ms",    cfg_noise_ms,    "measure OS noise on cores first (ms)"),
+  CL1U("noise-threshold", cfg_noise_threshold,
+                                       "min gap counted as noise (ns)"       ),
+  CL1D("noise-budget", cfg_noise_budget, "max % of time lost to noise"       ),
+  CL1F("noise-fail",  cfg_noise_fail,  "fail rather than warn if over budget"),
+  CL1S("perf-counters", cfg_perf_counters,
+                                       "counters, eg. cycles,instructions"   ),
+  CL1F("cpu-cost",    cfg_cpu_cost,    "report CPU time per message"         ),
+  CL1F("energy",      cfg_energy,      "report RAPL energy per message"      ),
+  CL1F("sched-stats", cfg_sched_stats, "report run delay and migrations"     ),
+  CL1S("timer",       cfg_timer,       "tsc,tsc-lfence,rdtscp,monotonic,..." ),
 };
 #define N_CFG_OPTS (sizeof(cfg_opts) / sizeof(cfg_opts[0]))
 
@@ -155,6 +198,14 @@ struct msg_reply {
 };
 
 
+/* CPU time used by one thread over a test (nanoseconds). */
+struct cpu_cost {
+  int64_t               user;
+  int64_t               sys;
+  int64_t               wall;
+};
+
+
 enum client_rx_cmd {
   CRXC_NEW,
   CRXC_WAIT,
@@ -178,13 +229,28 @@ struct client_rx {
   enum client_rx_cmd    state;
   struct msg_reply*     reply;
   int                   reply_buf_len;
+  int                   reply_len;
   int                   sock;
   int                   port;
   volatile int          n_rx;
-  struct client_rx_rec* recs;
+  struct client_rx_rec* recs;      /* only kept if dumping raw results */
   int                   recs_max;
   int                   recs_n;
+  struct sfnt_rawlog*   rawlog;    /* only if --raw-format=bin */
+  struct sfnt_hist      lat_hist;  /* rx time - send time */
+  struct sfnt_hist      jit_hist;  /* send lateness */
+  struct sfnt_timeline  timeline;  /* only if --interval */
+  uint64_t              sweep_start;
+  struct sfnt_stall     stall;     /* only if --stall-threshold */
+  FILE*                 stall_log;
+  int                   stall_key; /* rate, or 0 if not checking */
+  int                   lat_offset;
   uint32_t              sync_seq;
+  struct sfnt_cpu_usage cpu_start;
+  uint64_t              cpu_ts_start;
+  struct cpu_cost       cpu;       /* from last warmup to stop */
+  struct sfnt_sched_stats sched_start;
+  struct sfnt_sched_stats sched;   /* from last warmup to stop */
   int                   af; /* Input to thread */
 };
 
@@ -201,6 +267,7 @@ struct client_tx {
   int                   msg_per_sec_target;
   int                   msg_per_sec_tx;
   int                   msg_per_sec_rx;
+  int                   millisec;
   int                   reply_every;
   uint64_t              ts_start;
   uint32_t              start_seq;
@@ -208,6 +275,29 @@ struct client_tx {
   struct stats          ret_lat_stats;
   int                   n_fall_behinds;
   char*                 server_ld_preload;
+  struct sfnt_noise     client_noise;
+  struct sfnt_noise     server_noise;
+  int64_t               perf[SFNT_PERF_MAX * 2];  /* client then server */
+  struct cpu_cost       cpu[3];                   /* tx, rx, server */
+  int64_t               energy[SFNT_ENERGY_MAX + 1];  /* uJ per domain, ns */
+  struct sfnt_sched_stats sched[2];                 /* rx, server */
+};
+
+
+/* Results for one rate, accumulated over one or more runs. */
+struct rate_result {
+  int                   msg_per_sec_target;
+  int                   millisec;
+  uint64_t              n_tx_msgs;
+  uint64_t              n_rx_msgs;
+  int                   n_fall_behinds;
+  struct gap_stats      gap_stats;
+  struct sfnt_hist      lat_hist;
+  struct sfnt_hist      jit_hist;
+  int64_t               perf[SFNT_PERF_MAX * 2];
+  struct cpu_cost       cpu[3];
+  int64_t               energy[SFNT_ENERGY_MAX + 1];
+  struct sfnt_sched_stats sched[2];
 };
 
 
@@ -250,11 +340,24 @@ enum fd_type {
 
 
 #define MAX_FDS            1024
+#define MAX_PERCENTILES    16
 
 static struct sfnt_tsc_params tsc;
+static struct sfnt_perf perf;
+static const char* cpu_cost_names[] = { "tx", "rx", "srv" };
+static struct sfnt_energy energy;
 static char           ppbuf[64 * 1024];
 
 static int            client_rx_core_i;
+static int            raw_bin;        /* --raw-format=bin */
+static struct sfnt_rawlog rawlog;
+static enum sfnt_format out_format;   /* --format */
+static struct sfnt_record results;
+static int            results_keep;   /* fields common to every row */
+static int            results_col;    /* columns printed in this row */
+
+static double         pcts[MAX_PERCENTILES];
+static int            pcts_n;
 
 static enum fd_type   fd_type;
 static int            the_fds[4];  /* used for pipes and unix sockets */
@@ -746,6 +849,11 @@ static void client_send_opts(int ss)
   sfnt_sock_put_int(ss, cfg_nodelay);
   sfnt_sock_put_int(ss, cfg_busy_poll[1]);
   sfnt_sock_put_int(ss, cfg_v6only[1]);
+  sfnt_sock_put_int(ss, cfg_noise_ms);
+  sfnt_sock_put_int(ss, cfg_noise_threshold);
+  sfnt_sock_put_str(ss, cfg_perf_counters);
+  sfnt_sock_put_int(ss, cfg_cpu_cost);
+  sfnt_sock_put_int(ss, cfg_sched_stats);
 }
 
 
@@ -769,6 +877,11 @@ static void server_recv_opts(int ss)
   cfg_nodelay = sfnt_sock_get_int(ss);
   cfg_busy_poll[0] = sfnt_sock_get_int(ss);
   cfg_v6only[0] = sfnt_sock_get_int(ss);
+  cfg_noise_ms = sfnt_sock_get_int(ss);
+  cfg_noise_threshold = sfnt_sock_get_int(ss);
+  cfg_perf_counters = sfnt_sock_get_str(ss);
+  cfg_cpu_cost = sfnt_sock_get_int(ss);
+  cfg_sched_stats = sfnt_sock_get_int(ss);
 }
 
 
@@ -881,6 +994,25 @@ static int do_server2(int ss)
   /* Init after we've received config opts from client. */
   do_init();
 
+  /* Measure noise on our core while the client waits, so that the two
+   * measurements do not disturb one another.
+   */
+  if( cfg_noise_ms ) {
+    struct sfnt_noise noise;
+    sfnt_noise_measure(&noise, &tsc, cfg_noise_ms, cfg_noise_threshold);
+    sfnt_noise_put(ss, &noise);
+  }
+  /* Counters run throughout, and are sampled at the start and end of each
+   * test.  If they cannot be opened here then none are sent back, and the
+   * client shows them as unavailable.
+   */
+  if( cfg_perf_counters != NULL ) {
+    if( (rc = sfnt_perf_open(&perf, cfg_perf_counters)) < 0 )
+      sfnt_err("WARNING: --perf-counters not available on server (%s)\n",
+               strerror(-rc));
+    sfnt_perf_enable(&perf);
+  }
+
   /* Establish which AF is to be used ahead of creating socket. */
   if( cfg_mcast ) {
     sal = sfnt_getendpoint(af, cfg_mcast, 0, (struct sockaddr *) &sa, sal);
@@ -975,9 +1107,17 @@ static int do_server3(struct server* server)
   struct msg* msg = (struct msg*) ppbuf;
   struct msg_reply* reply = (struct msg_reply*) ppbuf;
   struct server_per_client* client;
+  struct sfnt_perf_sample perf_start, perf_now;
+  struct sfnt_cpu_usage cpu_start, cpu_now;
+  struct sfnt_sched_stats sched_start, sched_now, sched_delta;
+  uint64_t cpu_ts_start = 0, now;
+  int64_t* trailer = (int64_t*) (reply + 1);
   int flags = 0;
-  int rc;
+  int rc, i, n, reply_len;
 
+  memset(&perf_start, 0, sizeof(perf_start));
+  memset(&cpu_start, 0, sizeof(cpu_start));
+  memset(&sched_start, 0, sizeof(sched_start));
   if( fd_type & FDTF_STREAM )
     flags |= MSG_WAITALL;
 
@@ -1005,15 +1145,55 @@ static int do_server3(struct server* server)
       else {
         client->seq_expected = seq + 1;
         memset(&client->gap_stats, 0, sizeof(client->gap_stats));
+        if( cfg_perf_counters != NULL )
+          sfnt_perf_sample(&perf, &perf_start);
+        if( cfg_cpu_cost ) {
+          sfnt_cpu_usage_thread(&cpu_start);
+          sfnt_tsc(&cpu_ts_start);
+        }
+        if( cfg_sched_stats )
+          sfnt_sched_stats_thread(&sched_start);
       }
       if( msg->reply_seq != client->reply_seq ) {
         client->reply_seq = msg->reply_seq;
         if( msg->flags & MF_TIMESTAMP )
           sfnt_tsc(&reply->s_timestamp);
         reply->gap_stats = client->gap_stats;
-        rc = sendto(server->write_fd, reply, sizeof(*reply), 0,
+        /* Costs since the last reset go back with the final reply: CPU
+         * time (user, sys, wall) if --cpu-cost, scheduler stats if
+         * --sched-stats, then the number of perf counters and their counts.
+         */
+        n = 0;
+        if( msg->flags & MF_STOP ) {
+          if( cfg_cpu_cost ) {
+            sfnt_cpu_usage_thread(&cpu_now);
+            sfnt_tsc(&now);
+            trailer[n++] = cpu_now.user - cpu_start.user;
+            trailer[n++] = cpu_now.sys - cpu_start.sys;
+            trailer[n++] = sfnt_tsc_nsec(&tsc, now - cpu_ts_start);
+          }
+          if( cfg_sched_stats ) {
+            sfnt_sched_stats_thread(&sched_now);
+            sfnt_sched_stats_delta(&sched_start, &sched_now, &sched_delta);
+            trailer[n++] = sched_delta.run_delay;
+            trailer[n++] = sched_delta.n_runs;
+            trailer[n++] = sched_delta.n_switches;
+            trailer[n++] = sched_delta.n_migrations;
+          }
+          if( cfg_perf_counters != NULL ) {
+            sfnt_perf_sample(&perf, &perf_now);
+            trailer[n++] = perf.n;
+            sfnt_perf_delta(&perf, &perf_start, &perf_now, trailer + n);
+            n += perf.n;
+          }
+          for( i = 0; i < n; ++i )
+            trailer[i] = (int64_t) NT_LE64((uint64_t) trailer[i]);
+        }
+        reply_len = sizeof(*reply) + n * sizeof(trailer[0]);
+        SFNT_PROBE2(stream_reply, NT_LE32(reply->seq), reply->flags);
+        rc = sendto(server->write_fd, reply, reply_len, 0,
                     client->addrinfo->ai_addr, client->addrinfo->ai_addrlen);
-        NT_TESTi3(rc, ==, sizeof(*reply));
+        NT_TESTi3(rc, ==, reply_len);
       }
     }
     else if( rc == -1 && errno == EAGAIN ) {
@@ -1084,38 +1264,109 @@ static int client_rx_wait_sync(struct client_rx* crx, uint32_t seq,
 }
 
 
+/* Times are relative to the start of the sweep. */
+static void rawlog_put(struct client_rx* crx, int64_t lat)
+{
+  const struct msg_reply* m = crx->reply;
+  int64_t vals[3];
+  vals[0] = sfnt_tsc_nsec(&tsc, m->c_timestamp - m->send_lateness -
+                          crx->sweep_start);
+  vals[1] = sfnt_tsc_nsec(&tsc, m->c_timestamp - crx->sweep_start);
+  vals[2] = lat + crx->lat_offset;
+  sfnt_rawlog_put(crx->rawlog, vals);
+}
+
+
 static void client_rx_go(struct client_rx* crx)
 {
   struct client_rx_rec* rec;
   uint64_t now;
+  int64_t lat;
   int flags = 0;
   int rc;
 
   if( fd_type & FDTF_STREAM )
     flags |= MSG_WAITALL;
 
-  memset(crx->recs, 0, crx->recs_max * sizeof(crx->recs[0]));
+  if( crx->recs_max )
+    memset(crx->recs, 0, crx->recs_max * sizeof(crx->recs[0]));
   crx->recs_n = 0;
+  sfnt_hist_reset(&crx->lat_hist);
+  sfnt_hist_reset(&crx->jit_hist);
+  if( cfg_interval )
+    sfnt_timeline_reset(&crx->timeline);
+  if( crx->stall_key )
+    sfnt_stall_rebase(&crx->stall);
+  if( cfg_cpu_cost ) {
+    sfnt_cpu_usage_thread(&crx->cpu_start);
+    sfnt_tsc(&crx->cpu_ts_start);
+  }
+  if( cfg_sched_stats )
+    sfnt_sched_stats_thread(&crx->sched_start);
 
   while( 1 ) {
     rc = mux_recv(crx->sock, crx->reply, crx->reply_buf_len, flags);
     sfnt_tsc(&now);
     if( rc >= sizeof(struct msg_reply) ) {
+      crx->reply_len = rc;
       if( crx->reply->flags & MF_SAVE ) {
-        NT_TESTi3(crx->recs_n, <, crx->recs_max);
-        rec = &crx->recs[crx->recs_n];
-        rec->ts_send = crx->reply->c_timestamp;
-        rec->ts_recv = now;
-        rec->seq = crx->reply->seq;
-        rec->send_lateness = crx->reply->send_lateness;
-        ++crx->recs_n;
+        lat = sfnt_tsc_nsec(&tsc, now - crx->reply->c_timestamp -
+                            tsc.tsc_cost);
+        SFNT_PROBE2(rx_save, NT_LE32(crx->reply->seq), lat);
+        sfnt_hist_record(&crx->lat_hist, lat);
+        if( cfg_interval )
+          sfnt_timeline_record(&crx->timeline,
+                               sfnt_tsc_nsec(&tsc, now - crx->sweep_start),
+                               lat);
+        if( crx->stall_key )
+          sfnt_stall_check(&crx->stall, lat + crx->lat_offset,
+                           sfnt_tsc_nsec(&tsc, now - crx->sweep_start) * 1e-6,
+                           crx->stall_key);
+        sfnt_hist_record(&crx->jit_hist,
+                         sfnt_tsc_nsec(&tsc, crx->reply->send_lateness));
+        if( crx->rawlog != NULL )
+          rawlog_put(crx, lat);
+        if( crx->recs_max ) {
+          NT_TESTi3(crx->recs_n, <, crx->recs_max);
+          rec = &crx->recs[crx->recs_n];
+          rec->ts_send = crx->reply->c_timestamp;
+          rec->ts_recv = now;
+          rec->seq = crx->reply->seq;
+          rec->send_lateness = crx->reply->send_lateness;
+          ++crx->recs_n;
+        }
       }
       if( crx->reply->flags & MF_SYNC ) {
         PT_CHK(pthread_mutex_lock(&crx->lock));
         crx->sync_seq = NT_LE32(crx->reply->seq);
         PT_CHK(pthread_mutex_unlock(&crx->lock));
+        SFNT_PROBE2(sync_recv, crx->sync_seq, crx->reply->flags);
         PT_CHK(pthread_cond_signal(&crx->cond));
       }
+      /* Measure over the same span as the server: from the last warmup
+       * to the end.
+       */
+      if( cfg_cpu_cost && (crx->reply->flags & (MF_RESET | MF_STOP)) ) {
+        struct sfnt_cpu_usage cpu;
+        sfnt_cpu_usage_thread(&cpu);
+        if( crx->reply->flags & MF_RESET ) {
+          crx->cpu_start = cpu;
+          crx->cpu_ts_start = now;
+        }
+        else {
+          crx->cpu.user = cpu.user - crx->cpu_start.user;
+          crx->cpu.sys = cpu.sys - crx->cpu_start.sys;
+          crx->cpu.wall = sfnt_tsc_nsec(&tsc, now - crx->cpu_ts_start);
+        }
+      }
+      if( cfg_sched_stats && (crx->reply->flags & (MF_RESET | MF_STOP)) ) {
+        struct sfnt_sched_stats sched;
+        sfnt_sched_stats_thread(&sched);
+        if( crx->reply->flags & MF_RESET )
+          crx->sched_start = sched;
+        else
+          sfnt_sched_stats_delta(&crx->sched_start, &sched, &crx->sched);
+      }
       if( crx->reply->flags & MF_STOP )
         break;
     }
@@ -1153,8 +1404,11 @@ static void* client_rx_thread(void* arg)
       socklen = sizeof(*sin);
     }
     NT_TRY(bind(crx->sock, (const struct sockaddr*) &ss, socklen));
-    crx->recs = malloc(crx->recs_max * sizeof(crx->recs[0]));
-    memset(crx->recs, 0, crx->recs_max * sizeof(crx->recs[0]));
+    if( crx->recs_max ) {
+      crx->recs = malloc(crx->recs_max * sizeof(crx->recs[0]));
+      NT_TEST(crx->recs != NULL);
+      memset(crx->recs, 0, crx->recs_max * sizeof(crx->recs[0]));
+    }
     crx->recs_n = 0;
     crx->port = sfnt_get_port(crx->sock);
     add_fds(crx->sock);
@@ -1164,6 +1418,11 @@ static void* client_rx_thread(void* arg)
     break;
   }
 
+  /* Context switches are counted per thread, so this must be done here. */
+  if( cfg_stall_threshold )
+    NT_TRY(sfnt_stall_init(&crx->stall, &tsc, cfg_stall_threshold,
+                           crx->stall_log, "rate"));
+
   PT_CHK(pthread_mutex_lock(&crx->lock));
   while( crx->state != CRXC_EXIT ) {
     if( crx->state != crx->cmd ) {
@@ -1193,6 +1452,43 @@ static void* client_rx_thread(void* arg)
 }
 
 
+/* Print results of the noise preflight, and warn or fail if the core lost
+ * more time than --noise-budget allows.
+ */
+static void noise_report(const char* who, const char* core,
+                         const struct sfnt_noise* n)
+{
+  char* label = alloca(strlen(who) + (core ? strlen(core) : 3) + 10);
+  double pct = sfnt_noise_stolen_pct(n);
+
+  sprintf(label, "%s core=%s", who, core ? core : "any");
+  sfnt_noise_print(stdout, label, n);
+  if( cfg_noise_budget <= 0 || pct <= cfg_noise_budget )
+    return;
+  if( cfg_noise_fail ) {
+    fflush(stdout);
+    sfnt_err("ERROR: %s lost %.4f%% of time to OS noise (budget %g%%)\n",
+             label, pct, (double) cfg_noise_budget);
+    sfnt_fail_setup();
+  }
+  printf("# WARNING: %s lost %.4f%% of time to OS noise (budget %g%%)\n",
+         label, pct, (double) cfg_noise_budget);
+}
+
+
+static FILE* stall_log_open(const char* fname)
+{
+  FILE* f;
+  if( fname == NULL )
+    return stderr;
+  if( (f = fopen(fname, "w")) == NULL ) {
+    sfnt_err("ERROR: Could not open output file '%s'\n", fname);
+    sfnt_fail_setup();
+  }
+  return f;
+}
+
+
 static struct client_rx* client_rx_thread_start(int af)
 {
   struct client_rx* crx;
@@ -1201,9 +1497,27 @@ static struct client_rx* client_rx_thread_start(int af)
   crx = malloc(sizeof(*crx));
   PT_CHK(pthread_mutex_init(&crx->lock, NULL));
   PT_CHK(pthread_cond_init(&crx->cond, NULL));
-  crx->recs_max = cfg_samples * 3;
-  if( crx->recs_max < cfg_rtt_iter )
-    crx->recs_max = cfg_rtt_iter;
+  /* Latency and jitter go into histograms; individual records are only
+   * needed for --raw.
+   */
+  NT_TEST(sfnt_hist_init(&crx->lat_hist, SFNT_HIST_SUB_BITS) == 0);
+  NT_TEST(sfnt_hist_init(&crx->jit_hist, SFNT_HIST_SUB_BITS) == 0);
+  if( cfg_interval )
+    NT_TEST(sfnt_timeline_init(&crx->timeline,
+                               cfg_interval * (int64_t) 1000000,
+                               cfg_heatmap != NULL) == 0);
+  sfnt_tsc(&crx->sweep_start);
+  crx->stall_log = cfg_stall_threshold ? stall_log_open(cfg_stall_log) : NULL;
+  crx->stall_key = 0;
+  crx->lat_offset = 0;
+  crx->recs = NULL;
+  crx->recs_max = 0;
+  crx->rawlog = NULL;
+  if( cfg_raw != NULL && ! raw_bin ) {
+    crx->recs_max = cfg_samples * 3;
+    if( crx->recs_max < cfg_rtt_iter )
+      crx->recs_max = cfg_rtt_iter;
+  }
   crx->state = CRXC_NEW;
   crx->cmd = CRXC_WAIT;
   crx->af = af;
@@ -1224,6 +1538,7 @@ static void client_send_sync(struct client_tx* ctx, enum msg_flags flags)
   ++msg->reply_seq;
   seq = ctx->next_seq++;
   msg->seq = NT_LE32(seq);
+  SFNT_PROBE2(sync_send, seq, msg->flags);
   rc = send(ctx->write_fd, msg, ctx->msg_len, 0);
   NT_TESTi3(rc, ==, ctx->msg_len);
 }
@@ -1286,64 +1601,145 @@ static void client_stop(struct client_tx* ctx)
 }
 
 
-int64_t rec_latency_ns(struct client_tx* ctx, struct client_rx_rec* r)
+uint64_t rec_target_send_ts(struct client_tx* ctx, struct client_rx_rec* r)
+{
+  return r->ts_send - r->send_lateness;
+}
+
+
+static void write_raw_results(struct client_tx* ctx, int append)
 {
-  int64_t latency = sfnt_tsc_nsec(&tsc, r->ts_recv - r->ts_send);
-  if( ! cfg_rtt )
-    latency -= ctx->ret_lat_stats.mean;
-  return latency;
+  char* fname = (char*) alloca(strlen(cfg_raw) + 60);
+  int n = ctx->crx->recs_n;
+  int64_t lat_offset = cfg_rtt ? 0 : ctx->ret_lat_stats.mean;
+  int64_t* ns;
+  FILE* f;
+  int i;
+
+  sprintf(fname, "%s-%d-%d.dat",
+          cfg_raw, ctx->msg_len, ctx->msg_per_sec_target);
+  if( (f = fopen(fname, append ? "a" : "w")) == NULL ) {
+    sfnt_err("ERROR: Could not open output file '%s'\n", fname);
+    sfnt_fail_test();
+  }
+  if( ! append )
+    fprintf(f, "#send-target(ns)\tsend-actual(ns)\tlatency(ns)\n");
+  /* Gather the target send times, send times and latencies in ticks, and
+   * convert them to nanoseconds in one go.
+   */
+  NT_TEST((ns = malloc(3 * (size_t) n * sizeof(ns[0]) + 1)) != NULL);
+  for( i = 0; i < n; ++i ) {
+    struct client_rx_rec* r = &ctx->crx->recs[i];
+    ns[i] = rec_target_send_ts(ctx, r) - ctx->ts_start;
+    ns[n + i] = r->ts_send - ctx->ts_start;
+    ns[2 * n + i] = r->ts_recv - r->ts_send - tsc.tsc_cost;
+  }
+  sfnt_tsc_nsec_batch(&tsc, ns, ns, 3 * n);
+  for( i = 0; i < n; ++i )
+    fprintf(f, "%.9f\t%.9f\t%.9f\n", 1e-9 * ns[i], 1e-9 * ns[n + i],
+            1e-9 * (ns[2 * n + i] - lat_offset));
+  free(ns);
+  fclose(f);
 }
 
 
-uint64_t rec_target_send_ts(struct client_tx* ctx, struct client_rx_rec* r)
+/* With --raw-format=bin, the receive thread queues samples as they arrive
+ * and they are written out by a background thread.
+ */
+static void rawlog_begin(struct client_tx* ctx)
 {
-  return r->ts_send - r->send_lateness;
+  char* fname = (char*) alloca(strlen(cfg_raw) + 60);
+  char hdr[128];
+  int rc;
+  sprintf(fname, "%s-%d-%d.sfr",
+          cfg_raw, cfg_msg_size, ctx->msg_per_sec_target);
+  snprintf(hdr, sizeof(hdr), "tool=sfnt-stream\nsize=%d\nrate=%d\nrtt=%d\n",
+           cfg_msg_size, ctx->msg_per_sec_target, cfg_rtt);
+  if( (rc = sfnt_rawlog_open(&rawlog, fname, &tsc,
+                             "send_target_ns,send_ns,latency_ns", hdr)) < 0 ) {
+    sfnt_err("ERROR: Could not open output file '%s' (%s)\n",
+             fname, strerror(-rc));
+    sfnt_fail_test();
+  }
+  ctx->crx->rawlog = &rawlog;
 }
 
 
-static double ts_to_dbl(struct client_tx* ctx, uint64_t ts)
+static void rawlog_end(struct client_tx* ctx)
 {
-  return 1e-9 * sfnt_tsc_nsec(&tsc, ts - ctx->ts_start);
+  int rc;
+  ctx->crx->rawlog = NULL;
+  if( (rc = sfnt_rawlog_close(&rawlog)) < 0 ) {
+    sfnt_err("ERROR: Failed to write raw results (%s)\n", strerror(-rc));
+    sfnt_fail_test();
+  }
+  if( rawlog.n_stalls )
+    printf("# WARNING: raw results writer fell behind %"PRIu64" times\n",
+           rawlog.n_stalls);
 }
 
 
-static void write_raw_results(struct client_tx* ctx)
+static void write_hist_file(struct client_tx* ctx, struct rate_result* r)
 {
-  char* fname = (char*) alloca(strlen(cfg_raw) + 60);
+  char* fname = (char*) alloca(strlen(cfg_histfile) + 60);
+  int lat_offset = cfg_rtt ? 0 : -ctx->ret_lat_stats.mean;
   FILE* f;
-  int i;
 
-  sprintf(fname, "%s-%d-%d.dat",
-          cfg_raw, ctx->msg_len, ctx->msg_per_sec_target);
+  sprintf(fname, "%s-%d-%d.hist",
+          cfg_histfile, cfg_msg_size, r->msg_per_sec_target);
   if( (f = fopen(fname, "w")) == NULL ) {
     sfnt_err("ERROR: Could not open output file '%s'\n", fname);
     sfnt_fail_test();
   }
-  fprintf(f, "#send-target(ns)\tsend-actual(ns)\tlatency(ns)\n");
-  for( i = 0; i < ctx->crx->recs_n; ++i ) {
-    struct client_rx_rec* r = &ctx->crx->recs[i];
-    fprintf(f, "%.9f\t%.9f\t%.9f\n",
-            ts_to_dbl(ctx, rec_target_send_ts(ctx, r)),
-            ts_to_dbl(ctx, r->ts_send),
-            1e-9 * rec_latency_ns(ctx, r));
+  NT_TRY(sfnt_hist_write(f, &r->lat_hist, lat_offset));
+  fclose(f);
+}
+
+
+static void write_timeline_file(struct client_tx* ctx, const char* prefix,
+                                const char* suffix, int append,
+                                int (*write_fn)(const struct sfnt_timeline*,
+                                                FILE*, int64_t, int64_t, int))
+{
+  char* fname = (char*) alloca(strlen(prefix) + 60);
+  int lat_offset = cfg_rtt ? 0 : -ctx->ret_lat_stats.mean;
+  FILE* f;
+
+  sprintf(fname, "%s-%d-%d.%s",
+          prefix, cfg_msg_size, ctx->msg_per_sec_target, suffix);
+  if( (f = fopen(fname, append ? "a" : "w")) == NULL ) {
+    sfnt_err("ERROR: Could not open output file '%s'\n", fname);
+    sfnt_fail_test();
   }
+  NT_TRY(write_fn(&ctx->crx->timeline, f, 0, lat_offset, ! append));
   fclose(f);
 }
 
 
-static void get_stats(struct stats* s, int* results, int results_n)
+/* Times in the timeline are relative to the start of the sweep, so with
+ * --interleave the chunks for each rate appear at the times they ran.
+ */
+static void write_timeline(struct client_tx* ctx, int append)
 {
-  int* results_end = results + results_n;
-  int64_t variance;
+  sfnt_timeline_flush(&ctx->crx->timeline);
+  if( cfg_timeline != NULL )
+    write_timeline_file(ctx, cfg_timeline, "timeline", append,
+                        sfnt_timeline_write);
+  if( cfg_heatmap != NULL )
+    write_timeline_file(ctx, cfg_heatmap, "heatmap", append,
+                        sfnt_timeline_write_heatmap);
+}
 
-  qsort(results, results_n, sizeof(int), &sfnt_qsort_compare_int);
-  sfnt_iarray_mean_and_limits(results, results_end, &s->mean, &s->min,
-                              &s->max);
 
-  s->median = results[results_n >> 1u];
-  s->percentile = results[(int) (results_n * cfg_percentile / 100)];
-  sfnt_iarray_variance(results, results_end, s->mean, &variance);
-  s->stddev = (int) sqrt((double) variance);
+/* [offset] is added to every value (but does not affect stddev). */
+static void get_stats(struct stats* s, const struct sfnt_hist* h, int offset)
+{
+  s->mean = (int) sfnt_hist_mean(h) + offset;
+  s->min = (int) h->min + offset;
+  s->median = (int) sfnt_hist_percentile(h, 50) + offset;
+  s->max = (int) h->max + offset;
+  s->percentile = (int) sfnt_hist_percentile(h, cfg_percentile) + offset;
+  s->stddev = (int) sfnt_hist_stddev(h);
 }
 
 
@@ -1357,45 +1753,239 @@ static void stats_divide(struct stats* s, int divisor)
 }
 
 
-static void write_result_line(struct client_tx* ctx)
+static void rate_result_init(struct rate_result* r)
 {
-  struct client_rx* crx = ctx->crx;
-  int* send_jit = (int*) alloca(ctx->crx->recs_n * sizeof(int));
-  int* lat = (int*) alloca(ctx->crx->recs_n * sizeof(int));
+  NT_TEST(sfnt_hist_init(&r->lat_hist, SFNT_HIST_SUB_BITS) == 0);
+  NT_TEST(sfnt_hist_init(&r->jit_hist, SFNT_HIST_SUB_BITS) == 0);
+}
+
+
+static void rate_result_reset(struct rate_result* r, int msg_per_sec_target)
+{
+  r->msg_per_sec_target = msg_per_sec_target;
+  r->millisec = 0;
+  r->n_tx_msgs = 0;
+  r->n_rx_msgs = 0;
+  r->n_fall_behinds = 0;
+  memset(&r->gap_stats, 0, sizeof(r->gap_stats));
+  memset(r->perf, 0, sizeof(r->perf));
+  memset(r->cpu, 0, sizeof(r->cpu));
+  memset(r->energy, 0, sizeof(r->energy));
+  memset(r->sched, 0, sizeof(r->sched));
+  sfnt_hist_reset(&r->lat_hist);
+  sfnt_hist_reset(&r->jit_hist);
+}
+
+
+/* Add the results of the test just completed to [r]. */
+static void rate_result_add(struct rate_result* r, struct client_tx* ctx)
+{
+  const struct gap_stats* gs = &ctx->crx->reply->gap_stats;
+  uint64_t n_tx_msgs = ctx->end_seq - ctx->start_seq;
+  int i;
+
+  r->millisec += ctx->millisec;
+  r->n_tx_msgs += n_tx_msgs;
+  r->n_rx_msgs += n_tx_msgs - gs->n_msgs_dropped;
+  r->n_fall_behinds += ctx->n_fall_behinds;
+  r->gap_stats.n_msgs_dropped += gs->n_msgs_dropped;
+  r->gap_stats.n_gaps += gs->n_gaps;
+  r->gap_stats.n_ooo += gs->n_ooo;
+  sfnt_hist_merge(&r->lat_hist, &ctx->crx->lat_hist);
+  sfnt_hist_merge(&r->jit_hist, &ctx->crx->jit_hist);
+  /* A counter that is unavailable in any run is reported as unavailable. */
+  for( i = 0; i < perf.n * 2; ++i )
+    if( ctx->perf[i] < 0 )
+      r->perf[i] = -1;
+    else if( r->perf[i] >= 0 )
+      r->perf[i] += ctx->perf[i];
+  for( i = 0; i < 3; ++i ) {
+    r->cpu[i].user += ctx->cpu[i].user;
+    r->cpu[i].sys += ctx->cpu[i].sys;
+    r->cpu[i].wall += ctx->cpu[i].wall;
+  }
+  for( i = 0; i <= energy.n; ++i )
+    if( ctx->energy[i] < 0 )
+      r->energy[i] = -1;
+    else if( r->energy[i] >= 0 )
+      r->energy[i] += ctx->energy[i];
+  for( i = 0; i < 2; ++i )
+    sfnt_sched_stats_add(&r->sched[i], &ctx->sched[i]);
+}
+
+
+/* Each value in a row of results is printed separated by tabs, or added
+ * to the row for --format.  Missing values are "-".
+ */
+static void col_i64(const char* name, int64_t v)
+{
+  if( out_format == SFNT_FORMAT_TEXT )
+    printf("%s%"PRId64, results_col++ ? "\t" : "", v);
+  else
+    sfnt_record_int(&results, name, v);
+}
+
+
+static void col_float(const char* name, int precision, double v)
+{
+  if( out_format == SFNT_FORMAT_TEXT )
+    printf("%s%.*f", results_col++ ? "\t" : "", precision, v);
+  else
+    sfnt_record_float(&results, name, v, precision);
+}
+
+
+static void col_none(const char* name)
+{
+  if( out_format == SFNT_FORMAT_TEXT )
+    printf("%s-", results_col++ ? "\t" : "");
+  else
+    sfnt_record_str(&results, name, NULL);
+}
+
+
+/* Column name built from [fmt].  Valid until the next call. */
+static const char* col_name(const char* fmt, ...)
+{
+  static char name[64];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(name, sizeof(name), fmt, args);
+  va_end(args);
+  return name;
+}
+
+
+/* Print mean run delay (ns), and context switches and migrations per
+ * message.
+ */
+static void sched_stats_print(const char* thread,
+                              const struct sfnt_sched_stats* s, uint64_t n)
+{
+  if( s->run_delay < 0 || s->n_runs <= 0 )
+    col_none(col_name("%s:rundly", thread));
+  else
+    col_i64(col_name("%s:rundly", thread), s->run_delay / s->n_runs);
+  if( s->n_switches < 0 || n == 0 )
+    col_none(col_name("%s:csw", thread));
+  else
+    col_float(col_name("%s:csw", thread), 3, (double) s->n_switches / n);
+  if( s->n_migrations < 0 || n == 0 )
+    col_none(col_name("%s:mig", thread));
+  else
+    col_float(col_name("%s:mig", thread), 4, (double) s->n_migrations / n);
+}
+
+
+static void write_result_line(struct client_tx* ctx, struct rate_result* r)
+{
+  int lat_offset = cfg_rtt ? 0 : -ctx->ret_lat_stats.mean;
   struct stats l, j;
+  const char* name;
   int i;
 
-  for( i = 0; i < crx->recs_n; ++i ) {
-    struct client_rx_rec* r = &crx->recs[i];
-    lat[i] = rec_latency_ns(ctx, r);
-    send_jit[i] = sfnt_tsc_nsec(&tsc, r->send_lateness);
-  }
-  get_stats(&l, lat, crx->recs_n);
-  get_stats(&j, send_jit, crx->recs_n);
-  printf(/*mps*/"%d\t%d\t%d\t"
-         /*latency*/"%d\t%d\t%d\t%d\t%d\t%d\t%d\t"
-         /*sendjit*/"%d\t%d\t%d\t%d\t"
-         /*gaps*/"%d\t%"PRIu64"\t%d\n",
-         ctx->msg_per_sec_target, ctx->msg_per_sec_tx, ctx->msg_per_sec_rx,
-         l.mean, l.min, l.median, l.max, l.percentile, l.stddev, crx->recs_n,
-         j.mean, j.min, j.max, ctx->n_fall_behinds,
-         crx->reply->gap_stats.n_gaps, crx->reply->gap_stats.n_msgs_dropped,
-           crx->reply->gap_stats.n_ooo);
-  fflush(stdout);
+  if( cfg_histfile != NULL )
+    write_hist_file(ctx, r);
+  get_stats(&l, &r->lat_hist, lat_offset);
+  get_stats(&j, &r->jit_hist, 0);
+  /* Columns that share a name in the text table are told apart by their
+   * group in other formats.
+   */
+  results_col = 0;
+  col_i64("target", r->msg_per_sec_target);
+  col_i64("send", (int) (r->n_tx_msgs * 1000 / r->millisec));
+  col_i64("recv", (int) (r->n_rx_msgs * 1000 / r->millisec));
+  col_i64("mean", l.mean);
+  col_i64("min", l.min);
+  col_i64("median", l.median);
+  col_i64("max", l.max);
+  col_i64("%ile", l.percentile);
+  col_i64("stddev", l.stddev);
+  col_i64("samples", (int) r->lat_hist.n);
+  col_i64("sendjit:mean", j.mean);
+  col_i64("sendjit:min", j.min);
+  col_i64("sendjit:max", j.max);
+  col_i64("behind", r->n_fall_behinds);
+  col_i64("n_gaps", r->gap_stats.n_gaps);
+  col_i64("n_drops", r->gap_stats.n_msgs_dropped);
+  col_i64("n_ooo", r->gap_stats.n_ooo);
+  if( pcts_n ) {
+    int64_t* vals = alloca(pcts_n * sizeof(vals[0]));
+    sfnt_hist_percentiles(&r->lat_hist, pcts, vals, pcts_n);
+    for( i = 0; i < pcts_n; ++i )
+      col_i64(col_name("p%g", pcts[i]), (int) vals[i] + lat_offset);
+  }
+  /* Client costs are per message sent, and server costs per message
+   * received.
+   */
+  if( cfg_cpu_cost )
+    for( i = 0; i < 3; ++i ) {
+      const struct cpu_cost* c = &r->cpu[i];
+      uint64_t n_msgs = i < 2 ? r->n_tx_msgs : r->n_rx_msgs;
+      const char* cn = cpu_cost_names[i];
+      if( n_msgs == 0 || c->wall == 0 ) {
+        col_none(col_name("%s:usr", cn));
+        col_none(col_name("%s:sys", cn));
+        col_none(col_name("%s:util", cn));
+      }
+      else {
+        col_float(col_name("%s:usr", cn), 0, (double) c->user / n_msgs);
+        col_float(col_name("%s:sys", cn), 0, (double) c->sys / n_msgs);
+        col_float(col_name("%s:util", cn), 1,
+                  100.0 * (c->user + c->sys) / c->wall);
+      }
+    }
+  for( i = 0; i < perf.n * 2; ++i ) {
+    name = col_name("%s:%s", i < perf.n ? "c" : "s", perf.names[i % perf.n]);
+    if( r->perf[i] < 0 || r->n_tx_msgs == 0 )
+      col_none(name);
+    else
+      col_float(name, 1, (double) r->perf[i] / r->n_tx_msgs);
+  }
+  if( cfg_sched_stats ) {
+    sched_stats_print("rx", &r->sched[0], r->n_tx_msgs);
+    sched_stats_print("srv", &r->sched[1], r->n_rx_msgs);
+  }
+  for( i = 0; i < energy.n; ++i ) {
+    if( r->n_tx_msgs == 0 || r->energy[energy.n] == 0 || r->energy[i] < 0 ) {
+      col_none(col_name("%s:uJ", energy.names[i]));
+      col_none(col_name("%s:W", energy.names[i]));
+    }
+    else {
+      col_float(col_name("%s:uJ", energy.names[i]), 2,
+                (double) r->energy[i] / r->n_tx_msgs);
+      col_float(col_name("%s:W", energy.names[i]), 2,
+                r->energy[i] * 1e3 / r->energy[energy.n]);
+    }
+  }
+  if( out_format == SFNT_FORMAT_TEXT ) {
+    printf("\n");
+    fflush(stdout);
+  }
+  else {
+    sfnt_record_write(&results, results_keep);
+  }
 }
 
 
 static void client_do_test(struct client_tx* ctx)
 {
   struct msg* msg = ctx->msg;
+  struct sfnt_perf_sample perf_before, perf_after;
+  struct sfnt_cpu_usage cpu_before, cpu_after;
+  struct sfnt_energy_sample en_before, en_after;
+  const int64_t* trailer;
+  int n_trailer, n_srv_perf = 0;
   int msgs_since_reply = 0;
   uint64_t ts_start, ts_end, ts_next_send;
-  uint64_t ticks_per_msg, ts_last_send;
+  uint64_t ticks_per_msg, ts_last_send, ts_done;
   uint64_t max_fall_behind;
   uint32_t seq;
-  int rc;
+  int i, rc;
 
   /* Start-up the client RX thread and warmup. */
+  if( cfg_stall_threshold )
+    ctx->crx->stall_key = ctx->msg_per_sec_target;
   client_start(ctx, 100/*??*/, cfg_msg_size);
 
   /* Get ready. */
@@ -1414,11 +2004,17 @@ static void client_do_test(struct client_tx* ctx)
   ctx->n_fall_behinds = 0;
 
   /* Do the experiment. */
+  if( cfg_perf_counters != NULL )
+    sfnt_perf_sample(&perf, &perf_before);
+  if( cfg_cpu_cost )
+    sfnt_cpu_usage_thread(&cpu_before);
+  if( energy.n )
+    sfnt_energy_sample(&energy, &en_before);
   sfnt_tsc(&ts_start);
   ts_last_send = ts_start;
   ts_next_send = ts_last_send + ticks_per_msg;
   ctx->ts_start = ts_next_send;
-  ts_end = ts_start + tsc.hz / 1000 * cfg_millisec;
+  ts_end = ts_start + tsc.hz / 1000 * ctx->millisec;
   msg->timestamp = ts_start;
   msg->flags = MF_SAVE;
   while( msg->timestamp < ts_end ) {
@@ -1439,6 +2035,7 @@ static void client_do_test(struct client_tx* ctx)
       ++ctx->n_fall_behinds;
     }
     msg->send_lateness = msg->timestamp - ts_next_send;
+    SFNT_PROBE2(stream_send, seq, msg->send_lateness);
     rc = send(ctx->write_fd, msg, ctx->msg_len, 0);
     NT_TESTi3(rc, ==, ctx->msg_len);
     ts_last_send = msg->timestamp;
@@ -1446,14 +2043,63 @@ static void client_do_test(struct client_tx* ctx)
   }
 
   ctx->end_seq = ctx->next_seq;
+  if( energy.n ) {
+    sfnt_energy_sample(&energy, &en_after);
+    sfnt_tsc(&ts_done);
+    sfnt_energy_delta(&energy, &en_before, &en_after, ctx->energy);
+    ctx->energy[energy.n] = sfnt_tsc_nsec(&tsc, ts_done - ts_start);
+  }
+  if( cfg_cpu_cost ) {
+    sfnt_cpu_usage_thread(&cpu_after);
+    sfnt_tsc(&ts_done);
+    ctx->cpu[0].user = cpu_after.user - cpu_before.user;
+    ctx->cpu[0].sys = cpu_after.sys - cpu_before.sys;
+    ctx->cpu[0].wall = sfnt_tsc_nsec(&tsc, ts_done - ts_start);
+  }
+  if( cfg_perf_counters != NULL )
+    sfnt_perf_sample(&perf, &perf_after);
 
   client_stop(ctx);
 
+  /* The server's costs follow the final reply; see do_server3(). */
+  trailer = (const int64_t*) (ctx->crx->reply + 1);
+  n_trailer = (cfg_cpu_cost ? 3 : 0) + (cfg_sched_stats ? 4 : 0);
+  if( cfg_perf_counters != NULL ) {
+    NT_TEST(ctx->crx->reply_len >= sizeof(struct msg_reply) +
+            (n_trailer + 1) * sizeof(trailer[0]));
+    n_srv_perf = (int) NT_LE64((uint64_t) trailer[n_trailer]);
+    NT_TEST(n_srv_perf >= 0 && n_srv_perf <= SFNT_PERF_MAX);
+    n_trailer += 1 + n_srv_perf;
+  }
+  NT_TESTi3(ctx->crx->reply_len, ==, sizeof(struct msg_reply) +
+            n_trailer * sizeof(trailer[0]));
+  if( cfg_cpu_cost ) {
+    ctx->cpu[1] = ctx->crx->cpu;
+    ctx->cpu[2].user = (int64_t) NT_LE64((uint64_t) *trailer++);
+    ctx->cpu[2].sys = (int64_t) NT_LE64((uint64_t) *trailer++);
+    ctx->cpu[2].wall = (int64_t) NT_LE64((uint64_t) *trailer++);
+  }
+  if( cfg_sched_stats ) {
+    ctx->sched[0] = ctx->crx->sched;
+    ctx->sched[1].run_delay = (int64_t) NT_LE64((uint64_t) *trailer++);
+    ctx->sched[1].n_runs = (int64_t) NT_LE64((uint64_t) *trailer++);
+    ctx->sched[1].n_switches = (int64_t) NT_LE64((uint64_t) *trailer++);
+    ctx->sched[1].n_migrations = (int64_t) NT_LE64((uint64_t) *trailer++);
+  }
+  /* All -1 if the server could not open the counters. */
+  if( cfg_perf_counters != NULL ) {
+    sfnt_perf_delta(&perf, &perf_before, &perf_after, ctx->perf);
+    ++trailer;
+    for( i = 0; i < perf.n; ++i )
+      ctx->perf[perf.n + i] = n_srv_perf != perf.n ? -1 :
+        (int64_t) NT_LE64((uint64_t) trailer[i]);
+  }
+
   { /* Calculate achieved TX and RX rate. */
     uint64_t n_tx_msgs = ctx->end_seq - ctx->start_seq;
     uint64_t n_rx_msgs = n_tx_msgs - ctx->crx->reply->gap_stats.n_msgs_dropped;
-    ctx->msg_per_sec_tx = (int) (n_tx_msgs * 1000 / cfg_millisec);
-    ctx->msg_per_sec_rx = (int) (n_rx_msgs * 1000 / cfg_millisec);
+    ctx->msg_per_sec_tx = (int) (n_tx_msgs * 1000 / ctx->millisec);
+    ctx->msg_per_sec_rx = (int) (n_rx_msgs * 1000 / ctx->millisec);
   }
 }
 
@@ -1490,15 +2136,7 @@ static void client_measure_rtt(struct client_tx* ctx, struct stats* stats)
     rc = client_rx_wait_sync(crx, seq, 1000);
   }
 
-  {
-    struct client_rx_rec* r;
-    int* rtt = (int*) alloca(crx->recs_n * sizeof(int));
-    for( i = 0; i < crx->recs_n; ++i ) {
-      r = &crx->recs[i];
-      rtt[i] = sfnt_tsc_nsec(&tsc, r->ts_recv - r->ts_send);
-    }
-    get_stats(stats, rtt, crx->recs_n);
-  }
+  get_stats(stats, &crx->lat_hist, 0);
 
   client_stop(ctx);
 }
@@ -1568,6 +2206,13 @@ static int do_client(int argc, char* argv[])
   else
     sfnt_fail_usage("unknown fd_type '%s'", fd_type_s);
 
+  if( out_format != SFNT_FORMAT_TEXT ) {
+    sfnt_record_init(&results, out_format, sfnt_record_take_stdout());
+    sfnt_record_str(&results, "tool", sfnt_app_name);
+    sfnt_record_str(&results, "config.fd_type", fd_type_s);
+    sfnt_record_str(&results, "config.host", argc == 2 ? argv[1] : NULL);
+  }
+
   if( cfg_samples == 0 )
     /* Default to one latency sample per millisecond of test time. */
     cfg_samples = cfg_millisec;
@@ -1633,6 +2278,7 @@ static int do_client2(int ss, const char* hostport, int local)
   struct sockaddr_storage sa;
   socklen_t sa_len;
   int port;
+  int rc;
 
   if( cfg_ipv4 )
     af = AF_INET;
@@ -1682,6 +2328,16 @@ static int do_client2(int ss, const char* hostport, int local)
   freeaddrinfo(ai);
 
   do_init();
+  /* Counters are on this thread, which is the sender. */
+  if( cfg_perf_counters != NULL ) {
+    rc = sfnt_perf_open(&perf, cfg_perf_counters);
+    if( rc == -ENOSYS )
+      sfnt_fail_usage("ERROR: --perf-counters not supported on this "
+                      "platform");
+    if( rc < 0 )
+      sfnt_fail_usage("ERROR: Unknown counter in --perf-counters");
+    sfnt_perf_enable(&perf);
+  }
   client_send_opts(ss);
   ctx = malloc(sizeof(*ctx));
   ctx->ss = ss;
@@ -1691,6 +2347,11 @@ static int do_client2(int ss, const char* hostport, int local)
     sfnt_fail_usage("ERROR: Malformed argument to option --rates");
 
   ctx->server_ld_preload = sfnt_sock_get_str(ss);
+  if( cfg_noise_ms ) {
+    sfnt_noise_get(ss, &ctx->server_noise);
+    sfnt_noise_measure(&ctx->client_noise, &tsc, cfg_noise_ms,
+                       cfg_noise_threshold);
+  }
 
   /* Look up address again but with known port and AF. */
   port = sfnt_sock_get_int(ss);
@@ -1767,13 +2428,63 @@ static int do_client2(int ss, const char* hostport, int local)
                         &cfg_busy_poll[0], sizeof(cfg_busy_poll[0])));
   }
 
-  return do_client3(ctx);
+  rc = do_client3(ctx);
+  if( cfg_stall_threshold )
+    printf("# stalls=%"PRIu64"\n", ctx->crx->stall.n_stalls);
+  if( out_format != SFNT_FORMAT_TEXT ) {
+    fclose(results.f);
+    sfnt_record_free(&results);
+  }
+  return rc;
+}
+
+
+/* With --interleave each rate is measured in cfg_interleave chunks, each
+ * lasting 1/cfg_interleave of --millisec.  The chunks for all rates are
+ * run in a random order, so that any drift in the system's performance
+ * over the course of the sweep is spread evenly over the rates.  --stop
+ * is not applied.
+ */
+static int client_do_tests_interleaved(struct client_tx* ctx)
+{
+  int n_tasks = ctx->rates.len * cfg_interleave;
+  int* tasks = malloc(n_tasks * sizeof(int));
+  int* chunks_done = calloc(ctx->rates.len, sizeof(int));
+  struct rate_result* results = calloc(ctx->rates.len, sizeof(*results));
+  int i, rate_i;
+
+  NT_TEST(tasks && chunks_done && results);
+  for( i = 0; i < ctx->rates.len; ++i ) {
+    rate_result_init(&results[i]);
+    rate_result_reset(&results[i], ctx->rates.list[i]);
+  }
+  for( i = 0; i < n_tasks; ++i )
+    tasks[i] = i % ctx->rates.len;
+  sfnt_rand_shuffle(tasks, n_tasks);
+
+  ctx->millisec = (cfg_millisec + cfg_interleave - 1) / cfg_interleave;
+  for( i = 0; i < n_tasks; ++i ) {
+    rate_i = tasks[i];
+    ctx->msg_per_sec_target = ctx->rates.list[rate_i];
+    client_do_test(ctx);
+    if( cfg_raw != NULL )
+      write_raw_results(ctx, chunks_done[rate_i] > 0);
+    if( cfg_interval )
+      write_timeline(ctx, chunks_done[rate_i] > 0);
+    rate_result_add(&results[rate_i], ctx);
+    ++chunks_done[rate_i];
+  }
+
+  for( i = 0; i < ctx->rates.len; ++i )
+    write_result_line(ctx, &results[i]);
+  return 0;
 }
 
 
 static int do_client3(struct client_tx* ctx)
 {
-  int i;
+  struct rate_result result;
+  int i, rc;
 
   ctx->msg = calloc(1, 64 * 1024);
 
@@ -1782,34 +2493,111 @@ static int do_client3(struct client_tx* ctx)
     printf("# server LD_PRELOAD=%s\n", ctx->server_ld_preload);
   printf("# percentile=%g\n", (double) cfg_percentile);
   printf("# msgsize=%d\n", cfg_msg_size);
+  if( cfg_interleave > 1 )
+    printf("# interleave=%d seed=%"PRIu64"\n", cfg_interleave, cfg_seed);
+  if( cfg_interval )
+    printf("# interval=%ums\n", cfg_interval);
+  if( cfg_stall_threshold )
+    printf("# stall-threshold=%uns\n", cfg_stall_threshold);
+  if( cfg_noise_ms ) {
+    noise_report("client-tx", cfg_affinity[0], &ctx->client_noise);
+    noise_report("server", cfg_affinity[1], &ctx->server_noise);
+  }
+  if( cfg_cpu_cost )
+    printf("# cpu-cost: user and sys ns per message and %%utilisation of "
+           "client tx, client rx and server threads\n");
+  if( cfg_perf_counters != NULL ) {
+    printf("# perf-counters: per-message counts on client-tx (c:) and "
+           "server (s:)\n");
+    sfnt_perf_print_unavailable(stdout, "client-tx", &perf);
+  }
+  if( cfg_sched_stats )
+    printf("# sched-stats: mean run delay (ns), context switches and "
+           "migrations per message on client rx and server threads\n");
+  if( cfg_energy ) {
+    if( (rc = sfnt_energy_open(&energy)) < 0 )
+      printf("# WARNING: energy counters unavailable (%d %s)\n",
+             -rc, strerror(-rc));
+    else
+      printf("# energy: uJ per message and average W for the client "
+             "host\n");
+  }
   fflush(stdout);
 
   /* Measure single-trip latency when quiescent */
   client_measure_rtt(ctx, &ctx->ret_lat_stats);
   stats_divide(&ctx->ret_lat_stats, 2);
   printf("# return_latency=%d\n", ctx->ret_lat_stats.mean);
+  if( out_format != SFNT_FORMAT_TEXT ) {
+    sfnt_record_cmd_line(&results);
+    sfnt_record_sys_info(&results, &tsc);
+    sfnt_record_str(&results, "server.ld_preload", ctx->server_ld_preload);
+    sfnt_record_int(&results, "return_latency", ctx->ret_lat_stats.mean);
+    results_keep = results.n_fields;
+  }
 
   printf("#\n");
   printf("#mps\tmps\tmps\t"
          "latency\tlatency\tlatency\tlatency\tlatency\tlatency\tlatency\t"
          "sendjit\tsendjit\tsendjit\tsendjit\t"
-         "gaps\tgaps\tgaps\n");
+         "gaps\tgaps\tgaps");
+  for( i = 0; i < pcts_n; ++i )
+    printf("\tlatency");
+  if( cfg_cpu_cost )
+    for( i = 0; i < 9; ++i )
+      printf("\tcpu");
+  for( i = 0; i < perf.n * 2; ++i )
+    printf("\tperf");
+  if( cfg_sched_stats )
+    for( i = 0; i < 6; ++i )
+      printf("\tsched");
+  for( i = 0; i < energy.n * 2; ++i )
+    printf("\tenergy");
+  printf("\n");
   printf("#target\tsend\trecv\t"
          "mean\tmin\tmedian\tmax\t%%ile\tstddev\tsamples\t"
          "mean\tmin\tmax\tbehind\t"
-         "n_gaps\tn_drops\tn_ooo\n");
+         "n_gaps\tn_drops\tn_ooo");
+  for( i = 0; i < pcts_n; ++i )
+    printf("\tp%g", pcts[i]);
+  if( cfg_cpu_cost )
+    for( i = 0; i < 3; ++i )
+      printf("\t%s:usr\t%s:sys\t%s:util", cpu_cost_names[i],
+             cpu_cost_names[i], cpu_cost_names[i]);
+  for( i = 0; i < perf.n * 2; ++i )
+    printf("\t%s:%s", i < perf.n ? "c" : "s", perf.names[i % perf.n]);
+  if( cfg_sched_stats )
+    printf("\trx:rundly\trx:csw\trx:mig\tsrv:rundly\tsrv:csw\tsrv:mig");
+  for( i = 0; i < energy.n; ++i )
+    printf("\t%s:uJ\t%s:W", energy.names[i], energy.names[i]);
+  printf("\n");
   fflush(stdout);
 
   sfnt_sock_put_int(ctx->ss, cfg_msg_size);
   sfnt_sock_get_int(ctx->ss);
 
   /* the test proper */
+  sfnt_tsc(&ctx->crx->sweep_start);
+  ctx->crx->lat_offset = cfg_rtt ? 0 : -ctx->ret_lat_stats.mean;
+  if( cfg_interleave > 1 )
+    return client_do_tests_interleaved(ctx);
+
+  rate_result_init(&result);
+  ctx->millisec = cfg_millisec;
   for( i = 0; i < ctx->rates.len; ++i ) {
     ctx->msg_per_sec_target = ctx->rates.list[i];
+    if( raw_bin )
+      rawlog_begin(ctx);
     client_do_test(ctx);
-    if( cfg_raw != NULL )
-      write_raw_results(ctx);
-    write_result_line(ctx);
+    if( raw_bin )
+      rawlog_end(ctx);
+    else if( cfg_raw != NULL )
+      write_raw_results(ctx, 0);
+    if( cfg_interval )
+      write_timeline(ctx, 0);
+    rate_result_reset(&result, ctx->msg_per_sec_target);
+    rate_result_add(&result, ctx);
+    write_result_line(ctx, &result);
     if( cfg_stop && tx_is_not_keeping_up(ctx) ) {
       sfnt_err("sfnt-stream: client: TX rate is %d%% of target; stopping\n",
                ctx->msg_per_sec_tx * 100 / ctx->msg_per_sec_target);
@@ -1837,6 +2625,43 @@ int main(int argc, char* argv[])
                 &argc, argv, cfg_opts, N_CFG_OPTS);
   --argc; ++argv;
 
+  if( cfg_format != NULL && sfnt_format_parse(cfg_format, &out_format) < 0 )
+    sfnt_fail_usage("ERROR: Unknown format '%s'", cfg_format);
+  if( cfg_percentiles != NULL ) {
+    pcts_n = sfnt_hist_parse_percentiles(cfg_percentiles, pcts,
+                                         MAX_PERCENTILES);
+    if( pcts_n < 0 )
+      sfnt_fail_usage("ERROR: Malformed argument to option --percentiles");
+  }
+  if( cfg_interleave < 0 )
+    sfnt_fail_usage("ERROR: Bad argument to option --interleave");
+  if( cfg_timer != NULL && (rc = sfnt_timer_select(cfg_timer)) < 0 )
+    sfnt_fail_usage("ERROR: %s timer '%s'",
+                    rc == -ENOSYS ? "Unsupported" : "Unknown", cfg_timer);
+  if( cfg_raw_format != NULL ) {
+    if( ! strcmp(cfg_raw_format, "bin") )
+      raw_bin = 1;
+    else if( strcmp(cfg_raw_format, "text") )
+      sfnt_fail_usage("ERROR: Unknown raw format '%s'", cfg_raw_format);
+    if( cfg_raw == NULL )
+      sfnt_fail_usage("ERROR: --raw-format requires --raw");
+    if( raw_bin && cfg_interleave > 1 )
+      sfnt_fail_usage("ERROR: --raw-format=bin cannot be combined with "
+                      "--interleave");
+  }
+  cfg_seed = sfnt_rand_seed(cfg_seed);
+  if( (cfg_timeline != NULL || cfg_heatmap != NULL) && ! cfg_interval )
+    sfnt_fail_usage("ERROR: --timeline and --heatmap require --interval");
+  if( cfg_interval && cfg_timeline == NULL && cfg_heatmap == NULL )
+    sfnt_fail_usage("ERROR: --interval requires --timeline or --heatmap");
+  if( cfg_stall_log != NULL && ! cfg_stall_threshold )
+    sfnt_fail_usage("ERROR: --stall-log requires --stall-threshold");
+  if( (cfg_noise_budget > 0 || cfg_noise_fail) && ! cfg_noise_ms )
+    sfnt_fail_usage("ERROR: --noise-budget and --noise-fail require "
+                    "--noise-ms");
+  if( cfg_noise_fail && cfg_noise_budget <= 0 )
+    sfnt_fail_usage("ERROR: --noise-fail requires --noise-budget");
+
   if( argc == 0 )
     rc = -do_server();
   else
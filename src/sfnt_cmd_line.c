@@ -430,3 +430,73 @@ static void parse_cfg_string(char* s)
 
   free(argv);
 }
+
+
+/* Format value [i] of option [a].  Returns NULL for a string option that
+ * has not been set.
+ */
+static const char* cla_val_str(const struct sfnt_cmd_line_opt* a, int i,
+                               char* buf, int buf_len)
+{
+  switch( a->type ) {
+  case SFNT_CLAT_FLAG:
+  case SFNT_CLAT_INT:
+  case SFNT_CLAT_UINT:
+    snprintf(buf, buf_len, "%d", ((int*) a->value)[i]);
+    return buf;
+  case SFNT_CLAT_INT64:
+    snprintf(buf, buf_len, "%lld", ((long long int*) a->value)[i]);
+    return buf;
+  case SFNT_CLAT_UINT64:
+    snprintf(buf, buf_len, "%llu", ((unsigned long long int*) a->value)[i]);
+    return buf;
+  case SFNT_CLAT_FLOAT:
+    snprintf(buf, buf_len, "%g", ((float*) a->value)[i]);
+    return buf;
+  case SFNT_CLAT_STR:
+    return ((char**) a->value)[i];
+  default:
+    return NULL;
+  }
+}
+
+
+void sfnt_record_cmd_line(struct sfnt_record* rec)
+{
+  const struct sfnt_cmd_line_opt* a;
+  char key[64], v0[64], v1[64];
+  const char* s0;
+  const char* s1;
+  char* both;
+
+  for( a = cmd_line_opts; a != cmd_line_opts + cmd_line_opts_n; ++a ) {
+    if( a->type == SFNT_CLAT_FN || a->type == SFNT_CLAT_USAGE ||
+        a->type == SFNT_CLAT_IRANGE || a->value == NULL )
+      continue;
+    if( a->long_name )
+      snprintf(key, sizeof(key), "config.%s", a->long_name);
+    else
+      snprintf(key, sizeof(key), "config.%c", a->short_name);
+    s0 = cla_val_str(a, 0, v0, sizeof(v0));
+    if( a->num == 2 ) {
+      s1 = cla_val_str(a, 1, v1, sizeof(v1));
+      s0 = s0 ? s0 : "";
+      s1 = s1 ? s1 : "";
+      NT_TEST((both = malloc(strlen(s0) + strlen(s1) + 2)) != NULL);
+      sprintf(both, "%s;%s", s0, s1);
+      sfnt_record_str(rec, key, both);
+      free(both);
+    }
+    else if( a->type == SFNT_CLAT_STR )
+      sfnt_record_str(rec, key, s0);
+    else if( a->type == SFNT_CLAT_FLOAT )
+      sfnt_record_float(rec, key, *(float*) a->value, -1);
+    else if( a->type == SFNT_CLAT_UINT64 && *(int64_t*) a->value < 0 )
+      /* Too big for a signed value. */
+      sfnt_record_str(rec, key, s0);
+    else if( a->type == SFNT_CLAT_INT64 || a->type == SFNT_CLAT_UINT64 )
+      sfnt_record_int(rec, key, *(int64_t*) a->value);
+    else
+      sfnt_record_int(rec, key, *(int*) a->value);
+  }
+}
@@ -0,0 +1,187 @@
+/**************************************************************************\
+*    Filename: sfnt_energy.c
+* Description: Energy counters from the powercap (RAPL) interface.
+*   Copyright: (C) 2012-2023 Advanced Micro Devices, Inc.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation, incorporated herein by reference.
+\**************************************************************************/
+
+#include "sfnettest.h"
+#ifdef __linux__
+# include <dirent.h>
+#endif
+
+
+#ifdef __linux__
+
+static int energy_read_u64(const char* path, uint64_t* val)
+{
+  unsigned long long v;
+  FILE* f;
+  int rc;
+
+  if( (f = fopen(path, "r")) == NULL )
+    return -errno;
+  rc = fscanf(f, "%llu", &v);
+  fclose(f);
+  if( rc != 1 )
+    return -EINVAL;
+  *val = v;
+  return 0;
+}
+
+
+static int energy_read_str(const char* path, char* buf, int buf_len)
+{
+  FILE* f;
+  int len;
+
+  if( (f = fopen(path, "r")) == NULL )
+    return -errno;
+  if( fgets(buf, buf_len, f) == NULL )
+    buf[0] = '\0';
+  fclose(f);
+  len = strlen(buf);
+  while( len && isspace(buf[len - 1]) )
+    buf[--len] = '\0';
+  return len ? 0 : -EINVAL;
+}
+
+
+/* Zones are named <type>:<package> and sub-zones <type>:<package>:<n>.
+ * Sub-zone names (eg. "core") are not unique, so are qualified with the
+ * package.
+ */
+static void energy_add_zone(struct sfnt_energy* e, const char* root,
+                            const char* zone, int* err)
+{
+  char path[512], name[SFNT_ENERGY_NAME_LEN - 12];  /* room for -<pkg> */
+  const char* colon;
+  uint64_t uj;
+  int rc, i = e->n;
+
+  if( strstr(zone, "rapl") == NULL || strstr(zone, "mmio") != NULL ||
+      (colon = strchr(zone, ':')) == NULL )
+    return;
+  snprintf(path, sizeof(path), "%s/%s/name", root, zone);
+  if( energy_read_str(path, name, sizeof(name)) < 0 )
+    return;
+  if( strncmp(name, "package", 7) && strcmp(name, "core") )
+    return;
+  if( i == SFNT_ENERGY_MAX )
+    return;
+
+  snprintf(path, sizeof(path), "%s/%s/energy_uj", root, zone);
+  /* Recent kernels only allow root to read energy_uj. */
+  if( (rc = energy_read_u64(path, &uj)) < 0 ) {
+    *err = -rc;
+    return;
+  }
+  NT_TEST((e->paths[i] = strdup(path)) != NULL);
+  if( strchr(colon + 1, ':') != NULL )
+    snprintf(e->names[i], SFNT_ENERGY_NAME_LEN, "%s-%d", name,
+             atoi(colon + 1));
+  else
+    strcpy(e->names[i], name);
+  snprintf(path, sizeof(path), "%s/%s/max_energy_range_uj", root, zone);
+  if( energy_read_u64(path, &e->range[i]) < 0 )
+    e->range[i] = 0;
+  ++e->n;
+}
+
+
+static int zone_cmp(const void* a, const void* b)
+{
+  return strcmp(*(const char* const*) a, *(const char* const*) b);
+}
+
+
+int sfnt_energy_open(struct sfnt_energy* e)
+{
+  const char* root = getenv("SFNT_POWERCAP_ROOT");
+  char* zones[64];
+  struct dirent* ent;
+  int n_zones = 0, err = 0, i;
+  DIR* dir;
+
+  memset(e, 0, sizeof(*e));
+  if( root == NULL )
+    root = "/sys/class/powercap";
+  if( (dir = opendir(root)) == NULL )
+    return -errno;
+  while( (ent = readdir(dir)) != NULL && n_zones < 64 )
+    if( ent->d_name[0] != '.' )
+      NT_TEST((zones[n_zones++] = strdup(ent->d_name)) != NULL);
+  closedir(dir);
+
+  /* Sort so that columns come out in the same order on every run. */
+  qsort(zones, n_zones, sizeof(zones[0]), zone_cmp);
+  for( i = 0; i < n_zones; ++i ) {
+    energy_add_zone(e, root, zones[i], &err);
+    free(zones[i]);
+  }
+  if( e->n == 0 )
+    return err ? -err : -ENOENT;
+  return 0;
+}
+
+
+void sfnt_energy_close(struct sfnt_energy* e)
+{
+  int i;
+  for( i = 0; i < e->n; ++i )
+    free(e->paths[i]);
+  e->n = 0;
+}
+
+
+void sfnt_energy_sample(const struct sfnt_energy* e,
+                        struct sfnt_energy_sample* s)
+{
+  int i;
+  for( i = 0; i < e->n; ++i )
+    if( energy_read_u64(e->paths[i], &s->uj[i]) < 0 )
+      s->uj[i] = SFNT_ENERGY_UNKNOWN;
+}
+
+#else
+
+int sfnt_energy_open(struct sfnt_energy* e)
+{
+  memset(e, 0, sizeof(*e));
+  return -ENOSYS;
+}
+
+
+void sfnt_energy_close(struct sfnt_energy* e)
+{
+}
+
+
+void sfnt_energy_sample(const struct sfnt_energy* e,
+                        struct sfnt_energy_sample* s)
+{
+}
+
+#endif
+
+
+void sfnt_energy_delta(const struct sfnt_energy* e,
+                       const struct sfnt_energy_sample* before,
+                       const struct sfnt_energy_sample* after, int64_t* uj)
+{
+  int i;
+  for( i = 0; i < e->n; ++i )
+    if( before->uj[i] == SFNT_ENERGY_UNKNOWN ||
+        after->uj[i] == SFNT_ENERGY_UNKNOWN )
+      uj[i] = -1;
+    else if( after->uj[i] >= before->uj[i] )
+      uj[i] = after->uj[i] - before->uj[i];
+    else if( e->range[i] > before->uj[i] )
+      /* The counter wrapped. */
+      uj[i] = e->range[i] - before->uj[i] + after->uj[i];
+    else
+      uj[i] = -1;
+}
@@ -0,0 +1,401 @@
+/**************************************************************************\
+*    Filename: sfnt_hist.c
+* Description: Constant-memory log-linear latency histograms.
+*   Copyright: (C) 2012-2023 Advanced Micro Devices, Inc.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation, incorporated herein by reference.
+\**************************************************************************/
+
+#include "sfnettest.h"
+
+
+/* Buckets are laid out as follows (with H = 2^(sub_bits-1)):
+ *
+ *   values [0, 2H)               -> one bucket per value
+ *   values [2^m, 2^(m+1)), m>=S  -> H buckets of width 2^(m-S+1)
+ *
+ * so bucket index = shift * H + (v >> shift), where shift = m - S + 1.
+ */
+
+
+static inline int msb64(uint64_t v)
+{
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll(v);
+#else
+  int m = 0;
+  while( v >>= 1 )
+    ++m;
+  return m;
+#endif
+}
+
+
+static inline int hist_bucket(const struct sfnt_hist* h, int64_t v)
+{
+  int shift;
+  if( v < (2 << (h->sub_bits - 1)) )
+    return v < 0 ? 0 : (int) v;
+  shift = msb64(v) - h->sub_bits + 1;
+  return (shift << (h->sub_bits - 1)) + (int) (v >> shift);
+}
+
+
+int sfnt_hist_bucket(const struct sfnt_hist* h, int64_t v)
+{
+  return hist_bucket(h, v);
+}
+
+
+int64_t sfnt_hist_bucket_lo(const struct sfnt_hist* h, int i)
+{
+  int half = 1 << (h->sub_bits - 1);
+  int shift;
+  if( i < 2 * half )
+    return i;
+  shift = i / half - 1;
+  return (int64_t) (i - shift * half) << shift;
+}
+
+
+int64_t sfnt_hist_bucket_width(const struct sfnt_hist* h, int i)
+{
+  int half = 1 << (h->sub_bits - 1);
+  if( i < 2 * half )
+    return 1;
+  return (int64_t) 1 << (i / half - 1);
+}
+
+
+static void hist_clear_stats(struct sfnt_hist* h)
+{
+  h->lo_i = h->n_buckets;
+  h->hi_i = -1;
+  h->n = 0;
+  h->min = INT64_MAX;
+  h->max = INT64_MIN;
+  h->mean = 0;
+  h->m2 = 0;
+}
+
+
+int sfnt_hist_init(struct sfnt_hist* h, int sub_bits)
+{
+  NT_ASSERT(sub_bits >= 2 && sub_bits <= 16);
+  h->sub_bits = sub_bits;
+  h->n_buckets = (65 - sub_bits) << (sub_bits - 1);
+  h->counts = calloc(h->n_buckets, sizeof(h->counts[0]));
+  if( h->counts == NULL )
+    return -ENOMEM;
+  /* calloc() zeroed the counts already. */
+  hist_clear_stats(h);
+  return 0;
+}
+
+
+void sfnt_hist_free(struct sfnt_hist* h)
+{
+  free(h->counts);
+  h->counts = NULL;
+}
+
+
+void sfnt_hist_reset(struct sfnt_hist* h)
+{
+  /* Only touch the populated range: this is cheap enough to call between
+   * every batch of a test.
+   */
+  if( h->hi_i >= h->lo_i )
+    memset(&h->counts[h->lo_i], 0,
+           (size_t) (h->hi_i - h->lo_i + 1) * sizeof(h->counts[0]));
+  hist_clear_stats(h);
+}
+
+
+void sfnt_hist_record_n(struct sfnt_hist* h, int64_t v, uint64_t count)
+{
+  int i = hist_bucket(h, v);
+  double delta;
+
+  if( count == 0 )
+    return;
+  h->counts[i] += count;
+  if( i < h->lo_i )  h->lo_i = i;
+  if( i > h->hi_i )  h->hi_i = i;
+  if( v < h->min )   h->min = v;
+  if( v > h->max )   h->max = v;
+
+  /* Welford's running mean and variance. */
+  h->n += count;
+  delta = (double) v - h->mean;
+  h->mean += delta * count / h->n;
+  h->m2 += delta * ((double) v - h->mean) * count;
+}
+
+
+void sfnt_hist_record(struct sfnt_hist* h, int64_t v)
+{
+  sfnt_hist_record_n(h, v, 1);
+}
+
+
+void sfnt_hist_merge(struct sfnt_hist* dst, const struct sfnt_hist* src)
+{
+  double delta;
+  uint64_t n;
+  int i;
+
+  NT_ASSERT(dst->sub_bits == src->sub_bits);
+  if( src->n == 0 )
+    return;
+  for( i = src->lo_i; i <= src->hi_i; ++i )
+    dst->counts[i] += src->counts[i];
+  if( src->lo_i < dst->lo_i )  dst->lo_i = src->lo_i;
+  if( src->hi_i > dst->hi_i )  dst->hi_i = src->hi_i;
+  if( src->min < dst->min )    dst->min = src->min;
+  if( src->max > dst->max )    dst->max = src->max;
+
+  /* Chan et al. parallel combination of mean and variance. */
+  n = dst->n + src->n;
+  delta = src->mean - dst->mean;
+  dst->m2 += src->m2 + delta * delta * ((double) dst->n * src->n / n);
+  dst->mean += delta * src->n / n;
+  dst->n = n;
+}
+
+
+int64_t sfnt_hist_mean(const struct sfnt_hist* h)
+{
+  return (int64_t) h->mean;
+}
+
+
+double sfnt_hist_stddev(const struct sfnt_hist* h)
+{
+  if( h->n < 2 )
+    return 0;
+  return sqrt(h->m2 / (h->n - 1));
+}
+
+
+/* Representative value for the given bucket: its midpoint, limited to the
+ * range of values actually recorded.
+ */
+static int64_t hist_bucket_value(const struct sfnt_hist* h, int i)
+{
+  int64_t v = sfnt_hist_bucket_lo(h, i);
+  v += (sfnt_hist_bucket_width(h, i) - 1) / 2;
+  if( v < h->min )  v = h->min;
+  if( v > h->max )  v = h->max;
+  return v;
+}
+
+
+int64_t sfnt_hist_value_at_rank(const struct sfnt_hist* h, uint64_t rank)
+{
+  uint64_t cum = 0;
+  int i;
+
+  NT_ASSERT(h->n > 0);
+  if( rank >= h->n - 1 )
+    return h->max;
+  for( i = h->lo_i; i <= h->hi_i; ++i )
+    if( (cum += h->counts[i]) > rank )
+      break;
+  return hist_bucket_value(h, i);
+}
+
+
+static uint64_t pct_to_rank(const struct sfnt_hist* h, double pct)
+{
+  /* Same convention as indexing a sorted array at (n * pct / 100). */
+  double r = h->n * pct / 100;
+  if( r <= 0 )
+    return 0;
+  if( r >= h->n - 1 )
+    return h->n - 1;
+  return (uint64_t) r;
+}
+
+
+int64_t sfnt_hist_percentile(const struct sfnt_hist* h, double pct)
+{
+  return sfnt_hist_value_at_rank(h, pct_to_rank(h, pct));
+}
+
+
+void sfnt_hist_percentiles(const struct sfnt_hist* h, const double* pcts,
+                           int64_t* vals_out, int n_pcts)
+{
+  int* order = alloca(n_pcts * sizeof(int));
+  uint64_t rank, cum = 0;
+  int i, j, k, t;
+
+  NT_ASSERT(h->n > 0);
+
+  /* Visit the requested percentiles in ascending order so that a single
+   * walk over the buckets answers all of them.
+   */
+  for( j = 0; j < n_pcts; ++j ) {
+    for( k = j; k > 0 && pcts[order[k - 1]] > pcts[j]; --k )
+      order[k] = order[k - 1];
+    order[k] = j;
+  }
+
+  i = h->lo_i;
+  cum = h->counts[i];
+  for( k = 0; k < n_pcts; ++k ) {
+    t = order[k];
+    rank = pct_to_rank(h, pcts[t]);
+    if( rank >= h->n - 1 ) {
+      vals_out[t] = h->max;
+      continue;
+    }
+    while( cum <= rank )
+      cum += h->counts[++i];
+    vals_out[t] = hist_bucket_value(h, i);
+  }
+}
+
+
+int sfnt_hist_percentile_ci(const struct sfnt_hist* h, double pct,
+                            double z, int64_t* lo_out, int64_t* hi_out)
+{
+  /* Rank of the sample at the percentile is binomial(n, p), so the
+   * interval is bounded by the samples at ranks np +/- z*sqrt(np(1-p)).
+   */
+  double p = pct / 100;
+  double r = h->n * p;
+  double d = z * sqrt(h->n * p * (1 - p));
+  int rc = 0;
+
+  NT_ASSERT(h->n > 0);
+  if( r - d < 0 ) {
+    *lo_out = h->min;
+    rc = -1;
+  }
+  else {
+    *lo_out = sfnt_hist_value_at_rank(h, (uint64_t) (r - d));
+  }
+  if( r + d + 1 >= h->n ) {
+    *hi_out = h->max;
+    rc = -1;
+  }
+  else {
+    *hi_out = sfnt_hist_value_at_rank(h, (uint64_t) ceil(r + d));
+  }
+  return rc;
+}
+
+
+int sfnt_hist_parse_percentiles(const char* str, double* pcts, int max_n)
+{
+  const char* p = str;
+  char* end;
+  int n = 0;
+
+  while( *p ) {
+    if( *p == ',' ) {
+      ++p;
+      continue;
+    }
+    if( n == max_n )
+      return -E2BIG;
+    pcts[n] = strtod(p, &end);
+    if( end == p || pcts[n] < 0 || pcts[n] > 100 )
+      return -EINVAL;
+    ++n;
+    p = end;
+  }
+  return n;
+}
+
+
+int sfnt_hist_write(FILE* f, const struct sfnt_hist* h, int64_t offset)
+{
+  int i;
+
+  fprintf(f, "# sfnt-hist v1\n");
+  fprintf(f, "sub_bits %d\n", h->sub_bits);
+  fprintf(f, "offset %"PRId64"\n", offset);
+  fprintf(f, "n %"PRIu64"\n", h->n);
+  fprintf(f, "min %"PRId64"\n", h->min);
+  fprintf(f, "max %"PRId64"\n", h->max);
+  fprintf(f, "mean %.17g\n", h->mean);
+  fprintf(f, "m2 %.17g\n", h->m2);
+  for( i = h->lo_i; i <= h->hi_i; ++i )
+    if( h->counts[i] )
+      fprintf(f, "%d %"PRIu64"\n", i, h->counts[i]);
+  return ferror(f) ? -EIO : 0;
+}
+
+
+int sfnt_hist_read(FILE* f, struct sfnt_hist* h, int64_t* offset_out)
+{
+  char line[128];
+  long long ll;
+  unsigned long long ull;
+  uint64_t total = 0;
+  double d;
+  int i, rc, seen = 0;
+
+  h->counts = NULL;
+  *offset_out = 0;
+  if( fgets(line, sizeof(line), f) == NULL ||
+      strncmp(line, "# sfnt-hist v1", 14) )
+    return -EINVAL;
+
+  while( fgets(line, sizeof(line), f) != NULL ) {
+    if( line[0] == '#' || line[0] == '\n' )
+      continue;
+    if( sscanf(line, "sub_bits %d", &i) == 1 ) {
+      if( h->counts != NULL || i < 2 || i > 16 )
+        goto bad;
+      if( (rc = sfnt_hist_init(h, i)) < 0 )
+        return rc;
+      continue;
+    }
+    if( h->counts == NULL )
+      goto bad;  /* sub_bits must come first */
+    if( sscanf(line, "offset %lld", &ll) == 1 )
+      *offset_out = ll;
+    else if( sscanf(line, "n %llu", &ull) == 1 ) {
+      h->n = ull;
+      seen |= 1;
+    }
+    else if( sscanf(line, "min %lld", &ll) == 1 ) {
+      h->min = ll;
+      seen |= 2;
+    }
+    else if( sscanf(line, "max %lld", &ll) == 1 ) {
+      h->max = ll;
+      seen |= 4;
+    }
+    else if( sscanf(line, "mean %lf", &d) == 1 )
+      h->mean = d;
+    else if( sscanf(line, "m2 %lf", &d) == 1 )
+      h->m2 = d;
+    else if( sscanf(line, "%d %llu", &i, &ull) == 2 &&
+             i >= 0 && i < h->n_buckets ) {
+      h->counts[i] += ull;
+      total += ull;
+      if( i < h->lo_i )  h->lo_i = i;
+      if( i > h->hi_i )  h->hi_i = i;
+    }
+    else
+      goto bad;
+  }
+  if( h->counts == NULL )
+    return -EINVAL;
+  /* A truncated file is missing some of its counts. */
+  if( seen != 7 || h->n == 0 || total != h->n || h->min > h->max )
+    goto bad;
+  return 0;
+
+ bad:
+  if( h->counts != NULL )
+    sfnt_hist_free(h);
+  return -EINVAL;
+}
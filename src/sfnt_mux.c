@@ -19,6 +19,9 @@
   )
 
 
+uint64_t sfnt_mux_calls;
+
+
 static inline uint64_t get_tsc(void)
 {
   uint64_t tsc;
@@ -49,7 +52,10 @@ int sfnt_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms,
   uint64_t tsc_now, tsc_timeout;
   int rc;
 
+  ++sfnt_mux_calls;
+  SFNT_PROBE0(mux_wait);
   rc = poll(fds, nfds, use_timeout_ms);
+  SFNT_PROBE1(mux_wake, rc);
   if( return_now(rc, flags, timeout_ms) )
     return rc;
 
@@ -61,7 +67,10 @@ int sfnt_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms,
   tsc_timeout = calc_tsc_timeout(tscp, timeout_ms);
 
   while( 1 ) {
+    ++sfnt_mux_calls;
+    SFNT_PROBE0(mux_wait);
     rc = poll(fds, nfds, use_timeout_ms);
+    SFNT_PROBE1(mux_wake, rc);
     if( return_now(rc, flags, timeout_ms) )
       break;
     if( rc < 0 ) {  /* EINTR && NT_MUX_CONTINUE_ON_EINTR */
@@ -93,7 +102,10 @@ int sfnt_epoll_wait(int epfd, struct epoll_event* events, int maxevents,
   uint64_t tsc_now, tsc_timeout;
   int rc;
 
+  ++sfnt_mux_calls;
+  SFNT_PROBE0(mux_wait);
   rc = epoll_wait(epfd, events, maxevents, use_timeout_ms);
+  SFNT_PROBE1(mux_wake, rc);
   if( return_now(rc, flags, timeout_ms) )
     return rc;
 
@@ -105,7 +117,10 @@ int sfnt_epoll_wait(int epfd, struct epoll_event* events, int maxevents,
   tsc_timeout = calc_tsc_timeout(tscp, timeout_ms);
 
   while( 1 ) {
+    ++sfnt_mux_calls;
+    SFNT_PROBE0(mux_wait);
     rc = epoll_wait(epfd, events, maxevents, use_timeout_ms);
+    SFNT_PROBE1(mux_wake, rc);
     if( return_now(rc, flags, timeout_ms) )
       break;
     if( rc < 0 ) {  /* EINTR && NT_MUX_CONTINUE_ON_EINTR */
@@ -160,7 +175,10 @@ int sfnt_select(int nfds, fd_set* readfds, fd_set* writefds,
       memcpy(__FDS_BITS(&exceptfds_save), __FDS_BITS(exceptfds), fds_bytes);
   }
 
+  ++sfnt_mux_calls;
+  SFNT_PROBE0(mux_wait);
   rc = select(nfds, readfds, writefds, exceptfds, timeout);
+  SFNT_PROBE1(mux_wake, rc);
   if( return_now(rc, flags, timeout_ms) )
     return rc;
 
@@ -173,7 +191,10 @@ int sfnt_select(int nfds, fd_set* readfds, fd_set* writefds,
       memcpy(__FDS_BITS(writefds), __FDS_BITS(&writefds_save), fds_bytes);
     if( exceptfds != NULL )
       memcpy(__FDS_BITS(exceptfds), __FDS_BITS(&exceptfds_save), fds_bytes);
+    ++sfnt_mux_calls;
+    SFNT_PROBE0(mux_wait);
     rc = select(nfds, readfds, writefds, exceptfds, timeout);
+    SFNT_PROBE1(mux_wake, rc);
     if( return_now(rc, flags, timeout_ms) )
       break;
     if( rc < 0 ) {  /* EINTR && NT_MUX_CONTINUE_ON_EINTR */
@@ -0,0 +1,103 @@
+/**************************************************************************\
+*    Filename: sfnt_noise.c
+* Description: Measure OS noise on the current core.
+*   Copyright: (C) 2012-2023 Advanced Micro Devices, Inc.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation, incorporated herein by reference.
+\**************************************************************************/
+
+#include "sfnettest.h"
+
+
+/* Spin reading the TSC, and treat any gap between consecutive reads that is
+ * longer than the threshold as time stolen from this thread by the OS
+ * (interrupts, preemption, SMIs etc.).
+ */
+void sfnt_noise_measure(struct sfnt_noise* n, const struct sfnt_tsc_params* tsc,
+                        int millisec, int64_t threshold)
+{
+  uint64_t start, end, prev, now, thresh_ticks, gap;
+  int64_t gap_ns, lim;
+  int i;
+
+  memset(n, 0, sizeof(*n));
+  n->threshold = threshold;
+  thresh_ticks = (uint64_t) ((double) threshold * tsc->hz / 1e9);
+
+  sfnt_tsc(&start);
+  end = start + tsc->hz * millisec / 1000;
+  prev = start;
+  do {
+    sfnt_tsc(&now);
+    if( (gap = now - prev) > thresh_ticks ) {
+      gap_ns = sfnt_tsc_nsec(tsc, gap);
+      ++n->n_gaps;
+      n->stolen += gap_ns;
+      if( gap_ns > n->max_gap )
+        n->max_gap = gap_ns;
+      for( i = 0, lim = threshold * 2;
+           i < SFNT_NOISE_BUCKETS - 1 && gap_ns >= lim; ++i, lim *= 2 )
+        ;
+      ++n->buckets[i];
+    }
+    prev = now;
+  } while( now - start < end - start );
+
+  n->duration = sfnt_tsc_nsec(tsc, now - start);
+}
+
+
+double sfnt_noise_stolen_pct(const struct sfnt_noise* n)
+{
+  return n->duration ? 100.0 * n->stolen / n->duration : 0;
+}
+
+
+void sfnt_noise_print(FILE* f, const char* who, const struct sfnt_noise* n)
+{
+  int64_t lo = n->threshold;
+  int i;
+
+  fprintf(f, "# noise: %s ms=%"PRId64" threshold=%"PRId64"ns gaps=%"PRIu64
+          " stolen=%.4f%% max=%"PRId64"ns\n", who, n->duration / 1000000,
+          n->threshold, n->n_gaps, sfnt_noise_stolen_pct(n), n->max_gap);
+  if( n->n_gaps == 0 )
+    return;
+  fprintf(f, "# noise: %s gaps(ns):", who);
+  for( i = 0; i < SFNT_NOISE_BUCKETS; ++i, lo *= 2 )
+    if( n->buckets[i] ) {
+      if( i < SFNT_NOISE_BUCKETS - 1 )
+        fprintf(f, " %"PRId64"-%"PRId64":%"PRIu64, lo, lo * 2, n->buckets[i]);
+      else
+        fprintf(f, " >=%"PRId64":%"PRIu64, lo, n->buckets[i]);
+    }
+  fprintf(f, "\n");
+}
+
+
+void sfnt_noise_put(int fd, const struct sfnt_noise* n)
+{
+  int i;
+  sfnt_sock_put_int64(fd, n->duration);
+  sfnt_sock_put_int64(fd, n->threshold);
+  sfnt_sock_put_int64(fd, n->n_gaps);
+  sfnt_sock_put_int64(fd, n->stolen);
+  sfnt_sock_put_int64(fd, n->max_gap);
+  for( i = 0; i < SFNT_NOISE_BUCKETS; ++i )
+    sfnt_sock_put_int64(fd, n->buckets[i]);
+}
+
+
+void sfnt_noise_get(int fd, struct sfnt_noise* n)
+{
+  int i;
+  n->duration = sfnt_sock_get_int64(fd);
+  n->threshold = sfnt_sock_get_int64(fd);
+  n->n_gaps = sfnt_sock_get_int64(fd);
+  n->stolen = sfnt_sock_get_int64(fd);
+  n->max_gap = sfnt_sock_get_int64(fd);
+  for( i = 0; i < SFNT_NOISE_BUCKETS; ++i )
+    n->buckets[i] = sfnt_sock_get_int64(fd);
+}
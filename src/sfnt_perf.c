@@ -0,0 +1,327 @@
+/**************************************************************************\
+*    Filename: sfnt_perf.c
+* Description: Performance counters and per-thread CPU and scheduler stats.
+*   Copyright: (C) 2012-2023 Advanced Micro Devices, Inc.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation, incorporated herein by reference.
+\**************************************************************************/
+
+#define _GNU_SOURCE
+#include "sfnettest.h"
+#ifdef __linux__
+# include <sys/resource.h>
+#endif
+
+
+#if NT_HAVE_PERF_EVENT
+
+struct perf_event_desc {
+  const char* name;
+  uint32_t    type;
+  uint64_t    config;
+};
+
+
+#define HW(x)        PERF_TYPE_HARDWARE, PERF_COUNT_HW_##x
+#define SW(x)        PERF_TYPE_SOFTWARE, PERF_COUNT_SW_##x
+#define HW_CACHE(cache, op, result)                                     \
+  PERF_TYPE_HW_CACHE, (PERF_COUNT_HW_CACHE_##cache |                    \
+                       (PERF_COUNT_HW_CACHE_OP_##op << 8) |             \
+                       (PERF_COUNT_HW_CACHE_RESULT_##result << 16))
+
+static const struct perf_event_desc perf_events[] = {
+  { "cycles",           HW(CPU_CYCLES) },
+  { "instructions",     HW(INSTRUCTIONS) },
+  { "cache-references", HW(CACHE_REFERENCES) },
+  { "cache-misses",     HW(CACHE_MISSES) },
+  { "branches",         HW(BRANCH_INSTRUCTIONS) },
+  { "branch-misses",    HW(BRANCH_MISSES) },
+  { "l1d-misses",       HW_CACHE(L1D, READ, MISS) },
+  { "llc-misses",       HW_CACHE(LL, READ, MISS) },
+  { "context-switches", SW(CONTEXT_SWITCHES) },
+  { "cpu-migrations",   SW(CPU_MIGRATIONS) },
+  { "page-faults",      SW(PAGE_FAULTS) },
+  { "task-clock",       SW(TASK_CLOCK) },
+};
+#define N_PERF_EVENTS  (sizeof(perf_events) / sizeof(perf_events[0]))
+
+
+static const struct perf_event_desc* perf_event_find(const char* name,
+                                                     int len)
+{
+  unsigned i;
+  for( i = 0; i < N_PERF_EVENTS; ++i )
+    if( strlen(perf_events[i].name) == len &&
+        ! strncasecmp(perf_events[i].name, name, len) )
+      return &perf_events[i];
+  return NULL;
+}
+
+
+static int perf_event_open(const struct perf_event_desc* d, int group_fd)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = d->type;
+  attr.config = d->config;
+  attr.disabled = group_fd < 0;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  /* Count on this thread, wherever it runs. */
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+
+int sfnt_perf_open(struct sfnt_perf* p, const char* events)
+{
+  const struct perf_event_desc* d;
+  const char* s = events;
+  const char* end;
+  int i, len;
+
+  memset(p, 0, sizeof(*p));
+  p->leader = -1;
+  while( *s != '\0' ) {
+    if( (end = strchr(s, ',')) == NULL )
+      end = s + strlen(s);
+    len = end - s;
+    if( p->n == SFNT_PERF_MAX || (d = perf_event_find(s, len)) == NULL ) {
+      p->n = 0;
+      return -EINVAL;
+    }
+    p->names[p->n++] = d->name;
+    s = *end ? end + 1 : end;
+  }
+  if( p->n == 0 )
+    return -EINVAL;
+
+  /* Counters are opened as a group, so that they are scheduled together
+   * and can be read and enabled with a single system call.  Those that
+   * cannot be opened (eg. hardware counters in a VM) are left out.
+   */
+  for( i = 0; i < p->n; ++i ) {
+    d = perf_event_find(p->names[i], strlen(p->names[i]));
+    if( (p->fds[i] = perf_event_open(d, p->leader)) < 0 ) {
+      p->errs[i] = errno;
+      continue;
+    }
+    if( p->leader < 0 )
+      p->leader = p->fds[i];
+    p->slot[i] = p->n_open++;
+  }
+  return 0;
+}
+
+
+void sfnt_perf_close(struct sfnt_perf* p)
+{
+  int i;
+  for( i = 0; i < p->n; ++i )
+    if( p->fds[i] >= 0 )
+      close(p->fds[i]);
+  p->n = 0;
+  p->n_open = 0;
+  p->leader = -1;
+}
+
+
+void sfnt_perf_enable(const struct sfnt_perf* p)
+{
+  if( p->leader >= 0 )
+    NT_TRY(ioctl(p->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP));
+}
+
+
+void sfnt_perf_disable(const struct sfnt_perf* p)
+{
+  if( p->leader >= 0 )
+    NT_TRY(ioctl(p->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP));
+}
+
+
+void sfnt_perf_sample(const struct sfnt_perf* p, struct sfnt_perf_sample* s)
+{
+  uint64_t buf[3 + SFNT_PERF_MAX];
+  ssize_t len = (3 + p->n_open) * sizeof(buf[0]);
+  int i;
+
+  memset(s, 0, sizeof(*s));
+  if( p->leader < 0 )
+    return;
+  NT_TESTi3(read(p->leader, buf, len), ==, len);
+  s->enabled = buf[1];
+  s->running = buf[2];
+  for( i = 0; i < p->n_open; ++i )
+    s->vals[i] = buf[3 + i];
+}
+
+#else
+
+int sfnt_perf_open(struct sfnt_perf* p, const char* events)
+{
+  memset(p, 0, sizeof(*p));
+  p->leader = -1;
+  return -ENOSYS;
+}
+
+
+void sfnt_perf_close(struct sfnt_perf* p)
+{
+}
+
+
+void sfnt_perf_enable(const struct sfnt_perf* p)
+{
+}
+
+
+void sfnt_perf_disable(const struct sfnt_perf* p)
+{
+}
+
+
+void sfnt_perf_sample(const struct sfnt_perf* p, struct sfnt_perf_sample* s)
+{
+  memset(s, 0, sizeof(*s));
+}
+
+#endif
+
+
+void sfnt_perf_delta(const struct sfnt_perf* p,
+                     const struct sfnt_perf_sample* before,
+                     const struct sfnt_perf_sample* after, int64_t* deltas)
+{
+  uint64_t enabled = after->enabled - before->enabled;
+  uint64_t running = after->running - before->running;
+  double scale = running ? (double) enabled / running : 0;
+  int i;
+
+  /* If the kernel had to multiplex the counters then they only ran for
+   * part of the time, so scale up.
+   */
+  for( i = 0; i < p->n; ++i )
+    if( p->fds[i] < 0 || (enabled && ! running) )
+      deltas[i] = -1;
+    else
+      deltas[i] = (int64_t) ((after->vals[p->slot[i]] -
+                              before->vals[p->slot[i]]) * scale + 0.5);
+}
+
+
+void sfnt_perf_print_unavailable(FILE* f, const char* who,
+                                 const struct sfnt_perf* p)
+{
+  int i;
+  for( i = 0; i < p->n; ++i )
+    if( p->fds[i] < 0 )
+      fprintf(f, "# WARNING: %s: perf counter '%s' unavailable (%d %s)\n",
+              who, p->names[i], p->errs[i], strerror(p->errs[i]));
+}
+
+
+void sfnt_cpu_usage_thread(struct sfnt_cpu_usage* u)
+{
+#ifdef __linux__
+  struct rusage ru;
+  NT_TRY(getrusage(RUSAGE_THREAD, &ru));
+  u->user = ru.ru_utime.tv_sec * (int64_t) 1000000000 +
+            ru.ru_utime.tv_usec * (int64_t) 1000;
+  u->sys = ru.ru_stime.tv_sec * (int64_t) 1000000000 +
+           ru.ru_stime.tv_usec * (int64_t) 1000;
+#else
+  u->user = u->sys = 0;
+#endif
+}
+
+
+void sfnt_sched_stats_thread(struct sfnt_sched_stats* s)
+{
+  s->run_delay = s->n_runs = s->n_switches = s->n_migrations = -1;
+#ifdef __linux__
+  {
+    unsigned long long run, delay, n_runs, v;
+    struct rusage ru;
+    char line[128];
+    FILE* f;
+
+    /* Time on the CPU, time waiting on a runqueue, number of timeslices. */
+    if( (f = fopen("/proc/thread-self/schedstat", "r")) != NULL ) {
+      if( fscanf(f, "%llu %llu %llu", &run, &delay, &n_runs) == 3 ) {
+        s->run_delay = delay;
+        s->n_runs = n_runs;
+      }
+      fclose(f);
+    }
+    /* Only present if the kernel has CONFIG_SCHED_DEBUG. */
+    if( (f = fopen("/proc/thread-self/sched", "r")) != NULL ) {
+      while( fgets(line, sizeof(line), f) != NULL )
+        if( sscanf(line, "se.nr_migrations : %llu", &v) == 1 ) {
+          s->n_migrations = v;
+          break;
+        }
+      fclose(f);
+    }
+    NT_TRY(getrusage(RUSAGE_THREAD, &ru));
+    s->n_switches = ru.ru_nvcsw + ru.ru_nivcsw;
+  }
+#endif
+}
+
+
+static int64_t sched_stat_sub(int64_t a, int64_t b)
+{
+  return a < 0 || b < 0 ? -1 : a - b;
+}
+
+
+void sfnt_sched_stats_delta(const struct sfnt_sched_stats* before,
+                            const struct sfnt_sched_stats* after,
+                            struct sfnt_sched_stats* delta)
+{
+  delta->run_delay = sched_stat_sub(after->run_delay, before->run_delay);
+  delta->n_runs = sched_stat_sub(after->n_runs, before->n_runs);
+  delta->n_switches = sched_stat_sub(after->n_switches, before->n_switches);
+  delta->n_migrations = sched_stat_sub(after->n_migrations,
+                                       before->n_migrations);
+}
+
+
+static void sched_stat_add(int64_t* sum, int64_t v)
+{
+  if( v < 0 )
+    *sum = -1;
+  else if( *sum >= 0 )
+    *sum += v;
+}
+
+
+void sfnt_sched_stats_add(struct sfnt_sched_stats* sum,
+                          const struct sfnt_sched_stats* delta)
+{
+  sched_stat_add(&sum->run_delay, delta->run_delay);
+  sched_stat_add(&sum->n_runs, delta->n_runs);
+  sched_stat_add(&sum->n_switches, delta->n_switches);
+  sched_stat_add(&sum->n_migrations, delta->n_migrations);
+}
+
+
+void sfnt_sched_stats_put(int fd, const struct sfnt_sched_stats* s)
+{
+  sfnt_sock_put_int64(fd, s->run_delay);
+  sfnt_sock_put_int64(fd, s->n_runs);
+  sfnt_sock_put_int64(fd, s->n_switches);
+  sfnt_sock_put_int64(fd, s->n_migrations);
+}
+
+
+void sfnt_sched_stats_get(int fd, struct sfnt_sched_stats* s)
+{
+  s->run_delay = sfnt_sock_get_int64(fd);
+  s->n_runs = sfnt_sock_get_int64(fd);
+  s->n_switches = sfnt_sock_get_int64(fd);
+  s->n_migrations = sfnt_sock_get_int64(fd);
+}
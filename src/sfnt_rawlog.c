@@ -0,0 +1,322 @@
+/**************************************************************************\
+*    Filename: sfnt_rawlog.c
+* Description: Write and read binary raw results files.
+*   Copyright: (C) 2012-2023 Advanced Micro Devices, Inc.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation, incorporated herein by reference.
+\**************************************************************************/
+
+#define _GNU_SOURCE
+#include "sfnettest.h"
+
+
+/* Values held in the ring.  At 8 bytes each this is 8MB, which is a few
+ * hundred milliseconds of samples at the fastest rates we can measure.
+ */
+#define RAWLOG_RING_SIZE  (1u << 20)
+
+/* Encoded bytes are collected and written out in chunks of this size. */
+#define RAWLOG_BUF_SIZE   (64 * 1024)
+
+/* Longest encoding of a 64-bit value. */
+#define VARINT_MAX        10
+
+
+static int varint_put(uint8_t* p, uint64_t v)
+{
+  int n = 0;
+  while( v >= 0x80 ) {
+    p[n++] = (uint8_t) (v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (uint8_t) v;
+  return n;
+}
+
+
+static uint64_t zigzag(int64_t v)
+{
+  return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+
+static int64_t unzigzag(uint64_t v)
+{
+  return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+
+static void rawlog_flush(struct sfnt_rawlog* rl, const uint8_t* buf, int len)
+{
+  if( len && ! rl->err && fwrite(buf, 1, len, rl->f) != (size_t) len )
+    rl->err = errno ? errno : EIO;
+}
+
+
+/* The writer competes for the CPU with the thread it is supposed to keep
+ * out of the way of, so drop that CPU from the mask it inherited.  The
+ * rest of the mask is kept so the writer stays within taskset, --affinity
+ * and isolcpus restrictions.
+ */
+static void rawlog_move_off_cpu(int cpu)
+{
+#ifdef __linux__
+  cpu_set_t set;
+
+  if( cpu < 0 || cpu >= CPU_SETSIZE ||
+      sched_getaffinity(0, sizeof(set), &set) < 0 )
+    return;
+  CPU_CLR(cpu, &set);
+  /* Stay put if that was the only CPU we were allowed. */
+  if( CPU_COUNT(&set) > 0 )
+    sched_setaffinity(0, sizeof(set), &set);
+#endif
+}
+
+
+static void* rawlog_thread(void* arg)
+{
+  struct sfnt_rawlog* rl = arg;
+  uint64_t prev[SFNT_RAWLOG_MAX_FIELDS];
+  uint64_t head, tail = 0, put_cpu;
+  int64_t v;
+  uint8_t* buf;
+  int len = 0, field = 0, stop, moved = 0;
+
+  NT_TEST((buf = malloc(RAWLOG_BUF_SIZE + VARINT_MAX)) != NULL);
+  memset(prev, 0, sizeof(prev));
+  do {
+    /* The producer is not necessarily the thread that opened the log, so
+     * it tells us where it runs with its first record.
+     */
+    if( ! moved && (put_cpu = sfnt_load_acquire(&rl->put_cpu)) != 0 ) {
+      rawlog_move_off_cpu((int) put_cpu - 1);
+      moved = 1;
+    }
+    /* The caller queues everything before setting [stop], so once we've
+     * seen it one more pass empties the ring.
+     */
+    stop = sfnt_load_acquire(&rl->stop) != 0;
+    head = sfnt_load_acquire(&rl->head);
+    while( tail != head ) {
+      v = rl->ring[tail & rl->ring_mask];
+      /* Unsigned, so that a huge jump wraps rather than overflows. */
+      len += varint_put(buf + len,
+                        zigzag((int64_t) ((uint64_t) v - prev[field])));
+      prev[field] = v;
+      if( ++field == rl->n_fields )
+        field = 0;
+      ++tail;
+      if( len >= RAWLOG_BUF_SIZE ) {
+        sfnt_store_release(&rl->tail, tail);
+        rawlog_flush(rl, buf, len);
+        len = 0;
+      }
+    }
+    sfnt_store_release(&rl->tail, tail);
+    rawlog_flush(rl, buf, len);
+    len = 0;
+    if( ! stop )
+      usleep(1000);
+  } while( ! stop );
+  free(buf);
+  return NULL;
+}
+
+
+int sfnt_rawlog_open(struct sfnt_rawlog* rl, const char* path,
+                     const struct sfnt_tsc_params* tsc, const char* fields,
+                     const char* header)
+{
+  const char* s;
+  int rc;
+
+  memset(rl, 0, sizeof(*rl));
+  rl->n_fields = 1;
+  for( s = fields; *s; ++s )
+    rl->n_fields += *s == ',';
+  if( *fields == '\0' || rl->n_fields > SFNT_RAWLOG_MAX_FIELDS )
+    return -EINVAL;
+  if( (rl->ring = malloc(RAWLOG_RING_SIZE * sizeof(rl->ring[0]))) == NULL )
+    return -ENOMEM;
+  rl->ring_mask = RAWLOG_RING_SIZE - 1;
+  if( (rl->f = fopen(path, "wb")) == NULL ) {
+    rc = -errno;
+    free(rl->ring);
+    return rc;
+  }
+
+  fprintf(rl->f, SFNT_RAWLOG_MAGIC"\n");
+  fprintf(rl->f, "version=%s\n", SFNT_VERSION);
+  fprintf(rl->f, "cmdline=%s\n", sfnt_cmd_line);
+  fprintf(rl->f, "timer=%s\n", sfnt_timer_name(sfnt_timer));
+  fprintf(rl->f, "tsc_hz=%"PRIu64"\n", tsc->hz);
+  fprintf(rl->f, "tsc_cost=%"PRIu64"\n", tsc->tsc_cost);
+  if( header != NULL )
+    fputs(header, rl->f);
+  fprintf(rl->f, "fields=%s\n\n", fields);
+
+  if( (rc = pthread_create(&rl->thread, NULL, rawlog_thread, rl)) != 0 ) {
+    fclose(rl->f);
+    free(rl->ring);
+    return -rc;
+  }
+  return 0;
+}
+
+
+void sfnt_rawlog_put(struct sfnt_rawlog* rl, const int64_t* vals)
+{
+  uint64_t head = rl->head;
+  uint64_t size = rl->ring_mask + 1;
+  int i;
+
+#ifdef __linux__
+  if( head == 0 )
+    sfnt_store_release(&rl->put_cpu, (uint64_t) (sched_getcpu() + 1));
+#endif
+  if( head + rl->n_fields - rl->tail_cached > size ) {
+    rl->tail_cached = sfnt_load_acquire(&rl->tail);
+    if( head + rl->n_fields - rl->tail_cached > size ) {
+      ++rl->n_stalls;
+      do
+        rl->tail_cached = sfnt_load_acquire(&rl->tail);
+      while( head + rl->n_fields - rl->tail_cached > size );
+    }
+  }
+  for( i = 0; i < rl->n_fields; ++i )
+    rl->ring[(head + i) & rl->ring_mask] = vals[i];
+  sfnt_store_release(&rl->head, head + rl->n_fields);
+}
+
+
+int sfnt_rawlog_close(struct sfnt_rawlog* rl)
+{
+  sfnt_store_release(&rl->stop, 1);
+  NT_TESTi3(pthread_join(rl->thread, NULL), ==, 0);
+  if( fclose(rl->f) != 0 && ! rl->err )
+    rl->err = errno;
+  free(rl->ring);
+  rl->ring = NULL;
+  return -rl->err;
+}
+
+
+int sfnt_rawlog_reader_init(struct sfnt_rawlog_reader* r,
+                            const void* buf, size_t len)
+{
+  const char* p = buf;
+  const char* end = p + len;
+  const char* hdr_end;
+  char fields[SFNT_RAWLOG_MAX_FIELDS * 32];
+  char* f;
+  char* next;
+  size_t magic_len = strlen(SFNT_RAWLOG_MAGIC"\n");
+
+  memset(r, 0, sizeof(*r));
+  if( len < magic_len || memcmp(p, SFNT_RAWLOG_MAGIC"\n", magic_len) )
+    return -EINVAL;
+  /* The header ends with an empty line. */
+  for( hdr_end = p + magic_len - 1; ; ++hdr_end ) {
+    if( end - hdr_end < 2 )
+      return -EINVAL;
+    if( hdr_end[0] == '\n' && hdr_end[1] == '\n' )
+      break;
+  }
+  if( (r->header = malloc(hdr_end - p + 2)) == NULL )
+    return -ENOMEM;
+  memcpy(r->header, p, hdr_end - p + 1);
+  r->header[hdr_end - p + 1] = '\0';
+  r->p = (const uint8_t*) hdr_end + 2;
+  r->end = (const uint8_t*) end;
+
+  if( sfnt_rawlog_reader_get(r, "fields", fields, sizeof(fields)) == NULL ) {
+    sfnt_rawlog_reader_free(r);
+    return -EINVAL;
+  }
+  for( f = fields; f != NULL; f = next ) {
+    if( (next = strchr(f, ',')) != NULL )
+      *next++ = '\0';
+    if( r->n_fields == SFNT_RAWLOG_MAX_FIELDS ||
+        strlen(f) >= sizeof(r->fields[0]) ) {
+      sfnt_rawlog_reader_free(r);
+      return -EINVAL;
+    }
+    strcpy(r->fields[r->n_fields++], f);
+  }
+  return 0;
+}
+
+
+void sfnt_rawlog_reader_free(struct sfnt_rawlog_reader* r)
+{
+  free(r->header);
+  r->header = NULL;
+}
+
+
+const char* sfnt_rawlog_reader_get(const struct sfnt_rawlog_reader* r,
+                                   const char* key, char* buf, int buf_len)
+{
+  int key_len = strlen(key), len;
+  const char* line;
+  const char* eol;
+
+  for( line = strchr(r->header, '\n') + 1; *line; line = eol + 1 ) {
+    eol = strchr(line, '\n');
+    if( ! strncmp(line, key, key_len) && line[key_len] == '=' ) {
+      line += key_len + 1;
+      len = eol - line;
+      if( len >= buf_len )
+        len = buf_len - 1;
+      memcpy(buf, line, len);
+      buf[len] = '\0';
+      return buf;
+    }
+  }
+  return NULL;
+}
+
+
+int sfnt_rawlog_reader_field(const struct sfnt_rawlog_reader* r,
+                             const char* name)
+{
+  int i;
+  for( i = 0; i < r->n_fields; ++i )
+    if( ! strcmp(r->fields[i], name) )
+      return i;
+  return -1;
+}
+
+
+int sfnt_rawlog_reader_next(struct sfnt_rawlog_reader* r, int64_t* vals)
+{
+  const uint8_t* p = r->p;
+  uint64_t v;
+  int i, shift;
+
+  if( p == r->end )
+    return 0;
+  for( i = 0; i < r->n_fields; ++i ) {
+    v = 0;
+    for( shift = 0; ; shift += 7 ) {
+      /* The writer was stopped part way through a record. */
+      if( p == r->end ) {
+        r->truncated = 1;
+        r->p = r->end;
+        return 0;
+      }
+      if( shift > 63 )
+        return -EINVAL;
+      v |= (uint64_t) (*p & 0x7f) << shift;
+      if( ! (*p++ & 0x80) )
+        break;
+    }
+    r->prev[i] += (uint64_t) unzigzag(v);
+    vals[i] = (int64_t) r->prev[i];
+  }
+  r->p = p;
+  return 1;
+}
@@ -0,0 +1,263 @@
+/**************************************************************************\
+*    Filename: sfnt_record.c
+* Description: Write results as JSON, CSV or TSV rows.
+*   Copyright: (C) 2012-2023 Advanced Micro Devices, Inc.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation, incorporated herein by reference.
+\**************************************************************************/
+
+#include "sfnettest.h"
+
+
+int sfnt_format_parse(const char* name, enum sfnt_format* format_out)
+{
+  if( ! strcasecmp(name, "text") )
+    *format_out = SFNT_FORMAT_TEXT;
+  else if( ! strcasecmp(name, "json") )
+    *format_out = SFNT_FORMAT_JSON;
+  else if( ! strcasecmp(name, "csv") )
+    *format_out = SFNT_FORMAT_CSV;
+  else if( ! strcasecmp(name, "tsv") )
+    *format_out = SFNT_FORMAT_TSV;
+  else
+    return -EINVAL;
+  return 0;
+}
+
+
+FILE* sfnt_record_take_stdout(void)
+{
+  FILE* f;
+  int fd;
+
+  fflush(stdout);
+  NT_TRY2(fd, dup(fileno(stdout)));
+  NT_TEST((f = fdopen(fd, "w")) != NULL);
+  NT_TRY(dup2(fileno(stderr), fileno(stdout)));
+  return f;
+}
+
+
+void sfnt_record_init(struct sfnt_record* rec, enum sfnt_format format,
+                      FILE* f)
+{
+  memset(rec, 0, sizeof(*rec));
+  rec->format = format;
+  rec->f = f;
+}
+
+
+static void sfnt_record_truncate(struct sfnt_record* rec, int keep)
+{
+  while( rec->n_fields > keep ) {
+    --rec->n_fields;
+    free(rec->fields[rec->n_fields].key);
+    free(rec->fields[rec->n_fields].val);
+  }
+}
+
+
+void sfnt_record_free(struct sfnt_record* rec)
+{
+  sfnt_record_truncate(rec, 0);
+  free(rec->fields);
+  free(rec->columns);
+  rec->fields = NULL;
+  rec->columns = NULL;
+  rec->max_fields = 0;
+}
+
+
+static void sfnt_record_add(struct sfnt_record* rec, const char* key,
+                            const char* val, int is_str)
+{
+  struct sfnt_record_field* fld;
+
+  if( rec->n_fields == rec->max_fields ) {
+    rec->max_fields = rec->max_fields ? rec->max_fields * 2 : 64;
+    rec->fields = realloc(rec->fields,
+                          rec->max_fields * sizeof(rec->fields[0]));
+    NT_TEST(rec->fields != NULL);
+  }
+  fld = &rec->fields[rec->n_fields++];
+  NT_TEST((fld->key = strdup(key)) != NULL);
+  fld->val = NULL;
+  if( val != NULL )
+    NT_TEST((fld->val = strdup(val)) != NULL);
+  fld->is_str = is_str;
+}
+
+
+void sfnt_record_str(struct sfnt_record* rec, const char* key,
+                     const char* val)
+{
+  sfnt_record_add(rec, key, val, 1);
+}
+
+
+void sfnt_record_int(struct sfnt_record* rec, const char* key, int64_t val)
+{
+  char buf[32];
+  sprintf(buf, "%"PRId64, val);
+  sfnt_record_add(rec, key, buf, 0);
+}
+
+
+void sfnt_record_float(struct sfnt_record* rec, const char* key,
+                       double val, int precision)
+{
+  char buf[64];
+
+  /* JSON has no representation for these. */
+  if( isnan(val) || isinf(val) ) {
+    sfnt_record_add(rec, key, NULL, 0);
+    return;
+  }
+  if( precision < 0 )
+    snprintf(buf, sizeof(buf), "%g", val);
+  else
+    snprintf(buf, sizeof(buf), "%.*f", precision, val);
+  sfnt_record_add(rec, key, buf, 0);
+}
+
+
+static void json_put_str(FILE* f, const char* s)
+{
+  fputc('"', f);
+  for( ; *s; ++s )
+    switch( *s ) {
+    case '"':
+    case '\\':
+      fprintf(f, "\\%c", *s);
+      break;
+    case '\n':
+      fputs("\\n", f);
+      break;
+    case '\t':
+      fputs("\\t", f);
+      break;
+    default:
+      if( (unsigned char) *s < 0x20 )
+        fprintf(f, "\\u%04x", *s);
+      else
+        fputc(*s, f);
+      break;
+    }
+  fputc('"', f);
+}
+
+
+static void csv_put_str(FILE* f, const char* s)
+{
+  if( strpbrk(s, ",\"\r\n") == NULL ) {
+    fputs(s, f);
+    return;
+  }
+  fputc('"', f);
+  for( ; *s; ++s ) {
+    if( *s == '"' )
+      fputc('"', f);
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+
+/* TSV has no quoting, so separators in values become spaces. */
+static void tsv_put_str(FILE* f, const char* s)
+{
+  for( ; *s; ++s )
+    fputc(*s == '\t' || *s == '\n' || *s == '\r' ? ' ' : *s, f);
+}
+
+
+static void sfnt_record_write_json(struct sfnt_record* rec)
+{
+  struct sfnt_record_field* fld;
+  int i;
+
+  fputc('{', rec->f);
+  for( i = 0; i < rec->n_fields; ++i ) {
+    fld = &rec->fields[i];
+    if( i )
+      fputc(',', rec->f);
+    json_put_str(rec->f, fld->key);
+    fputc(':', rec->f);
+    if( fld->val == NULL )
+      fputs("null", rec->f);
+    else if( fld->is_str )
+      json_put_str(rec->f, fld->val);
+    else
+      fputs(fld->val, rec->f);
+  }
+  fputs("}\n", rec->f);
+}
+
+
+static void sfnt_record_write_sv(struct sfnt_record* rec)
+{
+  void (*put_str)(FILE*, const char*);
+  char sep;
+  char* columns;
+  size_t len = 1;
+  int i;
+
+  if( rec->format == SFNT_FORMAT_CSV ) {
+    put_str = csv_put_str;
+    sep = ',';
+  }
+  else {
+    put_str = tsv_put_str;
+    sep = '\t';
+  }
+
+  for( i = 0; i < rec->n_fields; ++i )
+    len += strlen(rec->fields[i].key) + 1;
+  NT_TEST((columns = malloc(len)) != NULL);
+  columns[0] = '\0';
+  for( i = 0; i < rec->n_fields; ++i ) {
+    strcat(columns, rec->fields[i].key);
+    strcat(columns, "\n");
+  }
+  if( rec->columns == NULL || strcmp(columns, rec->columns) ) {
+    for( i = 0; i < rec->n_fields; ++i ) {
+      if( i )
+        fputc(sep, rec->f);
+      put_str(rec->f, rec->fields[i].key);
+    }
+    fputc('\n', rec->f);
+    free(rec->columns);
+    rec->columns = columns;
+  }
+  else {
+    free(columns);
+  }
+
+  for( i = 0; i < rec->n_fields; ++i ) {
+    if( i )
+      fputc(sep, rec->f);
+    if( rec->fields[i].val != NULL )
+      put_str(rec->f, rec->fields[i].val);
+  }
+  fputc('\n', rec->f);
+}
+
+
+void sfnt_record_write(struct sfnt_record* rec, int keep)
+{
+  switch( rec->format ) {
+  case SFNT_FORMAT_JSON:
+    sfnt_record_write_json(rec);
+    break;
+  case SFNT_FORMAT_CSV:
+  case SFNT_FORMAT_TSV:
+    sfnt_record_write_sv(rec);
+    break;
+  default:
+    break;
+  }
+  fflush(rec->f);
+  sfnt_record_truncate(rec, keep);
+}
@@ -10,6 +10,7 @@
 \**************************************************************************/
 
 #include "sfnettest.h"
+#include <stddef.h>
 
 
 #ifndef MSG_MORE
@@ -415,6 +416,84 @@ extern int sfnt_sock_uncork(int fd)
 }
 
 
+#if NT_HAVE_TCP_INFO
+/* The kernel's struct tcp_info, up to tcpi_delivery_rate.  The C library's
+ * definition stops before the rate fields, and <linux/tcp.h> clashes with
+ * <netinet/tcp.h>.  The layout is only ever extended, and the kernel
+ * reports how much of it is filled in.
+ */
+struct linux_tcp_info {
+  uint8_t  state, ca_state, retransmits, probes, backoff, options;
+  uint8_t  wscale, flags;
+  uint32_t rto, ato, snd_mss, rcv_mss;
+  uint32_t unacked, sacked, lost, retrans, fackets;
+  uint32_t last_data_sent, last_ack_sent, last_data_recv, last_ack_recv;
+  uint32_t pmtu, rcv_ssthresh, rtt, rttvar, snd_ssthresh, snd_cwnd;
+  uint32_t advmss, reordering, rcv_rtt, rcv_space, total_retrans;
+  uint64_t pacing_rate, max_pacing_rate, bytes_acked, bytes_received;
+  uint32_t segs_out, segs_in, notsent_bytes, min_rtt;
+  uint32_t data_segs_in, data_segs_out;
+  uint64_t delivery_rate;
+};
+
+
+#define TCPI_HAS(len, field)                                            \
+  ((len) >= offsetof(struct linux_tcp_info, field) +                    \
+            sizeof(((struct linux_tcp_info*) 0)->field))
+
+
+int sfnt_tcp_info_read(int sock, struct sfnt_tcp_info* ti)
+{
+  struct linux_tcp_info lti;
+  socklen_t len = sizeof(lti);
+
+  memset(&lti, 0, sizeof(lti));
+  if( getsockopt(sock, IPPROTO_TCP, TCP_INFO, &lti, &len) < 0 )
+    return -errno;
+  ti->rtt = TCPI_HAS(len, rtt) ? lti.rtt : -1;
+  ti->rttvar = TCPI_HAS(len, rttvar) ? lti.rttvar : -1;
+  ti->total_retrans = TCPI_HAS(len, total_retrans) ? lti.total_retrans : -1;
+  ti->unacked = TCPI_HAS(len, unacked) ? lti.unacked : -1;
+  ti->snd_cwnd = TCPI_HAS(len, snd_cwnd) ? lti.snd_cwnd : -1;
+  ti->pacing_rate = TCPI_HAS(len, pacing_rate) ? lti.pacing_rate : -1;
+  ti->delivery_rate = TCPI_HAS(len, delivery_rate) ? lti.delivery_rate : -1;
+  /* ~0 means unlimited. */
+  if( ti->pacing_rate == (int64_t) ~0ULL )
+    ti->pacing_rate = -1;
+  return 0;
+}
+#else
+int sfnt_tcp_info_read(int sock, struct sfnt_tcp_info* ti)
+{
+  return -ENOSYS;
+}
+#endif
+
+
+void sfnt_tcp_info_put(int fd, const struct sfnt_tcp_info* ti)
+{
+  sfnt_sock_put_int64(fd, ti->rtt);
+  sfnt_sock_put_int64(fd, ti->rttvar);
+  sfnt_sock_put_int64(fd, ti->total_retrans);
+  sfnt_sock_put_int64(fd, ti->unacked);
+  sfnt_sock_put_int64(fd, ti->snd_cwnd);
+  sfnt_sock_put_int64(fd, ti->pacing_rate);
+  sfnt_sock_put_int64(fd, ti->delivery_rate);
+}
+
+
+void sfnt_tcp_info_get(int fd, struct sfnt_tcp_info* ti)
+{
+  ti->rtt = sfnt_sock_get_int64(fd);
+  ti->rttvar = sfnt_sock_get_int64(fd);
+  ti->total_retrans = sfnt_sock_get_int64(fd);
+  ti->unacked = sfnt_sock_get_int64(fd);
+  ti->snd_cwnd = sfnt_sock_get_int64(fd);
+  ti->pacing_rate = sfnt_sock_get_int64(fd);
+  ti->delivery_rate = sfnt_sock_get_int64(fd);
+}
+
+
 void sfnt_sock_put_int(int fd, int v)
 {
   int32_t v32 = NT_LE32(v);
@@ -430,6 +509,46 @@ int sfnt_sock_get_int(int fd)
 }
 
 
+void sfnt_sock_put_int64(int fd, int64_t v)
+{
+  uint64_t v64 = NT_LE64((uint64_t) v);
+  NT_TESTi3(send(fd, &v64, sizeof(v64), 0), ==, sizeof(v64));
+}
+
+
+int64_t sfnt_sock_get_int64(int fd)
+{
+  uint64_t v64;
+  NT_TESTi3(recv(fd, &v64, sizeof(v64), MSG_WAITALL), ==, sizeof(v64));
+  return (int64_t) NT_LE64(v64);
+}
+
+
+void sfnt_sock_put_int64s(int fd, const int64_t* v, int n)
+{
+  uint64_t buf[256];
+  int i, n_this;
+  for( ; n > 0; v += n_this, n -= n_this ) {
+    n_this = n < 256 ? n : 256;
+    for( i = 0; i < n_this; ++i )
+      buf[i] = NT_LE64((uint64_t) v[i]);
+    NT_TESTi3(send(fd, buf, n_this * sizeof(buf[0]), 0), ==,
+              n_this * sizeof(buf[0]));
+  }
+}
+
+
+void sfnt_sock_get_int64s(int fd, int64_t* v, int n)
+{
+  int i;
+  if( n > 0 )
+    NT_TESTi3(recv(fd, v, n * sizeof(v[0]), MSG_WAITALL), ==,
+              n * sizeof(v[0]));
+  for( i = 0; i < n; ++i )
+    v[i] = (int64_t) NT_LE64((uint64_t) v[i]);
+}
+
+
 void  sfnt_sock_put_str(int fd, const char* str)
 {
   if( str != NULL ) {
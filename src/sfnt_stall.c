@@ -0,0 +1,265 @@
+/**************************************************************************\
+*    Filename: sfnt_stall.c
+* Description: Attribution of latency outliers to OS events.
+*   Copyright: (C) 2012-2023 Advanced Micro Devices, Inc.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation, incorporated herein by reference.
+\**************************************************************************/
+
+#define _GNU_SOURCE
+#include "sfnettest.h"
+#ifdef __linux__
+# include <sys/resource.h>
+#endif
+
+
+/**********************************************************************
+ * /proc/interrupts and /proc/softirqs.
+ */
+
+static void irq_snap_grow(struct sfnt_irq_snap* s)
+{
+  s->max_lines = s->max_lines ? s->max_lines * 2 : 64;
+  s->names = realloc(s->names, s->max_lines * sizeof(s->names[0]));
+  s->counts = realloc(s->counts,
+                      s->max_lines * s->n_cpus * sizeof(s->counts[0]));
+  NT_TEST(s->names != NULL && s->counts != NULL);
+}
+
+
+int sfnt_irq_snap_read(struct sfnt_irq_snap* s, const char* path)
+{
+#ifdef __linux__
+  char* line = NULL;
+  size_t line_len = 0;
+  char* p;
+  char* end;
+  int n_cpus = 0, i, len;
+  FILE* f;
+
+  if( (f = fopen(path, "r")) == NULL )
+    return -errno;
+
+  /* Header is a list of CPU ids, which may have gaps if some are offline. */
+  if( getline(&line, &line_len, f) < 0 )
+    goto bad;
+  for( p = line; (p = strstr(p, "CPU")) != NULL; p += 3 )
+    ++n_cpus;
+  if( n_cpus == 0 )
+    goto bad;
+  if( n_cpus != s->n_cpus ) {
+    s->n_cpus = n_cpus;
+    s->cpu_ids = realloc(s->cpu_ids, n_cpus * sizeof(s->cpu_ids[0]));
+    s->counts = realloc(s->counts,
+                        s->max_lines * n_cpus * sizeof(s->counts[0]));
+    NT_TEST(s->cpu_ids != NULL);
+    NT_TEST(s->counts != NULL || s->max_lines == 0);
+  }
+  for( p = line, i = 0; (p = strstr(p, "CPU")) != NULL; p += 3 )
+    s->cpu_ids[i++] = atoi(p + 3);
+
+  s->n_lines = 0;
+  while( getline(&line, &line_len, f) >= 0 ) {
+    for( p = line; isspace(*p); ++p )
+      ;
+    if( (end = strchr(p, ':')) == NULL )
+      continue;
+    if( s->n_lines == s->max_lines )
+      irq_snap_grow(s);
+    len = end - p;
+    if( len >= SFNT_IRQ_NAME_LEN )
+      len = SFNT_IRQ_NAME_LEN - 1;
+    memcpy(s->names[s->n_lines], p, len);
+    s->names[s->n_lines][len] = '\0';
+
+    /* Some rows (eg. ERR) have a single total rather than a count per CPU. */
+    p = end + 1;
+    for( i = 0; i < n_cpus; ++i ) {
+      s->counts[s->n_lines * n_cpus + i] = strtoull(p, &end, 10);
+      if( end == p )
+        break;
+      p = end;
+    }
+    for( ; i < n_cpus; ++i )
+      s->counts[s->n_lines * n_cpus + i] = 0;
+
+    /* Numbered device interrupts are more usefully named by the device,
+     * which is the last word of the description.
+     */
+    if( isdigit(s->names[s->n_lines][0]) ) {
+      while( (len = strlen(p)) && isspace(p[len - 1]) )
+        p[len - 1] = '\0';
+      if( len && (end = strrchr(p, ' ')) != NULL && end[1] != '\0' ) {
+        strncpy(s->names[s->n_lines], end + 1, SFNT_IRQ_NAME_LEN - 1);
+        s->names[s->n_lines][SFNT_IRQ_NAME_LEN - 1] = '\0';
+      }
+    }
+    ++s->n_lines;
+  }
+
+  free(line);
+  fclose(f);
+  return 0;
+
+ bad:
+  free(line);
+  fclose(f);
+  return -EINVAL;
+#else
+  return -ENOSYS;
+#endif
+}
+
+
+void sfnt_irq_snap_free(struct sfnt_irq_snap* s)
+{
+  free(s->cpu_ids);
+  free(s->names);
+  free(s->counts);
+  memset(s, 0, sizeof(*s));
+}
+
+
+static int irq_snap_col(const struct sfnt_irq_snap* s, int cpu)
+{
+  int i;
+  for( i = 0; i < s->n_cpus; ++i )
+    if( s->cpu_ids[i] == cpu )
+      return i;
+  return -1;
+}
+
+
+int sfnt_irq_snap_fprint_delta(FILE* f, const struct sfnt_irq_snap* before,
+                               const struct sfnt_irq_snap* after,
+                               const int* cpus, int n_cpus)
+{
+  uint64_t delta;
+  int line, i, col, n = 0;
+
+  if( before->n_lines == 0 || before->n_lines != after->n_lines ||
+      before->n_cpus != after->n_cpus ) {
+    fprintf(f, "?");
+    return -1;
+  }
+  for( line = 0; line < after->n_lines; ++line ) {
+    delta = 0;
+    for( i = 0; i < n_cpus; ++i ) {
+      if( i > 0 && cpus[i] == cpus[0] )
+        continue;
+      if( (col = irq_snap_col(after, cpus[i])) < 0 )
+        continue;
+      delta += after->counts[line * after->n_cpus + col] -
+               before->counts[line * before->n_cpus + col];
+    }
+    if( delta )
+      fprintf(f, "%s%s:%"PRIu64, n++ ? "," : "", after->names[line], delta);
+  }
+  if( n == 0 )
+    fprintf(f, "-");
+  return n;
+}
+
+
+/**********************************************************************
+ * Stall detector.
+ */
+
+static void stall_read_thread(struct sfnt_stall* s, int* cpu,
+                              long* nvcsw, long* nivcsw)
+{
+#ifdef __linux__
+  struct rusage ru;
+  *cpu = sched_getcpu();
+  NT_TRY(getrusage(RUSAGE_THREAD, &ru));
+  *nvcsw = ru.ru_nvcsw;
+  *nivcsw = ru.ru_nivcsw;
+#else
+  *cpu = -1;
+  *nvcsw = *nivcsw = 0;
+#endif
+}
+
+
+static void stall_read_irqs(struct sfnt_stall* s, int i)
+{
+  sfnt_irq_snap_read(&s->irq[i], "/proc/interrupts");
+  sfnt_irq_snap_read(&s->softirq[i], "/proc/softirqs");
+}
+
+
+int sfnt_stall_init(struct sfnt_stall* s, const struct sfnt_tsc_params* tsc,
+                    int64_t threshold, FILE* log, const char* key_name)
+{
+  memset(s, 0, sizeof(*s));
+  s->tsc = tsc;
+  s->threshold = threshold;
+  s->log = log;
+  fprintf(log, "#time(ms)\t%s\tlatency\tcpu\tvcsw\tivcsw\t"
+          "window(us)\tirqs\tsoftirqs\n", key_name);
+  fflush(log);
+  sfnt_stall_rebase(s);
+  return 0;
+}
+
+
+void sfnt_stall_free(struct sfnt_stall* s)
+{
+  int i;
+  for( i = 0; i < 2; ++i ) {
+    sfnt_irq_snap_free(&s->irq[i]);
+    sfnt_irq_snap_free(&s->softirq[i]);
+  }
+}
+
+
+void sfnt_stall_rebase(struct sfnt_stall* s)
+{
+  stall_read_thread(s, &s->cpu, &s->nvcsw, &s->nivcsw);
+  stall_read_irqs(s, s->base);
+  sfnt_tsc(&s->win_ts);
+}
+
+
+int sfnt_stall_check(struct sfnt_stall* s, int64_t lat, double t_ms, int key)
+{
+  int cpus[2];
+  long nvcsw, nivcsw;
+  uint64_t now;
+  int cur = ! s->base;
+
+  /* Nothing is read for samples under the threshold, so that the monitor
+   * does not disturb the test.  The counts logged for a stall are instead
+   * deltas over the window since the previous stall or rebase.
+   */
+  if( lat < s->threshold )
+    return 0;
+
+  cpus[0] = s->cpu;
+  stall_read_thread(s, &cpus[1], &nvcsw, &nivcsw);
+  stall_read_irqs(s, cur);
+  sfnt_tsc(&now);
+
+  fprintf(s->log, "%.3f\t%d\t%"PRId64"\t", t_ms, key, lat);
+  if( cpus[0] == cpus[1] )
+    fprintf(s->log, "%d", cpus[0]);
+  else
+    fprintf(s->log, "%d->%d", cpus[0], cpus[1]);
+  fprintf(s->log, "\t%ld\t%ld\t%"PRId64"\t", nvcsw - s->nvcsw,
+          nivcsw - s->nivcsw, sfnt_tsc_usec(s->tsc, now - s->win_ts));
+  sfnt_irq_snap_fprint_delta(s->log, &s->irq[s->base], &s->irq[cur], cpus, 2);
+  fprintf(s->log, "\t");
+  sfnt_irq_snap_fprint_delta(s->log, &s->softirq[s->base], &s->softirq[cur],
+                             cpus, 2);
+  fprintf(s->log, "\n");
+  fflush(s->log);
+  ++s->n_stalls;
+
+  /* Start the next window from here, including the time spent logging. */
+  s->base = cur;
+  stall_read_thread(s, &s->cpu, &s->nvcsw, &s->nivcsw);
+  sfnt_tsc(&s->win_ts);
+  return 1;
+}
@@ -131,4 +131,138 @@ void sfnt_iarray_variance_int64(const int64_t* start, const int64_t* end,
   }
 
   *variance_out = sumsq / (end - start - 1);
-}
\ No newline at end of file
+}
+
+
+/* LSD radix sort, a byte per pass.  Flipping the sign bit makes unsigned
+ * order match signed order.  A byte's histogram does not depend on the
+ * order of the keys, so all are counted in one read of the input, and
+ * passes in which every key has the same byte (eg. the top bytes of
+ * nanosecond latencies) are skipped.
+ */
+void sfnt_sort_int64(int64_t* a, int64_t n)
+{
+  const uint64_t flip = (uint64_t) 1 << 63;
+  int64_t counts[8][256];
+  uint64_t *src, *dst, *buf, *t;
+  int64_t i, sum, c;
+  int pass, shift, b;
+
+  if( n < 2 )
+    return;
+  if( (buf = malloc(n * sizeof(buf[0]))) == NULL ) {
+    qsort(a, n, sizeof(a[0]), sfnt_qsort_compare_int64);
+    return;
+  }
+  src = (uint64_t*) a;
+  dst = buf;
+  memset(counts, 0, sizeof(counts));
+  for( i = 0; i < n; ++i )
+    for( pass = 0; pass < 8; ++pass )
+      ++counts[pass][((src[i] ^ flip) >> (pass * 8)) & 0xff];
+
+  for( pass = 0; pass < 8; ++pass ) {
+    shift = pass * 8;
+    if( counts[pass][((src[0] ^ flip) >> shift) & 0xff] == n )
+      continue;
+    for( b = 0, sum = 0; b < 256; ++b ) {
+      c = counts[pass][b];
+      counts[pass][b] = sum;
+      sum += c;
+    }
+    for( i = 0; i < n; ++i )
+      dst[counts[pass][((src[i] ^ flip) >> shift) & 0xff]++] = src[i];
+    t = src;
+    src = dst;
+    dst = t;
+  }
+  if( src != (uint64_t*) a )
+    memcpy(a, src, n * sizeof(a[0]));
+  free(buf);
+}
+
+
+void sfnt_sort_int(int* a, int64_t n)
+{
+  const uint32_t flip = (uint32_t) 1 << 31;
+  int64_t counts[4][256];
+  uint32_t *src, *dst, *buf, *t;
+  int64_t i, sum, c;
+  int pass, shift, b;
+
+  if( n < 2 )
+    return;
+  if( (buf = malloc(n * sizeof(buf[0]))) == NULL ) {
+    qsort(a, n, sizeof(a[0]), sfnt_qsort_compare_int);
+    return;
+  }
+  src = (uint32_t*) a;
+  dst = buf;
+  memset(counts, 0, sizeof(counts));
+  for( i = 0; i < n; ++i )
+    for( pass = 0; pass < 4; ++pass )
+      ++counts[pass][((src[i] ^ flip) >> (pass * 8)) & 0xff];
+
+  for( pass = 0; pass < 4; ++pass ) {
+    shift = pass * 8;
+    if( counts[pass][((src[0] ^ flip) >> shift) & 0xff] == n )
+      continue;
+    for( b = 0, sum = 0; b < 256; ++b ) {
+      c = counts[pass][b];
+      counts[pass][b] = sum;
+      sum += c;
+    }
+    for( i = 0; i < n; ++i )
+      dst[counts[pass][((src[i] ^ flip) >> shift) & 0xff]++] = src[i];
+    t = src;
+    src = dst;
+    dst = t;
+  }
+  if( src != (uint32_t*) a )
+    memcpy(a, src, n * sizeof(a[0]));
+  free(buf);
+}
+
+
+/* xorshift64* -- fast, and plenty good enough for scheduling and
+ * resampling.
+ */
+static uint64_t rand_state = 88172645463325252ull;
+
+
+uint64_t sfnt_rand_seed(uint64_t seed)
+{
+  if( seed == 0 )
+    seed = monotonic_clock() ^ ((uint64_t) getpid() << 32);
+  rand_state = seed ? seed : 1;
+  return seed;
+}
+
+
+uint64_t sfnt_rand_u64(void)
+{
+  uint64_t x = rand_state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  rand_state = x;
+  return x * 2685821657736338717ull;
+}
+
+
+double sfnt_rand_uniform(void)
+{
+  return ((sfnt_rand_u64() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+
+void sfnt_rand_shuffle(int* array, int n)
+{
+  int i, j, tmp;
+  for( i = n - 1; i > 0; --i ) {
+    j = (int) (sfnt_rand_u64() % (i + 1));
+    tmp = array[i];
+    array[i] = array[j];
+    array[j] = tmp;
+  }
+}
@@ -10,6 +10,15 @@
 \**************************************************************************/
 
 #include "sfnettest.h"
+#if defined(__unix__) || defined(__APPLE__)
+# include <sys/utsname.h>
+# include <time.h>
+#endif
+#ifdef __linux__
+# include <dirent.h>
+# include <linux/ethtool.h>
+# include <linux/sockios.h>
+#endif
 
 
 extern char** environ;
@@ -59,6 +68,27 @@ static void sfnt_dump_env_with_prefix(FILE* f, const char* pf,
 #endif
 
 
+/* Append [item] to the list in [buf], separated by "; ". */
+static void sfnt_list_add(char* buf, int buf_len, const char* item)
+{
+  int len = strlen(buf);
+  snprintf(buf + len, buf_len - len, "%s%s", len ? "; " : "", item);
+}
+
+
+#if defined(__unix__) || defined(__APPLE__)
+static void sfnt_list_env_with_prefix(char* buf, int buf_len,
+                                      const char* env_prefix)
+{
+  int env_prefix_len = strlen(env_prefix);
+  char** p;
+  for( p = environ; *p != NULL; ++p )
+    if( strncmp(env_prefix, *p, env_prefix_len) == 0 )
+      sfnt_list_add(buf, buf_len, *p);
+}
+#endif
+
+
 static void sfnt_onload_info_dump(FILE* f, const char* pf)
 {
 #if NT_SUPPORTS_ONLOAD
@@ -70,6 +100,186 @@ static void sfnt_onload_info_dump(FILE* f, const char* pf)
 }
 
 
+#if defined(__unix__) || defined(__APPLE__)
+static void sfnt_dump_date_uname(struct sfnt_record* rec)
+{
+  struct utsname u;
+  time_t now = time(NULL);
+  char buf[64], un[5 * sizeof(u.sysname) + 8];
+
+  if( strftime(buf, sizeof(buf), "%a %b %e %H:%M:%S %Z %Y",
+               localtime(&now)) ) {
+    if( rec != NULL )
+      sfnt_record_str(rec, "sys.date", buf);
+    else
+      sfnt_out("# date: %s\n", buf);
+  }
+  if( uname(&u) == 0 ) {
+    snprintf(un, sizeof(un), "%s %s %s %s %s", u.sysname, u.nodename,
+             u.release, u.version, u.machine);
+    if( rec != NULL )
+      sfnt_record_str(rec, "sys.uname", un);
+    else
+      sfnt_out("# uname: %s\n", un);
+  }
+}
+#endif
+
+
+#ifdef __linux__
+/* Find the first line of [path] that starts with [key]. */
+static const char* sfnt_read_file_line(const char* path, const char* key,
+                                       char* line, int line_len)
+{
+  const char* ret = NULL;
+  FILE* f;
+  int len;
+
+  if( (f = fopen(path, "r")) == NULL )
+    return NULL;
+  while( fgets(line, line_len, f) != NULL )
+    if( ! strncmp(line, key, strlen(key)) ) {
+      len = strlen(line);
+      if( len && line[len - 1] == '\n' )
+        line[len - 1] = '\0';
+      ret = line;
+      break;
+    }
+  fclose(f);
+  return ret;
+}
+
+
+/* The part of a "key: value" line after the colon, or NULL. */
+static const char* sfnt_line_value(const char* line)
+{
+  if( line == NULL || (line = strchr(line, ':')) == NULL )
+    return NULL;
+  return line + 1 + strspn(line + 1, " \t");
+}
+
+
+/* Log the first line of [path] that starts with [key]. */
+static void sfnt_dump_file_line(const char* pf, const char* path,
+                                const char* key)
+{
+  char line[256];
+  if( sfnt_read_file_line(path, key, line, sizeof(line)) != NULL )
+    sfnt_out("%s%s\n", pf, line);
+}
+
+
+static void sfnt_read_sys_str(const char* dir, const char* name, char* buf,
+                              int buf_len)
+{
+  char path[512];
+  FILE* f;
+  int len;
+
+  buf[0] = '\0';
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  if( (f = fopen(path, "r")) == NULL )
+    return;
+  if( fgets(buf, buf_len, f) == NULL )
+    buf[0] = '\0';
+  fclose(f);
+  len = strlen(buf);
+  while( len && isspace(buf[len - 1]) )
+    buf[--len] = '\0';
+}
+
+
+static int sfnt_not_dot(const struct dirent* ent)
+{
+  return ent->d_name[0] != '.';
+}
+
+
+/* Network controllers (PCI class 0x02) and the drivers bound to them.
+ * Logged, or appended to [list] if it is not NULL.
+ */
+static void sfnt_dump_pci_net(char* list, int list_len)
+{
+  const char* root = "/sys/bus/pci/devices";
+  char dir[512], class[16], vendor[16], device[16], driver[256], item[1024];
+  struct dirent** ents;
+  const char* drv;
+  int i, n, len;
+
+  if( (n = scandir(root, &ents, sfnt_not_dot, alphasort)) < 0 )
+    return;
+  for( i = 0; i < n; ++i ) {
+    snprintf(dir, sizeof(dir), "%s/%s", root, ents[i]->d_name);
+    sfnt_read_sys_str(dir, "class", class, sizeof(class));
+    if( ! strncmp(class, "0x02", 4) ) {
+      sfnt_read_sys_str(dir, "vendor", vendor, sizeof(vendor));
+      sfnt_read_sys_str(dir, "device", device, sizeof(device));
+      strcat(dir, "/driver");
+      drv = "-";
+      if( (len = readlink(dir, driver, sizeof(driver) - 1)) > 0 ) {
+        driver[len] = '\0';
+        drv = strrchr(driver, '/') ? strrchr(driver, '/') + 1 : driver;
+      }
+      snprintf(item, sizeof(item), "%s class=%s vendor=%s device=%s driver=%s",
+               ents[i]->d_name, class, vendor, device, drv);
+      if( list != NULL )
+        sfnt_list_add(list, list_len, item);
+      else
+        sfnt_out("# pci: %s\n", item);
+    }
+    free(ents[i]);
+  }
+  free(ents);
+}
+
+
+/* Driver details of each interface, as from "ethtool -i".  The ioctl is
+ * made on a unix socket, which the kernel passes through to the device,
+ * so as not to create an accelerated socket under an LD_PRELOAD stack.
+ * Logged, or appended to [list] if it is not NULL.
+ */
+static void sfnt_dump_ethtool(char* list, int list_len)
+{
+  struct ethtool_drvinfo di;
+  char item[256];
+  struct dirent** ents;
+  struct ifreq ifr;
+  int i, n, sock;
+
+  if( (sock = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 )
+    return;
+  if( (n = scandir("/sys/class/net", &ents, sfnt_not_dot, alphasort)) < 0 ) {
+    close(sock);
+    return;
+  }
+  for( i = 0; i < n; ++i ) {
+    memset(&ifr, 0, sizeof(ifr));
+    memset(&di, 0, sizeof(di));
+    di.cmd = ETHTOOL_GDRVINFO;
+    ifr.ifr_data = (void*) &di;
+    if( strlen(ents[i]->d_name) < sizeof(ifr.ifr_name) ) {
+      strcpy(ifr.ifr_name, ents[i]->d_name);
+      if( ioctl(sock, SIOCETHTOOL, &ifr) == 0 ) {
+        if( list != NULL ) {
+          snprintf(item, sizeof(item), "%s driver=%s version=%s bus-info=%s",
+                   ifr.ifr_name, di.driver, di.version, di.bus_info);
+          sfnt_list_add(list, list_len, item);
+        }
+        else {
+          sfnt_out("# %s: driver: %s\n", ifr.ifr_name, di.driver);
+          sfnt_out("# %s: version: %s\n", ifr.ifr_name, di.version);
+          sfnt_out("# %s: bus-info: %s\n", ifr.ifr_name, di.bus_info);
+        }
+      }
+    }
+    free(ents[i]);
+  }
+  free(ents);
+  close(sock);
+}
+#endif
+
+
 void sfnt_dump_sys_info(const struct sfnt_tsc_params* tsc_opt)
 {
   const char* ld_preload;
@@ -77,23 +287,24 @@ void sfnt_dump_sys_info(const struct sfnt_tsc_params* tsc_opt)
   if( sfnt_cmd_line )
     sfnt_out("# cmdline: %s\n", sfnt_cmd_line);
   sfnt_dump_ver_info(stdout, "# ");
-  if( ! getenv("SFNT_AVOID_FORK") ) {
+  /* Gathered directly rather than with shell pipelines, so that a run
+   * does not fork (or pollute the caches) just before it starts timing.
+   */
 #if defined(__unix__) || defined(__APPLE__)
-    system("date | sed 's/^/# date: /'");
-    system("uname -a | sed 's/^/# uname: /'");
+  sfnt_dump_date_uname(NULL);
 #endif
 #ifdef __linux__
-    system("cat /proc/cpuinfo | grep 'model name'"
-           " | head -1 | sed 's/^/# cpu: /'");
-    system("PATH=\"/sbin:$PATH\" lspci | grep -i net | sed 's/^/# lspci: /'");
-    system("for if in $(cd /sys/class/net && /bin/ls); do"
-           " ethtool -i $if 2>/dev/null | egrep 'bus-info|driver|^vers'"
-           " | sed \"s/^/# $if: /\"; done");
-    system("grep MemTotal /proc/meminfo | sed 's/^/# ram: /'");
+  sfnt_dump_file_line("# cpu: ", "/proc/cpuinfo", "model name");
+  sfnt_dump_pci_net(NULL, 0);
+  sfnt_dump_ethtool(NULL, 0);
+  sfnt_dump_file_line("# ram: ", "/proc/meminfo", "MemTotal");
 #endif
+  if( tsc_opt != NULL ) {
+    sfnt_out("# tsc_hz: %"PRId64" (%s)\n", tsc_opt->hz, tsc_opt->hz_source);
+    sfnt_out("# timer: %s cost=%.1fns resolution=%.1fns\n",
+             sfnt_timer_name(sfnt_timer), tsc_opt->tsc_cost * 1e9 / tsc_opt->hz,
+             tsc_opt->resolution * 1e9 / tsc_opt->hz);
   }
-  if( tsc_opt != NULL )
-    sfnt_out("# tsc_hz: %"PRId64"\n", tsc_opt->hz);
 #if defined(__unix__) || defined(__APPLE__)
   if( (ld_preload = getenv("LD_PRELOAD")) ) {
     sfnt_out("# LD_PRELOAD=%s\n", ld_preload);
@@ -103,3 +314,58 @@ void sfnt_dump_sys_info(const struct sfnt_tsc_params* tsc_opt)
 #endif
   sfnt_onload_info_dump(stdout, "# ");
 }
+
+
+void sfnt_record_sys_info(struct sfnt_record* rec,
+                          const struct sfnt_tsc_params* tsc_opt)
+{
+  char buf[4096];
+  const char* s;
+
+  sfnt_record_str(rec, "sys.cmdline", sfnt_cmd_line);
+  sfnt_record_str(rec, "sys.version", SFNT_VERSION);
+  sfnt_record_str(rec, "sys.src", SFNT_SRC_CSUM);
+#if defined(__unix__) || defined(__APPLE__)
+  sfnt_dump_date_uname(rec);
+#endif
+#ifdef __linux__
+  s = sfnt_read_file_line("/proc/cpuinfo", "model name", buf, sizeof(buf));
+  sfnt_record_str(rec, "sys.cpu", sfnt_line_value(s));
+  buf[0] = '\0';
+  sfnt_dump_pci_net(buf, sizeof(buf));
+  sfnt_record_str(rec, "sys.pci", buf);
+  buf[0] = '\0';
+  sfnt_dump_ethtool(buf, sizeof(buf));
+  sfnt_record_str(rec, "sys.nics", buf);
+  s = sfnt_read_file_line("/proc/meminfo", "MemTotal", buf, sizeof(buf));
+  sfnt_record_str(rec, "sys.ram", sfnt_line_value(s));
+#endif
+  if( tsc_opt != NULL ) {
+    sfnt_record_int(rec, "sys.tsc_hz", tsc_opt->hz);
+    sfnt_record_str(rec, "sys.tsc_hz_source", tsc_opt->hz_source);
+    sfnt_record_str(rec, "sys.timer", sfnt_timer_name(sfnt_timer));
+    sfnt_record_float(rec, "sys.timer_cost_ns",
+                      tsc_opt->tsc_cost * 1e9 / tsc_opt->hz, 1);
+    sfnt_record_float(rec, "sys.timer_resolution_ns",
+                      tsc_opt->resolution * 1e9 / tsc_opt->hz, 1);
+  }
+  s = NULL;
+#if defined(__unix__) || defined(__APPLE__)
+  s = getenv("LD_PRELOAD");
+#endif
+  sfnt_record_str(rec, "sys.ld_preload", s);
+  s = NULL;
+  buf[0] = '\0';
+#if defined(__unix__) || defined(__APPLE__)
+  if( getenv("LD_PRELOAD") && strstr(getenv("LD_PRELOAD"), "libvma") )
+    sfnt_list_env_with_prefix(buf, sizeof(buf), "VMA_");
+#endif
+#if NT_SUPPORTS_ONLOAD
+  if( &onload_version )
+    s = onload_version;
+  if( sfnt_onload_is_active() )
+    sfnt_list_env_with_prefix(buf, sizeof(buf), "EF_");
+#endif
+  sfnt_record_str(rec, "sys.onload_version", s);
+  sfnt_record_str(rec, "sys.env", buf);
+}
@@ -0,0 +1,191 @@
+/**************************************************************************\
+*    Filename: sfnt_timeline.c
+* Description: Per-interval latency statistics and heatmaps.
+*   Copyright: (C) 2012-2023 Advanced Micro Devices, Inc.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation, incorporated herein by reference.
+\**************************************************************************/
+
+#include "sfnettest.h"
+
+
+/* Heatmap columns are a quarter of an octave wide: values below 4 have a
+ * column each, and [2^m, 2^(m+1)) is split into 4 columns for m >= 2.
+ */
+#define HEAT_COLS  (64 * 4)
+
+
+static int heat_col(int64_t v)
+{
+  int m = 0;
+  if( v < 4 )
+    return v < 0 ? 0 : (int) v;
+  while( v >> (m + 1) )
+    ++m;
+  return m * 4 + (int) ((v >> (m - 2)) & 3);
+}
+
+
+static int64_t heat_col_lo(int col)
+{
+  int m = col / 4;
+  if( col < 4 )
+    return col;
+  return (int64_t) (4 + col % 4) << (m - 2);
+}
+
+
+static int64_t heat_col_width(int col)
+{
+  if( col < 4 )
+    return 1;
+  return (int64_t) 1 << (col / 4 - 2);
+}
+
+
+int sfnt_timeline_init(struct sfnt_timeline* tl, int64_t interval,
+                       int heatmap)
+{
+  int rc;
+  NT_ASSERT(interval > 0);
+  memset(tl, 0, sizeof(*tl));
+  tl->interval = interval;
+  tl->heatmap = heatmap;
+  if( (rc = sfnt_hist_init(&tl->cur, SFNT_HIST_SUB_BITS)) < 0 )
+    return rc;
+  tl->cur_i = -1;
+  return 0;
+}
+
+
+void sfnt_timeline_free(struct sfnt_timeline* tl)
+{
+  sfnt_hist_free(&tl->cur);
+  free(tl->rows);
+  free(tl->heat);
+  tl->rows = NULL;
+  tl->heat = NULL;
+}
+
+
+void sfnt_timeline_reset(struct sfnt_timeline* tl)
+{
+  sfnt_hist_reset(&tl->cur);
+  tl->cur_i = -1;
+  tl->rows_n = 0;
+  tl->heat_n = 0;
+}
+
+
+static void timeline_add_heat(struct sfnt_timeline* tl, int64_t t, int col,
+                              uint64_t count)
+{
+  struct sfnt_timeline_heat* h;
+  if( tl->heat_n == tl->heat_max ) {
+    tl->heat_max = tl->heat_max ? tl->heat_max * 2 : 1024;
+    tl->heat = realloc(tl->heat, tl->heat_max * sizeof(tl->heat[0]));
+    NT_TEST(tl->heat != NULL);
+  }
+  h = &tl->heat[tl->heat_n++];
+  h->t = t;
+  h->col = col;
+  h->count = count;
+}
+
+
+void sfnt_timeline_flush(struct sfnt_timeline* tl)
+{
+  static const double pcts[] = { 50, 90, 99, 99.9 };
+  struct sfnt_timeline_row* row;
+  uint64_t heat[HEAT_COLS];
+  int64_t vals[4];
+  int i, col;
+
+  if( tl->cur.n == 0 )
+    return;
+
+  if( tl->rows_n == tl->rows_max ) {
+    tl->rows_max = tl->rows_max ? tl->rows_max * 2 : 1024;
+    tl->rows = realloc(tl->rows, tl->rows_max * sizeof(tl->rows[0]));
+    NT_TEST(tl->rows != NULL);
+  }
+  row = &tl->rows[tl->rows_n++];
+  row->t = tl->cur_i * tl->interval;
+  row->n = tl->cur.n;
+  row->mean = tl->cur.mean;
+  row->min = tl->cur.min;
+  row->max = tl->cur.max;
+  sfnt_hist_percentiles(&tl->cur, pcts, vals, 4);
+  row->p50 = vals[0];
+  row->p90 = vals[1];
+  row->p99 = vals[2];
+  row->p999 = vals[3];
+
+  if( tl->heatmap ) {
+    /* Histogram buckets nest within heatmap columns, so the lower bound of
+     * each bucket identifies its column exactly.
+     */
+    memset(heat, 0, sizeof(heat));
+    for( i = tl->cur.lo_i; i <= tl->cur.hi_i; ++i )
+      if( tl->cur.counts[i] )
+        heat[heat_col(sfnt_hist_bucket_lo(&tl->cur, i))] += tl->cur.counts[i];
+    for( col = 0; col < HEAT_COLS; ++col )
+      if( heat[col] )
+        timeline_add_heat(tl, row->t, col, heat[col]);
+  }
+
+  sfnt_hist_reset(&tl->cur);
+}
+
+
+void sfnt_timeline_record(struct sfnt_timeline* tl, int64_t t, int64_t v)
+{
+  int64_t i = t / tl->interval;
+  if( i != tl->cur_i ) {
+    sfnt_timeline_flush(tl);
+    tl->cur_i = i;
+  }
+  sfnt_hist_record(&tl->cur, v);
+}
+
+
+int sfnt_timeline_write(const struct sfnt_timeline* tl, FILE* f,
+                        int64_t t_base, int64_t offset, int header)
+{
+  const struct sfnt_timeline_row* r;
+  int i;
+
+  if( header )
+    fprintf(f, "#time(ms)\tn\tmean\tmin\tp50\tp90\tp99\tp99.9\tmax\n");
+  for( i = 0; i < tl->rows_n; ++i ) {
+    r = &tl->rows[i];
+    fprintf(f, "%.3f\t%"PRIu64"\t%"PRId64"\t%"PRId64"\t%"PRId64"\t%"PRId64
+            "\t%"PRId64"\t%"PRId64"\t%"PRId64"\n",
+            (r->t - t_base) * 1e-6, r->n, (int64_t) r->mean + offset,
+            r->min + offset, r->p50 + offset, r->p90 + offset,
+            r->p99 + offset, r->p999 + offset, r->max + offset);
+  }
+  return ferror(f) ? -EIO : 0;
+}
+
+
+int sfnt_timeline_write_heatmap(const struct sfnt_timeline* tl, FILE* f,
+                                int64_t t_base, int64_t offset, int header)
+{
+  const struct sfnt_timeline_heat* h;
+  int64_t lo;
+  int i;
+
+  if( header )
+    fprintf(f, "#time(ms)\tlo(ns)\thi(ns)\tcount\n");
+  for( i = 0; i < tl->heat_n; ++i ) {
+    h = &tl->heat[i];
+    lo = heat_col_lo(h->col);
+    fprintf(f, "%.3f\t%"PRId64"\t%"PRId64"\t%"PRIu64"\n",
+            (h->t - t_base) * 1e-6, lo + offset,
+            lo + heat_col_width(h->col) + offset, h->count);
+  }
+  return ferror(f) ? -EIO : 0;
+}
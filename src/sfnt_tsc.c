@@ -10,6 +10,335 @@
 \**************************************************************************/
 
 #include "sfnettest.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <cpuid.h>
+# define HAVE_X86_TSC  1
+#else
+# define HAVE_X86_TSC  0
+#endif
+
+
+enum sfnt_timer sfnt_timer = SFNT_TIMER_TSC;
+
+static const char* const timer_names[] = {
+  "tsc", "tsc-lfence", "rdtscp", "monotonic", "monotonic-raw", "tai",
+};
+#define N_TIMERS  (sizeof(timer_names) / sizeof(timer_names[0]))
+
+/* Number of back-to-back reads used to measure the cost of sfnt_tsc(). */
+#define COST_READS  256
+
+
+static int timer_available(enum sfnt_timer t)
+{
+  switch( t ) {
+  case SFNT_TIMER_TSC:
+    return 1;
+#if HAVE_X86_TSC
+  case SFNT_TIMER_TSC_LFENCE:
+    return 1;
+  case SFNT_TIMER_RDTSCP: {
+    unsigned a, b, c, d;
+    return __get_cpuid(0x80000001, &a, &b, &c, &d) && (d & (1u << 27));
+  }
+#endif
+#ifdef CLOCK_MONOTONIC
+  case SFNT_TIMER_MONOTONIC:
+    return 1;
+#endif
+#ifdef CLOCK_MONOTONIC_RAW
+  case SFNT_TIMER_MONOTONIC_RAW:
+    return 1;
+#endif
+#ifdef CLOCK_TAI
+  case SFNT_TIMER_TAI:
+    return 1;
+#endif
+  default:
+    return 0;
+  }
+}
+
+
+int sfnt_timer_select(const char* name)
+{
+  unsigned i;
+  for( i = 0; i < N_TIMERS; ++i )
+    if( ! strcasecmp(name, timer_names[i]) ) {
+      if( ! timer_available(i) )
+        return -ENOSYS;
+      sfnt_timer = i;
+      return 0;
+    }
+  return -EINVAL;
+}
+
+
+const char* sfnt_timer_name(enum sfnt_timer t)
+{
+  return (unsigned) t < N_TIMERS ? timer_names[t] : "?";
+}
+
+
+#ifdef CLOCK_MONOTONIC
+static inline uint64_t timer_clock(clockid_t id)
+{
+  struct timespec t;
+  clock_gettime(id, &t);
+  return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+#endif
+
+
+void sfnt_timer_read(uint64_t* pval)
+{
+  switch( sfnt_timer ) {
+#if HAVE_X86_TSC
+  case SFNT_TIMER_TSC_LFENCE: {
+    uint32_t lo, hi;
+    __asm__ __volatile__("lfence; rdtsc" : "=a" (lo), "=d" (hi) :: "memory");
+    *pval = ((uint64_t) hi << 32) | lo;
+    break;
+  }
+  case SFNT_TIMER_RDTSCP: {
+    uint32_t lo, hi, aux;
+    __asm__ __volatile__("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux)
+                         :: "memory");
+    *pval = ((uint64_t) hi << 32) | lo;
+    break;
+  }
+#endif
+#ifdef CLOCK_MONOTONIC
+  case SFNT_TIMER_MONOTONIC:
+    *pval = timer_clock(CLOCK_MONOTONIC);
+    break;
+#endif
+#ifdef CLOCK_MONOTONIC_RAW
+  case SFNT_TIMER_MONOTONIC_RAW:
+    *pval = timer_clock(CLOCK_MONOTONIC_RAW);
+    break;
+#endif
+#ifdef CLOCK_TAI
+  case SFNT_TIMER_TAI:
+    *pval = timer_clock(CLOCK_TAI);
+    break;
+#endif
+  default:
+    sfnt_tsc_hw(pval);
+    break;
+  }
+}
+
+
+/**********************************************************************
+ * Calibration cache.
+ *
+ * An invariant TSC ticks at a constant rate through frequency changes and
+ * idle states, so its calibration holds until the machine reboots or its
+ * CPU or microcode changes.  The result is kept in a file keyed by those,
+ * so that later runs need only a short calibration to check it against,
+ * rather than a full one.  $SFNT_TSC_CACHE overrides the location of the
+ * file, and if empty disables the cache.
+ */
+
+/* A calibration must take this long to be cached. */
+#define TSC_CACHE_USEC   50000
+/* The cached frequency is used if a calibration over TSC_CHECK_USEC agrees
+ * with it to within TSC_CHECK_PPM, else it is measured again.
+ */
+#define TSC_CHECK_USEC   10000
+#define TSC_CHECK_PPM    1000
+
+#ifdef __linux__
+
+static int tsc_is_invariant(const char* flags)
+{
+  if( sfnt_timer > SFNT_TIMER_RDTSCP )
+    return 0;
+#if HAVE_X86_TSC
+  {
+    unsigned a, b, c, d;
+    if( __get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1u << 8)) )
+      return 1;
+  }
+#endif
+  /* Hypervisors often hide the CPUID bit, but Linux still knows. */
+  return strstr(flags, " constant_tsc") != NULL &&
+         strstr(flags, " nonstop_tsc") != NULL;
+}
+
+
+static void cpuinfo_field(const char* line, const char* name, char* buf,
+                          int buf_len)
+{
+  const char* colon;
+  int len;
+  if( strncmp(line, name, strlen(name)) ||
+      (colon = strchr(line, ':')) == NULL )
+    return;
+  for( ++colon; isspace(*colon); ++colon )
+    ;
+  snprintf(buf, buf_len, "%s", colon);
+  len = strlen(buf);
+  while( len && isspace(buf[len - 1]) )
+    buf[--len] = '\0';
+}
+
+
+/* Returns 0 if the TSC is invariant and [key] identifies this boot. */
+static int tsc_cache_key(char* key, int key_len)
+{
+  char line[4096], model[128] = "", ucode[32] = "", flags[4096] = "";
+  char boot_id[64] = "";
+  FILE* f;
+
+  if( (f = fopen("/proc/cpuinfo", "r")) == NULL )
+    return -1;
+  /* The first processor is enough. */
+  while( fgets(line, sizeof(line), f) != NULL && line[0] != '\n' ) {
+    cpuinfo_field(line, "model name", model, sizeof(model));
+    cpuinfo_field(line, "microcode", ucode, sizeof(ucode));
+    cpuinfo_field(line, "flags", flags + 1, sizeof(flags) - 1);
+  }
+  fclose(f);
+  flags[0] = ' ';
+  if( ! tsc_is_invariant(flags) )
+    return -1;
+
+  if( (f = fopen("/proc/sys/kernel/random/boot_id", "r")) == NULL )
+    return -1;
+  if( fscanf(f, "%63s", boot_id) != 1 )
+    boot_id[0] = '\0';
+  fclose(f);
+  if( boot_id[0] == '\0' )
+    return -1;
+  snprintf(key, key_len, "%s|%s|%s|%s", model, ucode, boot_id,
+           sfnt_timer_name(sfnt_timer));
+  return 0;
+}
+
+
+static const char* tsc_cache_path(char* buf, int buf_len)
+{
+  const char* path = getenv("SFNT_TSC_CACHE");
+  const char* home;
+  if( path != NULL )
+    return path[0] ? path : NULL;
+  if( (home = getenv("HOME")) == NULL )
+    return NULL;
+  snprintf(buf, buf_len, "%s/.sfnettest-tsc", home);
+  return buf;
+}
+
+
+static int tsc_cache_lookup(uint64_t* hz)
+{
+  char path_buf[512], key[512], line[512];
+  unsigned long long v;
+  const char* path;
+  int len, rc = -1;
+  FILE* f;
+
+  if( (path = tsc_cache_path(path_buf, sizeof(path_buf))) == NULL ||
+      tsc_cache_key(key, sizeof(key)) < 0 ||
+      (f = fopen(path, "r")) == NULL )
+    return -1;
+  if( fgets(line, sizeof(line), f) != NULL ) {
+    len = strlen(line);
+    if( len && line[len - 1] == '\n' )
+      line[--len] = '\0';
+    if( ! strcmp(line, key) && fscanf(f, "%llu", &v) == 1 && v ) {
+      *hz = v;
+      rc = 0;
+    }
+  }
+  fclose(f);
+  return rc;
+}
+
+
+static void tsc_cache_store(uint64_t hz)
+{
+  char path_buf[512], tmp[560], key[512];
+  const char* path;
+  FILE* f;
+
+  if( (path = tsc_cache_path(path_buf, sizeof(path_buf))) == NULL ||
+      tsc_cache_key(key, sizeof(key)) < 0 )
+    return;
+  /* Write then rename, as many runs may start at once. */
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+  if( (f = fopen(tmp, "w")) == NULL )
+    return;
+  fprintf(f, "%s\n%"PRIu64"\n", key, hz);
+  if( fclose(f) == 0 && rename(tmp, path) == 0 )
+    return;
+  unlink(tmp);
+}
+
+#else
+
+static int tsc_cache_lookup(uint64_t* hz)
+{
+  return -1;
+}
+
+
+static void tsc_cache_store(uint64_t hz)
+{
+}
+
+#endif
+
+
+/* The clock_gettime() sources count nanoseconds, so need no calibration. */
+static int timer_is_ns(void)
+{
+  return sfnt_timer >= SFNT_TIMER_MONOTONIC;
+}
+
+
+/* Returns true if the frequency of the timer is known without measuring
+ * it, and sets [hz_source] to say how.  Else [hz_source] is "measured", and
+ * [cached] is set to the cached frequency, or 0 if there is none.
+ */
+static int timer_hz_known(struct sfnt_tsc_params* params, uint64_t* cached)
+{
+  if( timer_is_ns() ) {
+    params->hz = 1000000000;
+    params->hz_source = "ns";
+    return 1;
+  }
+#if defined(__GNUC__) && defined(__aarch64__)
+  /* The generic timer's frequency is architected. */
+  {
+    uint64_t hz;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r" (hz));
+    if( hz ) {
+      params->hz = hz;
+      params->hz_source = "cntfrq";
+      return 1;
+    }
+  }
+#endif
+  if( tsc_cache_lookup(cached) < 0 )
+    *cached = 0;
+  params->hz_source = "measured";
+  return 0;
+}
+
+
+/* Returns true, and uses the cached frequency, if [hz] agrees with it. */
+static int tsc_cache_check(struct sfnt_tsc_params* params, uint64_t cached,
+                           uint64_t hz)
+{
+  uint64_t diff = hz > cached ? hz - cached : cached - hz;
+  if( diff > cached / 1000000 * TSC_CHECK_PPM )
+    return 0;
+  params->hz = cached;
+  params->hz_source = "cached";
+  return 1;
+}
 
 
 static void measure_begin(struct sfnt_tsc_measure* measure)
@@ -79,16 +408,64 @@ static uint64_t measure_hz(int interval_usec)
 }
 
 
-static uint64_t measure_tsc(void)
+/* The cost of sfnt_tsc() is taken as the mean step between back-to-back
+ * reads, and its resolution as the smallest non-zero step, each the best of
+ * several runs to discount interrupts.  A coarse counter (eg. a 25MHz
+ * cntvct_el0) often returns the same value twice running, so its cost can
+ * round down to zero ticks while its resolution is one tick.
+ */
+static void measure_tsc(struct sfnt_tsc_params* params)
+{
+  uint64_t t[COST_READS], cost, step;
+  int run, i;
+
+  params->tsc_cost = UINT64_MAX;
+  params->resolution = 0;
+  for( run = 0; run < 10; ++run ) {
+    for( i = 0; i < COST_READS; ++i )
+      sfnt_tsc(&t[i]);
+    cost = (t[COST_READS - 1] - t[0]) / (COST_READS - 1);
+    if( cost < params->tsc_cost )
+      params->tsc_cost = cost;
+    for( i = 1; i < COST_READS; ++i )
+      if( (step = t[i] - t[i - 1]) != 0 &&
+          (params->resolution == 0 || step < params->resolution) )
+        params->resolution = step;
+  }
+}
+
+
+/* Choose the largest shift for which the ticks to nanoseconds multiplier
+ * fits in 32 bits, for the best precision, as the kernel's
+ * clocks_calc_mult_shift() does.
+ */
+static void calc_mult_shift(struct sfnt_tsc_params* params)
 {
-  return 0;  /* ?? TODO */
+  uint64_t mult = 0;
+  uint32_t shift;
+
+  for( shift = 32; shift > 0; --shift ) {
+    mult = (((uint64_t) 1000000000 << shift) + params->hz / 2) / params->hz;
+    if( mult <= UINT32_MAX )
+      break;
+  }
+  params->mult = (uint32_t) mult;
+  params->shift = shift;
 }
 
 
 int sfnt_tsc_get_params(struct sfnt_tsc_params* params)
 {
-  params->hz = measure_hz(100000);
-  params->tsc_cost = measure_tsc();
+  uint64_t cached;
+
+  if( ! timer_hz_known(params, &cached) &&
+      ! (cached && tsc_cache_check(params, cached,
+                                   measure_hz(TSC_CHECK_USEC))) ) {
+    params->hz = measure_hz(100000);
+    tsc_cache_store(params->hz);
+  }
+  calc_mult_shift(params);
+  measure_tsc(params);
 
   return 0;
 }
@@ -103,46 +480,100 @@ void sfnt_tsc_get_params_begin(struct sfnt_tsc_measure* measure)
 int sfnt_tsc_get_params_end(const struct sfnt_tsc_measure* measure,
                             struct sfnt_tsc_params* params, int interval_usec)
 {
-  params->hz = measure_end(measure, interval_usec);
-  params->tsc_cost = measure_tsc();
+  uint64_t cached;
+
+  if( ! timer_hz_known(params, &cached) &&
+      ! (cached && tsc_cache_check(params, cached,
+                                   measure_end(measure, TSC_CHECK_USEC))) ) {
+    /* A stale cache entry is replaced, so measure for long enough. */
+    if( cached && interval_usec < TSC_CACHE_USEC )
+      interval_usec = TSC_CACHE_USEC;
+    params->hz = measure_end(measure, interval_usec);
+    /* Only cache a calibration taken over a decent interval. */
+    if( interval_usec >= TSC_CACHE_USEC )
+      tsc_cache_store(params->hz);
+  }
+  calc_mult_shift(params);
+  measure_tsc(params);
 
   return 0;
 }
 
 
+/* ticks * mult >> shift without overflowing, as in the kernel's
+ * mul_u64_u32_shr().  [shift] is at most 32.
+ */
+static inline uint64_t tsc_to_ns(const struct sfnt_tsc_params* params,
+                                 uint64_t tsc)
+{
+  uint64_t lo = (uint64_t) (uint32_t) tsc * params->mult;
+  uint64_t hi = (tsc >> 32) * params->mult;
+  return (lo >> params->shift) + (hi << (32 - params->shift));
+}
+
+
 int64_t sfnt_tsc_msec(const struct sfnt_tsc_params* params, int64_t tsc)
 {
-  return tsc * 1000 / params->hz;
+  return sfnt_tsc_nsec(params, tsc) / 1000000;
 }
 
 
 int64_t sfnt_tsc_usec(const struct sfnt_tsc_params* params, int64_t tsc)
 {
-  return tsc * 1000000 / params->hz;
+  return sfnt_tsc_nsec(params, tsc) / 1000;
 }
 
 
 int64_t sfnt_tsc_nsec(const struct sfnt_tsc_params* params, int64_t tsc)
 {
-  return tsc * 1000000000 / params->hz;
+  if( tsc < 0 )
+    return -(int64_t) tsc_to_ns(params, -(uint64_t) tsc);
+  return tsc_to_ns(params, tsc);
+}
+
+
+void sfnt_tsc_nsec_batch(const struct sfnt_tsc_params* params,
+                         const int64_t* tsc, int64_t* nsec, int n)
+{
+  uint64_t mag;
+  int64_t sign;
+  int i;
+
+  /* No branches, so that the compiler is free to vectorise. */
+  for( i = 0; i < n; ++i ) {
+    sign = tsc[i] >> 63;
+    mag = (tsc[i] ^ sign) - sign;
+    nsec[i] = ((int64_t) tsc_to_ns(params, mag) ^ sign) - sign;
+  }
+}
+
+
+/* Convert [v] in units of 1/[per_sec] seconds to ticks.  Whole seconds
+ * are converted separately so that the products cannot overflow.
+ */
+static int64_t to_tsc(const struct sfnt_tsc_params* params, int64_t v,
+                      int64_t per_sec)
+{
+  return (v / per_sec) * (int64_t) params->hz +
+         (v % per_sec) * (int64_t) params->hz / per_sec;
 }
 
 
 int64_t sfnt_msec_tsc(const struct sfnt_tsc_params* params, int64_t msecs)
 {
-  return params->hz * msecs / 1000;
+  return to_tsc(params, msecs, 1000);
 }
 
 
 int64_t sfnt_usec_tsc(const struct sfnt_tsc_params* params, int64_t usecs)
 {
-  return params->hz * usecs / 1000000;
+  return to_tsc(params, usecs, 1000000);
 }
 
 
 int64_t sfnt_nsec_tsc(const struct sfnt_tsc_params* params, int64_t nsecs)
 {
-  return params->hz * nsecs / 1000000000;
+  return to_tsc(params, nsecs, 1000000000);
 }
 
 